@@ -4,13 +4,28 @@ using UnityEngine.Events;
 namespace uNvEncoder
 {
 
+// Times in info are Lib.GetClockMicroseconds() values, so the capture-to-output
+// latency is info.drainTime minus the clock value taken at capture.
+public struct EncodedFrame
+{
+    public System.IntPtr data;
+    public EncodedDataInfo info;
+}
+
 [System.Serializable]
 public class Encoder
 {
     [System.Serializable]
     public class EncodedCallback : UnityEvent<System.IntPtr, int> {};
     public EncodedCallback onEncoded = new EncodedCallback();
+    [System.Serializable]
+    public class EncodedFrameCallback : UnityEvent<EncodedFrame> {};
+    public EncodedFrameCallback onEncodedFrame = new EncodedFrameCallback();
     public bool outputError = false;
+    // onEncodedFrame costs one more native call per packet, so it is opt-in.
+    public bool outputFrameInfo = false;
+
+    EncodedPacket[] packets_ = new EncodedPacket[64];
 
     public int id { get; private set; } = -1;
 
@@ -19,6 +34,11 @@ public class Encoder
         get { return Lib.IsValid(id); }
     }
 
+    public EncoderState state
+    {
+        get { return Lib.GetState(id); }
+    }
+
     public int width
     {
         get { return Lib.GetWidth(id); }
@@ -39,6 +59,39 @@ public class Encoder
         get { return Lib.GetFrameRate(id); }
     }
 
+    public int bitRate
+    {
+        get { return Lib.GetBitRate(id); }
+    }
+
+    // SPS/PPS of the current configuration in Annex-B format, available as
+    // soon as the encoder is created and refreshed by Reconfigure().
+    public byte[] sequenceParams
+    {
+        get 
+        { 
+            var size = Lib.GetSequenceParams(id, null, 0);
+            var buffer = new byte[size];
+            if (size > 0) Lib.GetSequenceParams(id, buffer, size);
+            return buffer;
+        }
+    }
+
+    public bool GetParameterSetInfo(out ParameterSetInfo info)
+    {
+        return Lib.GetParameterSetInfo(id, out info);
+    }
+
+    public ulong droppedFrameCount
+    {
+        get { return Lib.GetDroppedFrameCount(id); }
+    }
+
+    public ulong droppedEncodedDataCount
+    {
+        get { return Lib.GetDroppedEncodedDataCount(id); }
+    }
+
     public string error
     {
         get 
@@ -61,34 +114,186 @@ public class Encoder
         }
     }
 
+    public void CreateAsync(EncoderDesc desc)
+    {
+        id = Lib.CreateAsync(desc);
+    }
+
     public void Destroy()
     {
         Lib.Destroy(id);
     }
 
+    public void DestroyAsync()
+    {
+        Lib.DestroyAsync(id);
+        id = -1;
+    }
+
+    // Hands the encoder back to the pool filled by Lib.FillPool() so that the
+    // next Create() with the same size and format can reuse its session.
+    public void ReturnToPool()
+    {
+        Lib.ReturnToPool(id);
+        id = -1;
+    }
+
     public void Reconfigure(EncoderDesc desc)
     {
-        // Lib.Reconfigure(id, desc);
+        // Bitrate and frame rate changes are applied to the live session;
+        // settings fixed at creation such as the format need a new encoder.
+        if (Lib.Reconfigure(id, desc)) return;
+
+        var msg = error;
+        if (!string.IsNullOrEmpty(msg))
+        {
+            Debug.LogError(msg);
+        }
+
         Destroy();
         Create(desc);
     }
 
+    // Switches the encoded size within maxWidth x maxHeight given at creation;
+    // the next frame is an IDR frame of the new size.
+    public bool SetResolution(int width, int height)
+    {
+        if (Lib.SetResolution(id, width, height)) return true;
+
+        var msg = error;
+        if (!string.IsNullOrEmpty(msg))
+        {
+            Debug.LogError(msg);
+        }
+        return false;
+    }
+
+    // Records to a file from the native encode thread: fragmented MP4 for
+    // .mp4, MPEG-TS for .ts, Matroska for .mkv and the raw H.264 stream
+    // otherwise. .webm is refused since WebM does not allow H.264.
+    // fragmentDuration [ms] sets the MP4 fragment and Matroska cluster
+    // length. Returns a sink id for StopSink(), or -1 if the file could not
+    // be opened.
+    public int StartFileSink(string path, int fragmentDuration = 1000)
+    {
+        int sinkId;
+        var extension = System.IO.Path.GetExtension(path).ToLower();
+        switch (extension)
+        {
+            case ".mp4":
+                sinkId = Lib.StartMp4FileSink(id, path, fragmentDuration);
+                break;
+            case ".ts":
+                sinkId = Lib.StartMpegTsFileSink(id, path);
+                break;
+            case ".mkv":
+                sinkId = Lib.StartMatroskaFileSink(id, path, fragmentDuration);
+                break;
+            case ".webm":
+                Debug.LogError("WebM cannot carry H.264. Use .mkv instead.");
+                return -1;
+            default:
+                sinkId = Lib.StartAnnexBFileSink(id, path);
+                break;
+        }
+
+        if (sinkId < 0)
+        {
+            Debug.LogError("Failed to start writing to " + path + ".");
+        }
+        return sinkId;
+    }
+
+    public void StopSink(int sinkId)
+    {
+        Lib.StopSink(id, sinkId);
+    }
+
+    // Filters rewrite every packet once on the native drain thread, before
+    // sinks and onEncoded see it, in the order they were added. Each returns
+    // a filter id for RemoveFilter() and GetFilterStats().
+    public int AddNalUnitStripFilter(uint typeMask)
+    {
+        return Lib.AddNalUnitStripFilter(id, typeMask);
+    }
+
+    public int AddSeiTimeStampFilter()
+    {
+        return Lib.AddSeiTimeStampFilter(id);
+    }
+
+    public void RemoveFilter(int filterId)
+    {
+        Lib.RemoveFilter(id, filterId);
+    }
+
+    public bool GetFilterStats(int filterId, out FilterStats stats)
+    {
+        return Lib.GetFilterStats(id, filterId, out stats);
+    }
+
+    // Subscribers receive the same packets as onEncoded through their own
+    // bounded queue, sharing the native payload instead of copying it, so a
+    // slow consumer only drops its own packets. Dropping skips to the next
+    // IDR frame or recovery point. A new subscriber first gets the packets
+    // since the last one, with SPS/PPS in front. Returns a subscriber id, or
+    // -1 on failure.
+    public int Subscribe(int capacity, BackpressurePolicy policy = BackpressurePolicy.DropOldest)
+    {
+        return Lib.Subscribe(id, capacity, policy);
+    }
+
+    public void Unsubscribe(int subscriberId)
+    {
+        Lib.Unsubscribe(id, subscriberId);
+    }
+
+    // The data of the returned packets stays valid until the next call with
+    // the same subscriber or ReleaseSubscribedPackets().
+    public int PopSubscribedPackets(int subscriberId, EncodedPacket[] packets)
+    {
+        return Lib.PopSubscribedPackets(id, subscriberId, packets, packets.Length);
+    }
+
+    public void ReleaseSubscribedPackets(int subscriberId)
+    {
+        Lib.ReleaseSubscribedPackets(id, subscriberId);
+    }
+
+    public ulong GetSubscriberDroppedCount(int subscriberId)
+    {
+        return Lib.GetSubscriberDroppedCount(id, subscriberId);
+    }
+
     public void Update()
     {
         if (!isValid) return;
 
-        Lib.CopyEncodedData(id);
-
-        int n = Lib.GetEncodedDataCount(id);
+        int n = Lib.CopyEncodedPackets(id, packets_, packets_.Length);
         for (int i = 0; i < n; ++i)
         {
-            var size = Lib.GetEncodedDataSize(id, i);
-            var data = Lib.GetEncodedDataBuffer(id, i);
-            onEncoded.Invoke(data, size);
+            var packet = packets_[i];
+            onEncoded.Invoke(packet.data, packet.size);
+            if (outputFrameInfo)
+            {
+                onEncodedFrame.Invoke(GetEncodedFrame(i, packet.data));
+            }
         }
+
+        // The buffers (or locked bitstreams in zero-copy mode) are only valid
+        // inside the callbacks above.
+        Lib.ReleaseEncodedData(id);
+    }
+
+    EncodedFrame GetEncodedFrame(int index, System.IntPtr data)
+    {
+        var frame = new EncodedFrame();
+        frame.data = data;
+        Lib.GetEncodedDataInfo(id, index, out frame.info);
+        return frame;
     }
 
-    public bool Encode(Texture texture, bool forceIdrFrame)
+    public bool Encode(Texture texture, bool forceIdrFrame, ulong timeStamp = 0, ulong userData = 0)
     {
         if (!texture)
         {
@@ -97,7 +302,7 @@ public class Encoder
         }
 
         var ptr = texture.GetNativeTexturePtr();
-        if (!Encode(ptr, forceIdrFrame))
+        if (!Encode(ptr, forceIdrFrame, timeStamp, userData))
         {
             var msg = error;
             if (outputError && !string.IsNullOrEmpty(msg))
@@ -110,7 +315,7 @@ public class Encoder
         return true;
     }
 
-    public bool Encode(System.IntPtr ptr, bool forceIdrFrame)
+    public bool Encode(System.IntPtr ptr, bool forceIdrFrame, ulong timeStamp = 0, ulong userData = 0)
     {
         if (ptr == System.IntPtr.Zero)
         {
@@ -124,16 +329,21 @@ public class Encoder
             return false;
         }
 
-        var result = Lib.Encode(id, ptr, forceIdrFrame);
+        var result = Lib.Encode(id, ptr, forceIdrFrame, timeStamp, userData);
         if (outputError && !result)
         {
-            Debug.LogError(error);
+            // Frames dropped by a backpressure policy fail without an error.
+            var msg = error;
+            if (!string.IsNullOrEmpty(msg))
+            {
+                Debug.LogError(msg);
+            }
         }
 
         return result;
     }
 
-    public bool EncodeSharedHandle(System.IntPtr sharedHandle, bool forceIdrFrame)
+    public bool EncodeSharedHandle(System.IntPtr sharedHandle, bool forceIdrFrame, ulong timeStamp = 0, ulong userData = 0)
     {
         if (sharedHandle == System.IntPtr.Zero)
         {
@@ -147,7 +357,7 @@ public class Encoder
             return false;
         }
 
-        var result = Lib.EncodeSharedHandle(id, sharedHandle, forceIdrFrame);
+        var result = Lib.EncodeSharedHandle(id, sharedHandle, forceIdrFrame, timeStamp, userData);
         if (!result)
         {
             Debug.LogError(error);
@@ -14,6 +14,46 @@ public enum Format
     UNKNOWN = 0,
 }
 
+public enum EncoderState
+{
+    Invalid = -1,
+    Initializing = 0,
+    Ready = 1,
+    Failed = 2,
+    Destroying = 3,
+}
+
+public enum BackpressurePolicy
+{
+    Error = 0,
+    Block = 1,
+    DropNewest = 2,
+    DropOldest = 3,
+    Coalesce = 4,
+}
+
+// AnnexB keeps NVENC's start codes; the length-prefixed forms (AVCC, as in
+// MP4/Matroska) replace them with 4-byte big-endian sizes.
+public enum BitstreamFormat
+{
+    AnnexB = 0,
+    LengthPrefixed = 1,
+    LengthPrefixedWithoutParameterSets = 2,
+}
+
+public enum PictureType
+{
+    P = 0,
+    B = 1,
+    I = 2,
+    IDR = 3,
+    BI = 4,
+    Skipped = 5,
+    IntraRefresh = 6,
+    NonReferenceP = 7,
+    Unknown = 0xFF,
+}
+
 [StructLayout(LayoutKind.Sequential), Serializable]
 public struct EncoderDesc
 {
@@ -29,6 +69,159 @@ public struct EncoderDesc
     public int maxFrameSize;
     [MarshalAs(UnmanagedType.I4)]
     public Format format;
+    [MarshalAs(UnmanagedType.I4)]
+    public int pipelineDepth;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool zeroCopy;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool subFrameOutput;
+    [MarshalAs(UnmanagedType.I4)]
+    public int sliceCount;
+    [MarshalAs(UnmanagedType.I4)]
+    public BackpressurePolicy inputBackpressure;
+    [MarshalAs(UnmanagedType.I4)]
+    public BackpressurePolicy outputBackpressure;
+    [MarshalAs(UnmanagedType.I4)]
+    public int backpressureTimeout;
+    [MarshalAs(UnmanagedType.I4)]
+    public int maxWidth;
+    [MarshalAs(UnmanagedType.I4)]
+    public int maxHeight;
+    [MarshalAs(UnmanagedType.I4)]
+    public BitstreamFormat outputFormat;
+}
+
+// Cost of one bitstream filter on the native drain thread. Times are in
+// nanoseconds.
+[StructLayout(LayoutKind.Sequential)]
+public struct FilterStats
+{
+    public ulong packetCount;
+    public ulong droppedCount;
+    public ulong totalTime;
+    public ulong maxTime;
+}
+
+[StructLayout(LayoutKind.Sequential)]
+public struct EncodedDataInfo
+{
+    public ulong index;
+    public ulong timeStamp;
+    public ulong userData;
+    public ulong submitTime;
+    public ulong completeTime;
+    public ulong drainTime;
+    [MarshalAs(UnmanagedType.I4)]
+    public int size;
+    [MarshalAs(UnmanagedType.I4)]
+    public int frameIndex;
+    [MarshalAs(UnmanagedType.I4)]
+    public PictureType pictureType;
+    [MarshalAs(UnmanagedType.I4)]
+    public int averageQp;
+    [MarshalAs(UnmanagedType.I4)]
+    public int satd;
+    [MarshalAs(UnmanagedType.I4)]
+    public int ltrFrameIndex;
+    [MarshalAs(UnmanagedType.I4)]
+    public int intraMbCount;
+    [MarshalAs(UnmanagedType.I4)]
+    public int interMbCount;
+    [MarshalAs(UnmanagedType.I4)]
+    public int averageMvX;
+    [MarshalAs(UnmanagedType.I4)]
+    public int averageMvY;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool isIdrFrame;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool isLastSlice;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool isLtrFrame;
+}
+
+[StructLayout(LayoutKind.Sequential)]
+public struct NalUnit
+{
+    public uint offset;
+    public uint size;
+    public byte startCodeSize;
+    public byte type;
+    public byte refIdc;
+}
+
+[StructLayout(LayoutKind.Sequential)]
+public struct ParameterSetInfo
+{
+    [MarshalAs(UnmanagedType.I4)]
+    public int profileIdc;
+    [MarshalAs(UnmanagedType.I4)]
+    public int constraintFlags;
+    [MarshalAs(UnmanagedType.I4)]
+    public int levelIdc;
+    [MarshalAs(UnmanagedType.I4)]
+    public int spsId;
+    [MarshalAs(UnmanagedType.I4)]
+    public int ppsId;
+    [MarshalAs(UnmanagedType.I4)]
+    public int chromaFormatIdc;
+    [MarshalAs(UnmanagedType.I4)]
+    public int bitDepthLuma;
+    [MarshalAs(UnmanagedType.I4)]
+    public int bitDepthChroma;
+    [MarshalAs(UnmanagedType.I4)]
+    public int width;
+    [MarshalAs(UnmanagedType.I4)]
+    public int height;
+    [MarshalAs(UnmanagedType.I4)]
+    public int maxNumRefFrames;
+    [MarshalAs(UnmanagedType.I4)]
+    public int sarWidth;
+    [MarshalAs(UnmanagedType.I4)]
+    public int sarHeight;
+    [MarshalAs(UnmanagedType.I4)]
+    public int videoFormat;
+    [MarshalAs(UnmanagedType.I4)]
+    public int colourPrimaries;
+    [MarshalAs(UnmanagedType.I4)]
+    public int transferCharacteristics;
+    [MarshalAs(UnmanagedType.I4)]
+    public int matrixCoefficients;
+    public uint numUnitsInTick;
+    public uint timeScale;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool frameMbsOnly;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool hasVui;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool isVideoFullRange;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool hasTimingInfo;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool isFixedFrameRate;
+    [MarshalAs(UnmanagedType.U1)]
+    public bool isCabac;
+}
+
+[Flags]
+public enum EncodedPacketFlags
+{
+    None = 0,
+    IdrFrame = 1 << 0,
+    LastSlice = 1 << 1,
+    LtrFrame = 1 << 2,
+    RecoveryPoint = 1 << 3,
+}
+
+[StructLayout(LayoutKind.Sequential)]
+public struct EncodedPacket
+{
+    public IntPtr data;
+    public int size;
+    public EncodedPacketFlags flags;
+    public ulong timeStamp;
+    public ulong userData;
+    public int encoderId;
+    public PictureType pictureType;
 }
 
 public static class Lib
@@ -37,14 +230,32 @@ public static class Lib
 
     // ---
 
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetCompletionReactorCount")]
+    public static extern void SetCompletionReactorCount(int count);
     [DllImport(dllName, EntryPoint = "uNvEncoderCreate")]
     private static extern int CreateInternal(IntPtr desc);
+    [DllImport(dllName, EntryPoint = "uNvEncoderCreateAsync")]
+    private static extern int CreateAsyncInternal(IntPtr desc);
     [DllImport(dllName, EntryPoint = "uNvEncoderDestroy")]
     public static extern int Destroy(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderDestroyAsync")]
+    public static extern void DestroyAsync(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderReturnToPool")]
+    public static extern void ReturnToPool(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderFillPool")]
+    private static extern void FillPoolInternal(IntPtr desc, int count, int warmUpFrameCount);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetPooledCount")]
+    private static extern int GetPooledCountInternal(IntPtr desc);
+    [DllImport(dllName, EntryPoint = "uNvEncoderClearPool")]
+    public static extern void ClearPool();
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetState")]
+    public static extern EncoderState GetState(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetResolution")]
+    public static extern bool SetResolution(int id, int width, int height);
     [DllImport(dllName, EntryPoint = "uNvEncoderIsValid")]
     public static extern bool IsValid(int id);
     [DllImport(dllName, EntryPoint = "uNvEncoderReconfigure")]
-    private static extern void ReconfigureInternal(int id, IntPtr desc);
+    private static extern bool ReconfigureInternal(int id, IntPtr desc);
     [DllImport(dllName, EntryPoint = "uNvEncoderGetWidth")]
     public static extern int GetWidth(int id);
     [DllImport(dllName, EntryPoint = "uNvEncoderGetHeight")]
@@ -53,18 +264,76 @@ public static class Lib
     public static extern Format GetFormat(int id);
     [DllImport(dllName, EntryPoint = "uNvEncoderGetFrameRate")]
     public static extern int GetFrameRate(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetBitRate")]
+    public static extern int GetBitRate(int id);
     [DllImport(dllName, EntryPoint = "uNvEncoderEncode")]
-    public static extern bool Encode(int id, IntPtr texturePtr, bool forceIdrFrame);
+    public static extern bool Encode(int id, IntPtr texturePtr, bool forceIdrFrame, ulong timeStamp, ulong userData);
     [DllImport(dllName, EntryPoint = "uNvEncoderEncodeSharedHandle")]
-    public static extern bool EncodeSharedHandle(int id, IntPtr sharedHandle, bool forceIdrFrame);
+    public static extern bool EncodeSharedHandle(int id, IntPtr sharedHandle, bool forceIdrFrame, ulong timeStamp, ulong userData);
+    [DllImport(dllName, EntryPoint = "uNvEncoderStartAnnexBFileSink")]
+    public static extern int StartAnnexBFileSink(int id, [MarshalAs(UnmanagedType.LPStr)] string path);
+    [DllImport(dllName, EntryPoint = "uNvEncoderStartMp4FileSink")]
+    public static extern int StartMp4FileSink(int id, [MarshalAs(UnmanagedType.LPStr)] string path, int fragmentDuration);
+    [DllImport(dllName, EntryPoint = "uNvEncoderStartMpegTsFileSink")]
+    public static extern int StartMpegTsFileSink(int id, [MarshalAs(UnmanagedType.LPStr)] string path);
+    [DllImport(dllName, EntryPoint = "uNvEncoderStartMatroskaFileSink")]
+    public static extern int StartMatroskaFileSink(int id, [MarshalAs(UnmanagedType.LPStr)] string path, int clusterDuration);
+    [DllImport(dllName, EntryPoint = "uNvEncoderStopSink")]
+    public static extern void StopSink(int id, int sinkId);
+    [DllImport(dllName, EntryPoint = "uNvEncoderAddNalUnitStripFilter")]
+    public static extern int AddNalUnitStripFilter(int id, uint typeMask);
+    [DllImport(dllName, EntryPoint = "uNvEncoderAddSeiTimeStampFilter")]
+    public static extern int AddSeiTimeStampFilter(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderRemoveFilter")]
+    public static extern void RemoveFilter(int id, int filterId);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetFilterStats")]
+    public static extern bool GetFilterStats(int id, int filterId, out FilterStats stats);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSubscribe")]
+    public static extern int Subscribe(int id, int capacity, BackpressurePolicy policy);
+    [DllImport(dllName, EntryPoint = "uNvEncoderUnsubscribe")]
+    public static extern void Unsubscribe(int id, int subscriberId);
+    [DllImport(dllName, EntryPoint = "uNvEncoderPopSubscribedPackets")]
+    public static extern int PopSubscribedPackets(int id, int subscriberId, [Out] EncodedPacket[] packets, int count);
+    [DllImport(dllName, EntryPoint = "uNvEncoderReleaseSubscribedPackets")]
+    public static extern void ReleaseSubscribedPackets(int id, int subscriberId);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetSubscriberDroppedCount")]
+    public static extern ulong GetSubscriberDroppedCount(int id, int subscriberId);
     [DllImport(dllName, EntryPoint = "uNvEncoderCopyEncodedData")]
     public static extern void CopyEncodedData(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderCopyEncodedPackets")]
+    public static extern int CopyEncodedPackets(int id, [Out] EncodedPacket[] packets, int count);
+    [DllImport(dllName, EntryPoint = "uNvEncoderCopyAllEncodedPackets")]
+    public static extern int CopyAllEncodedPackets([Out] EncodedPacket[] packets, int count);
+    [DllImport(dllName, EntryPoint = "uNvEncoderReleaseEncodedData")]
+    public static extern void ReleaseEncodedData(int id);
     [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataCount")]
     public static extern int GetEncodedDataCount(int id);
     [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataSize")]
     public static extern int GetEncodedDataSize(int id, int index);
     [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataBuffer")]
     public static extern IntPtr GetEncodedDataBuffer(int id, int index);
+    [DllImport(dllName, EntryPoint = "uNvEncoderIsEncodedDataLastSlice")]
+    public static extern bool IsEncodedDataLastSlice(int id, int index);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataTimeStamp")]
+    public static extern ulong GetEncodedDataTimeStamp(int id, int index);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataUserData")]
+    public static extern ulong GetEncodedDataUserData(int id, int index);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataTimes")]
+    public static extern bool GetEncodedDataTimes(int id, int index, out ulong submitTime, out ulong completeTime, out ulong drainTime);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataInfo")]
+    public static extern bool GetEncodedDataInfo(int id, int index, out EncodedDataInfo info);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataNalUnits")]
+    public static extern int GetEncodedDataNalUnits(int id, int index, [Out] NalUnit[] units, int maxCount);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetSequenceParams")]
+    public static extern int GetSequenceParams(int id, [Out] byte[] buffer, int bufferSize);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetParameterSetInfo")]
+    public static extern bool GetParameterSetInfo(int id, out ParameterSetInfo info);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetClockMicroseconds")]
+    public static extern ulong GetClockMicroseconds();
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetDroppedFrameCount")]
+    public static extern ulong GetDroppedFrameCount(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetDroppedEncodedDataCount")]
+    public static extern ulong GetDroppedEncodedDataCount(int id);
     [DllImport(dllName, EntryPoint = "uNvEncoderGetError")]
     private static extern IntPtr GetErrorInternal(int id);
     [DllImport(dllName, EntryPoint = "uNvEncoderHasError")]
@@ -81,12 +350,39 @@ public static class Lib
         return id;
         }
 
-    public static void Reconfigure(int id, EncoderDesc desc)
+    public static int CreateAsync(EncoderDesc desc)
+    {
+        var ptr = Marshal.AllocHGlobal(Marshal.SizeOf(typeof(EncoderDesc)));
+        Marshal.StructureToPtr(desc, ptr, false);
+        var id = CreateAsyncInternal(ptr);
+        Marshal.FreeHGlobal(ptr);
+        return id;
+    }
+
+    public static void FillPool(EncoderDesc desc, int count, int warmUpFrameCount)
+    {
+        var ptr = Marshal.AllocHGlobal(Marshal.SizeOf(typeof(EncoderDesc)));
+        Marshal.StructureToPtr(desc, ptr, false);
+        FillPoolInternal(ptr, count, warmUpFrameCount);
+        Marshal.FreeHGlobal(ptr);
+    }
+
+    public static int GetPooledCount(EncoderDesc desc)
+    {
+        var ptr = Marshal.AllocHGlobal(Marshal.SizeOf(typeof(EncoderDesc)));
+        Marshal.StructureToPtr(desc, ptr, false);
+        var count = GetPooledCountInternal(ptr);
+        Marshal.FreeHGlobal(ptr);
+        return count;
+    }
+
+    public static bool Reconfigure(int id, EncoderDesc desc)
     {
         var ptr = Marshal.AllocHGlobal(Marshal.SizeOf(typeof(EncoderDesc)));
         Marshal.StructureToPtr(desc, ptr, false);
-        ReconfigureInternal(id, ptr);
+        var result = ReconfigureInternal(id, ptr);
         Marshal.FreeHGlobal(ptr);
+        return result;
     }
 
     public static string GetError(int id)
@@ -12,6 +12,7 @@ public class OutputEncodedDataToFile : MonoBehaviour
 
     FileStream fileStream_;
     BinaryWriter binaryWriter_;
+    byte[] buffer_ = new byte[0];
 
     void Start()
     {
@@ -38,9 +39,14 @@ public class OutputEncodedDataToFile : MonoBehaviour
 
         if (ptr == System.IntPtr.Zero) return;
 
-        var bytes = new byte[size];
-        Marshal.Copy(ptr, bytes, 0, size);
-        binaryWriter_.Write(bytes);
+        // TextureEncoder.recordingPath writes from the native side instead and
+        // keeps the file I/O off the main thread.
+        if (buffer_.Length < size)
+        {
+            buffer_ = new byte[size * 2];
+        }
+        Marshal.Copy(ptr, buffer_, 0, size);
+        binaryWriter_.Write(buffer_, 0, size);
     }
 }
 
@@ -17,8 +17,14 @@ public class TextureEncoder : MonoBehaviour
         format = uNvEncoder.Format.R8G8B8A8_UNORM,
         bitRate = 2000000,
         maxFrameSize = 2000000/60,
+        pipelineDepth = 3,
     };
-    public bool forceIdrFrame = true;
+    // Viewers that join later get the current GOP replayed by the encoder, so
+    // there is no need to make every frame an IDR frame.
+    public bool forceIdrFrame = false;
+    public string recordingPath = "";
+
+    int recordingSinkId_ = -1;
 
     void OnEnable()
     {
@@ -26,12 +32,21 @@ public class TextureEncoder : MonoBehaviour
         setting.width = texture.width;
         setting.height = texture.height;
         encoder.Create(setting);
+        if (!string.IsNullOrEmpty(recordingPath))
+        {
+            recordingSinkId_ = encoder.StartFileSink(recordingPath);
+        }
         StartCoroutine(EncodeLoop());
     }
 
     void OnDisable()
     {
         StopAllCoroutines();
+        if (recordingSinkId_ >= 0)
+        {
+            encoder.StopSink(recordingSinkId_);
+            recordingSinkId_ = -1;
+        }
         encoder.Destroy();
     }
 
@@ -49,7 +64,7 @@ public class TextureEncoder : MonoBehaviour
         if (!texture) return;
 
         encoder.Update();
-        encoder.Encode(texture, forceIdrFrame);
+        encoder.Encode(texture, forceIdrFrame, Lib.GetClockMicroseconds());
     }
 }
 
@@ -0,0 +1,260 @@
+#include <cstring>
+#include <random>
+#include <vector>
+#include "AnnexB.h"
+#include "ParameterSets.h"
+#include "CannedStream.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+namespace
+{
+
+
+const uint8_t * FindStartCodeScalar(const uint8_t *begin, const uint8_t *end)
+{
+    for (auto p = begin; p + 3 <= end; ++p)
+    {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) return p;
+    }
+    return end;
+}
+
+
+std::vector<uint8_t> GetTypes(const std::vector<NalUnit> &units)
+{
+    std::vector<uint8_t> types;
+    for (const auto &unit : units) types.push_back(unit.type);
+    return types;
+}
+
+
+// The SIMD scanners must agree with the scalar loop at every alignment,
+// including start codes that straddle their block boundaries.
+void TestFindStartCode()
+{
+    std::mt19937 random(1);
+    std::vector<uint8_t> data(4096 + 64);
+
+    for (int round = 0; round < 200; ++round)
+    {
+        for (auto &byte : data)
+        {
+            // Mostly zeros and ones so that near misses are common.
+            const auto value = random() % 8;
+            byte = static_cast<uint8_t>(value < 4 ? 0 : value < 6 ? 1 : value);
+        }
+
+        const auto size = random() % 4096;
+        const auto begin = data.data() + random() % 64;
+        const auto end = begin + size;
+        for (const uint8_t *p = begin; p < end;)
+        {
+            const auto expected = FindStartCodeScalar(p, end);
+            UNVENCODER_CHECK(FindStartCode(p, end) == expected);
+            if (expected == end) break;
+            p = expected + 1;
+        }
+    }
+
+    const uint8_t noStartCode[] = { 0x00, 0x00, 0x02, 0x00, 0x00 };
+    UNVENCODER_CHECK(FindStartCode(noStartCode, noStartCode + sizeof(noStartCode)) == noStartCode + sizeof(noStartCode));
+    UNVENCODER_CHECK(FindStartCode(noStartCode, noStartCode) == noStartCode);
+}
+
+
+void TestParseNalUnits()
+{
+    const Test::CannedStream stream(1280, 720, 30, 2, 2, 2, 64, 0);
+    const auto &idr = stream.GetFrames()[0].data;
+
+    std::vector<NalUnit> units;
+    ParseNalUnits(idr.data(), idr.size(), units);
+    UNVENCODER_CHECK((GetTypes(units) == std::vector<uint8_t> { 7, 8, 5, 5 }));
+    UNVENCODER_CHECK(units.size() == 4 && units[0].offset == 4 && units[0].startCodeSize == 4);
+    UNVENCODER_CHECK(units.size() == 4 && units[2].startCodeSize == 4 && units[3].startCodeSize == 3);
+    UNVENCODER_CHECK(units.size() == 4 && units[3].offset + units[3].size == idr.size());
+    UNVENCODER_CHECK(units.size() == 4 && units[3].size == 65);
+
+    NalIndex index;
+    BuildNalIndex(idr.data(), idr.size(), index);
+    UNVENCODER_CHECK(index.isComplete && index.count == units.size());
+
+    // A complete index is used as is, with the base offset added.
+    std::vector<NalUnit> appended;
+    AppendNalUnits(idr.data(), idr.size(), &index, 100, appended);
+    UNVENCODER_CHECK(appended.size() == units.size());
+    for (size_t i = 0; i < appended.size() && i < units.size(); ++i)
+    {
+        UNVENCODER_CHECK(appended[i].offset == units[i].offset + 100);
+        UNVENCODER_CHECK(appended[i].type == units[i].type);
+    }
+
+    ParseNalUnits(idr.data(), 0, units);
+    UNVENCODER_CHECK(units.empty());
+}
+
+
+void TestRecoveryPointSei()
+{
+    const Test::CannedStream stream(640, 480, 30, 4, 4, 1, 64, 2);
+    for (const auto &frame : stream.GetFrames())
+    {
+        NalIndex index;
+        BuildNalIndex(frame.data.data(), frame.data.size(), index);
+        UNVENCODER_CHECK(HasRecoveryPointSei(frame.data.data(), frame.data.size(), index) == frame.isRecoveryPoint);
+
+        NalIndex incomplete;
+        UNVENCODER_CHECK(HasRecoveryPointSei(frame.data.data(), frame.data.size(), incomplete) == frame.isRecoveryPoint);
+    }
+}
+
+
+void TestLengthPrefixed()
+{
+    const Test::CannedStream stream(1280, 720, 30, 1, 1, 2, 64, 0);
+    const auto &idr = stream.GetFrames()[0].data;
+
+    for (const bool stripParameterSets : { false, true })
+    {
+        std::vector<NalUnit> units;
+        ParseNalUnits(idr.data(), idr.size(), units);
+
+        const auto expectedSize = GetLengthPrefixedSize(units, stripParameterSets);
+        std::vector<uint8_t> converted(expectedSize);
+        const auto size = ConvertToLengthPrefixed(idr.data(), units, stripParameterSets, converted.data());
+        UNVENCODER_CHECK(size == expectedSize);
+
+        std::vector<NalUnit> parsed;
+        ParseLengthPrefixedNalUnits(converted.data(), size, parsed);
+        UNVENCODER_CHECK(GetTypes(parsed) == (stripParameterSets ?
+            std::vector<uint8_t> { 5, 5 } :
+            std::vector<uint8_t> { 7, 8, 5, 5 }));
+        UNVENCODER_CHECK(GetTypes(parsed) == GetTypes(units));
+        for (size_t i = 0; i < parsed.size() && i < units.size(); ++i)
+        {
+            UNVENCODER_CHECK(parsed[i].offset == units[i].offset && parsed[i].size == units[i].size);
+        }
+    }
+
+    // The second slice has a 3-byte start code, so the frame would grow.
+    std::vector<NalUnit> units;
+    ParseNalUnits(idr.data(), idr.size(), units);
+    UNVENCODER_CHECK(!CanConvertInPlace(units, false));
+    UNVENCODER_CHECK(!CanOverwriteStartCodes(units));
+}
+
+
+void TestConvertInPlace()
+{
+    const Test::CannedStream stream(1280, 720, 30, 1, 1, 1, 64, 0);
+    const auto original = stream.GetFrames()[0].data;
+    auto data = original;
+
+    std::vector<NalUnit> units;
+    ParseNalUnits(data.data(), data.size(), units);
+    UNVENCODER_CHECK(CanConvertInPlace(units, false));
+    UNVENCODER_CHECK(CanOverwriteStartCodes(units));
+
+    const auto size = ConvertToLengthPrefixed(data.data(), units, false, data.data());
+    UNVENCODER_CHECK(size == original.size());
+    UNVENCODER_CHECK(data[0] == 0 && data[3] == units[0].size);
+
+    RestoreStartCodes(data.data(), units);
+    UNVENCODER_CHECK(data == original);
+}
+
+
+void TestStripNalUnits()
+{
+    const Test::CannedStream stream(1280, 720, 30, 1, 1, 2, 64, 0);
+    const auto &idr = stream.GetFrames()[0].data;
+
+    std::vector<NalUnit> units;
+    ParseNalUnits(idr.data(), idr.size(), units);
+
+    std::vector<uint8_t> stripped(idr.size());
+    const auto mask = (1U << NalUnitTypeSps) | (1U << NalUnitTypePps);
+    const auto size = StripNalUnits(idr.data(), units, mask, stripped.data());
+    stripped.resize(size);
+    UNVENCODER_CHECK((GetTypes(units) == std::vector<uint8_t> { 5, 5 }));
+
+    std::vector<NalUnit> parsed;
+    ParseNalUnits(stripped.data(), stripped.size(), parsed);
+    UNVENCODER_CHECK((GetTypes(parsed) == std::vector<uint8_t> { 5, 5 }));
+}
+
+
+void TestParameterSets()
+{
+    const Test::CannedStream stream(1280, 720, 30, 1, 1, 1, 64, 0);
+    const auto &idr = stream.GetFrames()[0].data;
+
+    ParameterSetInfo info;
+    UNVENCODER_CHECK(ParseParameterSets(idr.data(), idr.size(), info));
+    UNVENCODER_CHECK(info.profileIdc == 66 && info.levelIdc == 31);
+    UNVENCODER_CHECK(info.width == 1280 && info.height == 720);
+    UNVENCODER_CHECK(info.maxNumRefFrames == 1 && !info.hasVui && !info.isCabac);
+
+    // 1080 is not a multiple of 16 and comes out of the cropping window.
+    const Test::CannedStream cropped(1920, 1080, 30, 1, 1, 1, 64, 0);
+    const auto &croppedIdr = cropped.GetFrames()[0].data;
+    UNVENCODER_CHECK(ParseParameterSets(croppedIdr.data(), croppedIdr.size(), info));
+    UNVENCODER_CHECK(info.width == 1920 && info.height == 1080);
+
+    const Test::CannedStream withoutIdr(1280, 720, 30, 2, 2, 1, 64, 0);
+    const auto &p = withoutIdr.GetFrames()[1].data;
+    UNVENCODER_CHECK(!ParseParameterSets(p.data(), p.size(), info));
+}
+
+
+void TestAvcDecoderConfigurationRecord()
+{
+    const Test::CannedStream stream(1280, 720, 30, 1, 1, 1, 64, 0);
+    const auto &idr = stream.GetFrames()[0].data;
+
+    std::vector<NalUnit> units;
+    ParseNalUnits(idr.data(), idr.size(), units);
+
+    std::vector<uint8_t> record;
+    UNVENCODER_CHECK(BuildAvcDecoderConfigurationRecord(idr.data(), units, record));
+    UNVENCODER_CHECK(record.size() > 11);
+    if (record.size() <= 11) return;
+
+    const auto &sps = units[0];
+    const auto &pps = units[1];
+    UNVENCODER_CHECK(record[0] == 1);
+    UNVENCODER_CHECK(record[1] == idr[sps.offset + 1] && record[3] == idr[sps.offset + 3]);
+    UNVENCODER_CHECK(record[4] == 0xFF && record[5] == 0xE1);
+    UNVENCODER_CHECK(((record[6] << 8) | record[7]) == static_cast<int>(sps.size));
+    UNVENCODER_CHECK(std::memcmp(&record[8], &idr[sps.offset], sps.size) == 0);
+
+    const auto ppsCount = 8 + sps.size;
+    UNVENCODER_CHECK(record.size() == ppsCount + 3 + pps.size);
+    UNVENCODER_CHECK(record[ppsCount] == 1);
+    UNVENCODER_CHECK(((record[ppsCount + 1] << 8) | record[ppsCount + 2]) == static_cast<int>(pps.size));
+
+    const Test::CannedStream withoutIdr(1280, 720, 30, 2, 2, 1, 64, 0);
+    const auto &p = withoutIdr.GetFrames()[1].data;
+    ParseNalUnits(p.data(), p.size(), units);
+    UNVENCODER_CHECK(!BuildAvcDecoderConfigurationRecord(p.data(), units, record));
+}
+
+
+}
+
+
+int main()
+{
+    TestFindStartCode();
+    TestParseNalUnits();
+    TestRecoveryPointSei();
+    TestLengthPrefixed();
+    TestConvertInPlace();
+    TestStripNalUnits();
+    TestParameterSets();
+    TestAvcDecoderConfigurationRecord();
+    return Test::Finish("AnnexBTest");
+}
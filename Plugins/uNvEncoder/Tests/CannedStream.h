@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "AnnexB.h"
+#include "Muxer.h"
+
+
+namespace uNvEncoder
+{
+namespace Test
+{
+
+
+// Writes an H.264 RBSP and inserts emulation prevention bytes as it goes,
+// so that the parameter sets below parse the same way as NVENC output.
+class RbspWriter final
+{
+public:
+    explicit RbspWriter(std::vector<uint8_t> &buffer) : buffer_(buffer) {}
+
+    void U(uint32_t value, int bitCount)
+    {
+        for (int i = bitCount - 1; i >= 0; --i)
+        {
+            byte_ = static_cast<uint8_t>((byte_ << 1) | ((value >> i) & 1));
+            if (++bitCount_ == 8) PutByte();
+        }
+    }
+
+    void Ue(uint32_t value)
+    {
+        const auto code = value + 1;
+        int length = 0;
+        while ((code >> length) > 1) ++length;
+        U(0, length);
+        U(code, length + 1);
+    }
+
+    void Se(int32_t value)
+    {
+        Ue(value > 0 ? static_cast<uint32_t>(value) * 2 - 1 : static_cast<uint32_t>(-value) * 2);
+    }
+
+    void Finish()
+    {
+        U(1, 1);
+        while (bitCount_ != 0) U(0, 1);
+    }
+
+private:
+    void PutByte()
+    {
+        if (zeroCount_ >= 2 && byte_ <= 3)
+        {
+            buffer_.push_back(3);
+            zeroCount_ = 0;
+        }
+        buffer_.push_back(byte_);
+        zeroCount_ = byte_ == 0 ? zeroCount_ + 1 : 0;
+        byte_ = 0;
+        bitCount_ = 0;
+    }
+
+    std::vector<uint8_t> &buffer_;
+    uint8_t byte_ = 0;
+    int bitCount_ = 0;
+    int zeroCount_ = 0;
+};
+
+
+// Baseline profile SPS/PPS for width x height, cropped like NVENC does when
+// the size is not a multiple of 16.
+inline void AppendSps(std::vector<uint8_t> &data, int width, int height)
+{
+    const auto widthInMbs = static_cast<uint32_t>((width + 15) / 16);
+    const auto heightInMbs = static_cast<uint32_t>((height + 15) / 16);
+    const auto cropRight = (widthInMbs * 16 - width) / 2;
+    const auto cropBottom = (heightInMbs * 16 - height) / 2;
+
+    data.insert(data.end(), { 0x00, 0x00, 0x00, 0x01, 0x67 });
+    RbspWriter writer(data);
+    writer.U(66, 8);         // profile_idc
+    writer.U(0xC0, 8);       // constraint_set0/1_flag
+    writer.U(31, 8);         // level_idc
+    writer.Ue(0);            // seq_parameter_set_id
+    writer.Ue(0);            // log2_max_frame_num_minus4
+    writer.Ue(2);            // pic_order_cnt_type
+    writer.Ue(1);            // max_num_ref_frames
+    writer.U(0, 1);          // gaps_in_frame_num_value_allowed_flag
+    writer.Ue(widthInMbs - 1);
+    writer.Ue(heightInMbs - 1);
+    writer.U(1, 1);          // frame_mbs_only_flag
+    writer.U(1, 1);          // direct_8x8_inference_flag
+    const bool isCropped = cropRight > 0 || cropBottom > 0;
+    writer.U(isCropped ? 1 : 0, 1);
+    if (isCropped)
+    {
+        writer.Ue(0);
+        writer.Ue(cropRight);
+        writer.Ue(0);
+        writer.Ue(cropBottom);
+    }
+    writer.U(0, 1);          // vui_parameters_present_flag
+    writer.Finish();
+}
+
+
+inline void AppendPps(std::vector<uint8_t> &data)
+{
+    data.insert(data.end(), { 0x00, 0x00, 0x00, 0x01, 0x68 });
+    RbspWriter writer(data);
+    writer.Ue(0);            // pic_parameter_set_id
+    writer.Ue(0);            // seq_parameter_set_id
+    writer.U(0, 1);          // entropy_coding_mode_flag
+    writer.U(0, 1);          // bottom_field_pic_order_in_frame_present_flag
+    writer.Ue(0);            // num_slice_groups_minus1
+    writer.Ue(0);            // num_ref_idx_l0_default_active_minus1
+    writer.Ue(0);            // num_ref_idx_l1_default_active_minus1
+    writer.U(0, 1);          // weighted_pred_flag
+    writer.U(0, 2);          // weighted_bipred_idc
+    writer.Se(0);            // pic_init_qp_minus26
+    writer.Se(0);            // pic_init_qs_minus26
+    writer.Se(0);            // chroma_qp_index_offset
+    writer.U(1, 1);          // deblocking_filter_control_present_flag
+    writer.U(0, 1);          // constrained_intra_pred_flag
+    writer.U(0, 1);          // redundant_pic_cnt_present_flag
+    writer.Finish();
+}
+
+
+// SEI with a recovery point message, as NVENC writes at the start of each
+// intra refresh wave.
+inline void AppendRecoveryPointSei(std::vector<uint8_t> &data)
+{
+    data.insert(data.end(), { 0x00, 0x00, 0x00, 0x01, 0x06, 0x06, 0x01, 0xC4, 0x80 });
+}
+
+
+// A slice whose payload never contains a start code. The first slice gets
+// a 4-byte start code and the following ones a 3-byte one, which NVENC
+// output has too.
+inline void AppendSlice(std::vector<uint8_t> &data, bool isIdrSlice, bool isFirstSlice, size_t payloadSize, uint32_t seed)
+{
+    if (isFirstSlice) data.push_back(0x00);
+    data.insert(data.end(), { 0x00, 0x00, 0x01 });
+    data.push_back(isIdrSlice ? 0x65 : 0x41);
+    for (size_t i = 0; i < payloadSize; ++i)
+    {
+        seed = seed * 1664525U + 1013904223U;
+        data.push_back(static_cast<uint8_t>((seed >> 24) | 0x80));
+    }
+}
+
+
+// A recorded-looking Annex-B stream: an IDR frame with SPS/PPS every
+// gopLength frames, a recovery point SEI every recoveryInterval frames
+// (0 for none), and P frames in between, each made of sliceCount slices.
+class CannedStream final
+{
+public:
+    struct Frame
+    {
+        std::vector<uint8_t> data;
+        uint64_t timeStamp = 0; // [us]
+        bool isIdrFrame = false;
+        bool isRecoveryPoint = false;
+    };
+
+    CannedStream(
+        int width,
+        int height,
+        int frameRate,
+        int frameCount,
+        int gopLength,
+        int sliceCount = 1,
+        size_t sliceSize = 256,
+        int recoveryInterval = 0)
+    {
+        frames_.resize(static_cast<size_t>(frameCount));
+        for (int i = 0; i < frameCount; ++i)
+        {
+            auto &frame = frames_[i];
+            frame.isIdrFrame = i % gopLength == 0;
+            frame.isRecoveryPoint = !frame.isIdrFrame && recoveryInterval > 0 && i % recoveryInterval == 0;
+            frame.timeStamp = 1000000 + static_cast<uint64_t>(i) * 1000000 / static_cast<uint64_t>(frameRate);
+
+            if (frame.isIdrFrame)
+            {
+                AppendSps(frame.data, width, height);
+                AppendPps(frame.data);
+            }
+            if (frame.isRecoveryPoint)
+            {
+                AppendRecoveryPointSei(frame.data);
+            }
+            for (int s = 0; s < sliceCount; ++s)
+            {
+                AppendSlice(frame.data, frame.isIdrFrame, s == 0, sliceSize, static_cast<uint32_t>(i * 31 + s));
+            }
+        }
+    }
+
+    const std::vector<Frame> & GetFrames() const { return frames_; }
+
+    // Feeds every frame to muxer as one packet.
+    void WriteTo(Muxer &muxer) const
+    {
+        for (const auto &frame : frames_)
+        {
+            MuxerPacket packet;
+            packet.data = frame.data.data();
+            packet.size = frame.data.size();
+            packet.timeStamp = frame.timeStamp;
+            packet.isIdrFrame = frame.isIdrFrame;
+            packet.isRecoveryPoint = frame.isRecoveryPoint;
+            muxer.Write(packet);
+        }
+    }
+
+private:
+    std::vector<Frame> frames_;
+};
+
+
+}
+}
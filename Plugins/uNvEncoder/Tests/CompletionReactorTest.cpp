@@ -0,0 +1,283 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CompletionReactor.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+namespace
+{
+
+
+// Stands in for an Encoder: Submit() queues an encode whose event is
+// signaled from another thread, the way NVENC signals completions.
+class FakeSource final : public CompletionSource
+{
+public:
+    explicit FakeSource(size_t depth = 4)
+        : events_(depth)
+    {
+    }
+
+    void Submit()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++submittedCount_;
+    }
+
+    void Complete()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_[completedCount_++ % events_.size()].Signal();
+    }
+
+    Event * GetPendingCompletionEvent() const override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (drainedCount_ >= submittedCount_) return nullptr;
+        return &events_[drainedCount_ % events_.size()];
+    }
+
+    void OnEncodeCompleted() override
+    {
+        isDraining_ = true;
+        if (drainDelay_.count() > 0)
+        {
+            std::this_thread::sleep_for(drainDelay_);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++drainedCount_;
+        }
+        isDraining_ = false;
+    }
+
+    void OnWake() override
+    {
+        ++wakeCount_;
+    }
+
+    void SetDrainDelay(std::chrono::milliseconds delay) { drainDelay_ = delay; }
+    uint64_t GetWakeCount() const { return wakeCount_; }
+    bool IsDraining() const { return isDraining_; }
+
+    uint64_t GetDrainedCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return drainedCount_;
+    }
+
+private:
+    mutable std::vector<Event> events_;
+    mutable std::mutex mutex_;
+    uint64_t submittedCount_ = 0;
+    uint64_t completedCount_ = 0;
+    uint64_t drainedCount_ = 0;
+    std::chrono::milliseconds drainDelay_ { 0 };
+    std::atomic<bool> isDraining_ { false };
+    std::atomic<uint64_t> wakeCount_ { 0 };
+};
+
+
+bool WaitUntil(const std::function<bool()> &condition)
+{
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > timeout) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+
+void TestEvent()
+{
+    Event event;
+    UNVENCODER_CHECK(event.Wait(0) == Event::WaitResult::Timeout);
+
+    event.Signal();
+    UNVENCODER_CHECK(event.Wait(0) == Event::WaitResult::Signaled);
+    UNVENCODER_CHECK(event.Wait(0) == Event::WaitResult::Timeout);
+
+    Event other;
+    Event *events[] = { &event, &other };
+    size_t index = 0;
+    other.Signal();
+    UNVENCODER_CHECK(Event::WaitAny(events, 2, 100, index) == Event::WaitResult::Signaled);
+    UNVENCODER_CHECK(index == 1);
+    UNVENCODER_CHECK(Event::WaitAny(events, 2, 1, index) == Event::WaitResult::Timeout);
+
+    std::thread signaler([&]
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        event.Signal();
+    });
+    UNVENCODER_CHECK(Event::WaitAny(events, 2, Event::Infinite, index) == Event::WaitResult::Signaled);
+    UNVENCODER_CHECK(index == 0);
+    signaler.join();
+}
+
+
+// Completions from several sources are all drained by the one reactor thread.
+void TestDrainsAllSources()
+{
+    constexpr int sourceCount = 8;
+    constexpr uint64_t frameCount = 200;
+
+    CompletionReactor reactor;
+    std::vector<std::unique_ptr<FakeSource>> sources;
+    for (int i = 0; i < sourceCount; ++i)
+    {
+        sources.push_back(std::make_unique<FakeSource>());
+        UNVENCODER_CHECK(reactor.Register(sources.back().get()));
+    }
+    UNVENCODER_CHECK(reactor.GetEncoderCount() == sourceCount);
+
+    for (uint64_t n = 0; n < frameCount; ++n)
+    {
+        for (auto &source : sources)
+        {
+            source->Submit();
+        }
+        reactor.Wake();
+        for (auto &source : sources)
+        {
+            source->Complete();
+        }
+        for (auto &source : sources)
+        {
+            const auto expected = n + 1;
+            UNVENCODER_CHECK(WaitUntil([&] { return source->GetDrainedCount() == expected; }));
+        }
+    }
+
+    for (auto &source : sources)
+    {
+        reactor.Unregister(source.get());
+    }
+    UNVENCODER_CHECK(reactor.GetEncoderCount() == 0);
+}
+
+
+// A long drain does not hold the reactor lock, and Unregister() returns only
+// after the drain of that source has finished.
+void TestUnregisterWaitsForDrain()
+{
+    CompletionReactor reactor;
+    FakeSource slow;
+    FakeSource other;
+    slow.SetDrainDelay(std::chrono::milliseconds(200));
+    UNVENCODER_CHECK(reactor.Register(&slow));
+
+    slow.Submit();
+    reactor.Wake();
+    slow.Complete();
+    UNVENCODER_CHECK(WaitUntil([&] { return slow.IsDraining(); }));
+
+    const Test::Stopwatch stopwatch;
+    UNVENCODER_CHECK(reactor.Register(&other));
+    UNVENCODER_CHECK(reactor.GetEncoderCount() == 2);
+    UNVENCODER_CHECK(stopwatch.GetSeconds() < 0.1);
+
+    reactor.Unregister(&slow);
+    UNVENCODER_CHECK(!slow.IsDraining());
+    UNVENCODER_CHECK(slow.GetDrainedCount() == 1);
+
+    reactor.Unregister(&other);
+}
+
+
+// Frames submitted while the reactor drains the previous one, or right after
+// it has gone back to sleep without them, are still drained as long as every
+// submit wakes the reactor, as Encoder::Encode() does.
+void TestSubmitWhileDraining()
+{
+    constexpr uint64_t frameCount = 20;
+
+    CompletionReactor reactor;
+    FakeSource source(frameCount + 1);
+    source.SetDrainDelay(std::chrono::milliseconds(10));
+    UNVENCODER_CHECK(reactor.Register(&source));
+
+    source.Submit();
+    reactor.Wake();
+    source.Complete();
+    UNVENCODER_CHECK(WaitUntil([&] { return source.IsDraining(); }));
+
+    std::thread completer([&]
+    {
+        for (uint64_t n = 1; n < frameCount; ++n)
+        {
+            source.Submit();
+            reactor.Wake();
+            std::this_thread::sleep_for(std::chrono::microseconds(500 * (n % 5)));
+            source.Complete();
+            std::this_thread::sleep_for(std::chrono::microseconds(700 * (n % 3)));
+        }
+    });
+    completer.join();
+    UNVENCODER_CHECK(WaitUntil([&] { return source.GetDrainedCount() == frameCount; }));
+
+    // The reactor is idle and waits on its wake event alone now.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    source.Submit();
+    reactor.Wake();
+    source.Complete();
+    UNVENCODER_CHECK(WaitUntil([&] { return source.GetDrainedCount() == frameCount + 1; }));
+
+    reactor.Unregister(&source);
+}
+
+
+// Wake() also reaches sources with nothing in flight, which is how an encoder
+// flushes packets held back by a full queue once the consumer makes room.
+void TestWakeWithoutPendingEncode()
+{
+    CompletionReactor reactor;
+    FakeSource idle;
+    FakeSource other;
+    UNVENCODER_CHECK(reactor.Register(&idle));
+    UNVENCODER_CHECK(reactor.Register(&other));
+
+    // Register() wakes the reactor too.
+    UNVENCODER_CHECK(WaitUntil([&] { return idle.GetWakeCount() > 0 && other.GetWakeCount() > 0; }));
+
+    for (int i = 0; i < 10; ++i)
+    {
+        const auto count = idle.GetWakeCount();
+        reactor.Wake();
+        UNVENCODER_CHECK(WaitUntil([&] { return idle.GetWakeCount() > count; }));
+    }
+    UNVENCODER_CHECK(idle.GetDrainedCount() == 0);
+
+    // Once Unregister() has returned the source is not called any more.
+    reactor.Unregister(&idle);
+    const auto idleCount = idle.GetWakeCount();
+    const auto otherCount = other.GetWakeCount();
+    reactor.Wake();
+    UNVENCODER_CHECK(WaitUntil([&] { return other.GetWakeCount() > otherCount; }));
+    UNVENCODER_CHECK(idle.GetWakeCount() == idleCount);
+
+    reactor.Unregister(&other);
+}
+
+
+}
+
+
+int main()
+{
+    TestEvent();
+    TestDrainsAllSources();
+    TestUnregisterWaitsForDrain();
+    TestSubmitWhileDraining();
+    TestWakeWithoutPendingEncode();
+    return Test::Finish("CompletionReactorTest");
+}
@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FakeNvenc.h"
+
+
+namespace uNvEncoder
+{
+namespace Test
+{
+
+
+namespace
+{
+
+
+// NV_ENC_LOCK_BITSTREAM::hwEncodeStatus of a finished picture (see Nvenc.cpp).
+constexpr uint32_t hwEncodeStatusCompleted = 2;
+
+const uint8_t sequenceParams[] =
+{
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1F, 0xAC, 0xD9, 0x40, 0x50, 0x05, 0xBB, 0x01, 0x10,
+    0x00, 0x00, 0x00, 0x01, 0x68, 0xEB, 0xE3, 0xCB, 0x22, 0xC0,
+};
+
+const uint8_t idrSlice[] = { 0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x84, 0x00, 0x33, 0xFF };
+const uint8_t slice[] = { 0x00, 0x00, 0x00, 0x01, 0x41, 0x9A, 0x02, 0x0C, 0x10 };
+
+
+struct Bitstream
+{
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> sliceOffsets;
+    uint32_t frameIndex = 0;
+    uint64_t timeStamp = 0;
+    NV_ENC_PIC_TYPE pictureType = NV_ENC_PIC_TYPE_UNKNOWN;
+    bool isCompleted = false;
+};
+
+
+struct Completion
+{
+    std::chrono::steady_clock::time_point time;
+    Bitstream *bitstream = nullptr;
+    void *event = nullptr;
+};
+
+
+struct State
+{
+    std::chrono::milliseconds completionDelay { 0 };
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Completion> completions;
+    bool shouldStop = false;
+    int submittedCount = 0;
+    int inFlightCount = 0;
+    int maxInFlightCount = 0;
+    std::thread thread;
+};
+
+State *s_state = nullptr;
+int s_session = 0;
+
+
+void RunCompletionThread()
+{
+    auto &state = *s_state;
+    std::unique_lock<std::mutex> lock(state.mutex);
+
+    for (;;)
+    {
+        state.cond.wait(lock, [&] { return state.shouldStop || !state.completions.empty(); });
+        if (state.shouldStop) break;
+
+        const auto completion = state.completions.front();
+        if (state.cond.wait_until(lock, completion.time, [&] { return state.shouldStop; })) break;
+
+        state.completions.pop_front();
+        if (completion.bitstream)
+        {
+            completion.bitstream->isCompleted = true;
+            --state.inFlightCount;
+        }
+        state.cond.notify_all();
+
+        if (completion.event)
+        {
+            ::SetEvent(completion.event);
+        }
+    }
+}
+
+
+NVENCSTATUS NVENCAPI OpenEncodeSessionEx(NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS *, void **encoder)
+{
+    *encoder = &s_session;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI GetEncodeCaps(void *, GUID, NV_ENC_CAPS_PARAM *, int *capsVal)
+{
+    *capsVal = 1;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI GetEncodePresetConfig(void *, GUID, GUID, NV_ENC_PRESET_CONFIG *)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI InitializeEncoder(void *, NV_ENC_INITIALIZE_PARAMS *)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI ReconfigureEncoder(void *, NV_ENC_RECONFIGURE_PARAMS *)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI DestroyEncoder(void *)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI RegisterAsyncEvent(void *, NV_ENC_EVENT_PARAMS *)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI UnregisterAsyncEvent(void *, NV_ENC_EVENT_PARAMS *)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI CreateBitstreamBuffer(void *, NV_ENC_CREATE_BITSTREAM_BUFFER *params)
+{
+    params->bitstreamBuffer = new Bitstream();
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI DestroyBitstreamBuffer(void *, NV_ENC_OUTPUT_PTR bitstreamBuffer)
+{
+    delete static_cast<Bitstream *>(bitstreamBuffer);
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI RegisterResource(void *, NV_ENC_REGISTER_RESOURCE *params)
+{
+    params->registeredResource = params->resourceToRegister;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI UnregisterResource(void *, NV_ENC_REGISTERED_PTR)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI MapInputResource(void *, NV_ENC_MAP_INPUT_RESOURCE *params)
+{
+    params->mappedResource = params->registeredResource;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI UnmapInputResource(void *, NV_ENC_INPUT_PTR)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI EncodePicture(void *, NV_ENC_PIC_PARAMS *params)
+{
+    auto &state = *s_state;
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    Completion completion;
+    completion.time = std::chrono::steady_clock::now() + state.completionDelay;
+    completion.event = params->completionEvent;
+
+    if (!(params->encodePicFlags & NV_ENC_PIC_FLAG_EOS))
+    {
+        const auto bitstream = static_cast<Bitstream *>(params->outputBitstream);
+        const auto isIdrFrame = state.submittedCount == 0 || (params->encodePicFlags & NV_ENC_PIC_FLAG_FORCEIDR);
+
+        // Every picture has two slices, with SPS/PPS in front of IDR frames.
+        auto &data = bitstream->data;
+        data.clear();
+        bitstream->sliceOffsets.clear();
+        if (isIdrFrame)
+        {
+            data.insert(data.end(), std::begin(sequenceParams), std::end(sequenceParams));
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            bitstream->sliceOffsets.push_back(static_cast<uint32_t>(data.size()));
+            if (isIdrFrame)
+            {
+                data.insert(data.end(), std::begin(idrSlice), std::end(idrSlice));
+            }
+            else
+            {
+                data.insert(data.end(), std::begin(slice), std::end(slice));
+            }
+        }
+        bitstream->frameIndex = params->frameIdx;
+        bitstream->timeStamp = params->inputTimeStamp;
+        bitstream->pictureType = isIdrFrame ? NV_ENC_PIC_TYPE_IDR : NV_ENC_PIC_TYPE_P;
+        bitstream->isCompleted = false;
+
+        completion.bitstream = bitstream;
+        ++state.submittedCount;
+        ++state.inFlightCount;
+        state.maxInFlightCount = (std::max)(state.maxInFlightCount, state.inFlightCount);
+    }
+
+    state.completions.push_back(completion);
+    state.cond.notify_all();
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI LockBitstream(void *, NV_ENC_LOCK_BITSTREAM *params)
+{
+    auto &state = *s_state;
+    std::unique_lock<std::mutex> lock(state.mutex);
+
+    const auto bitstream = static_cast<Bitstream *>(params->outputBitstream);
+    if (!bitstream->isCompleted)
+    {
+        if (params->doNotWait) return NV_ENC_ERR_LOCK_BUSY;
+        state.cond.wait(lock, [&] { return bitstream->isCompleted; });
+    }
+
+    params->bitstreamBufferPtr = bitstream->data.data();
+    params->bitstreamSizeInBytes = static_cast<uint32_t>(bitstream->data.size());
+    params->frameIdx = bitstream->frameIndex;
+    params->outputTimeStamp = bitstream->timeStamp;
+    params->pictureType = bitstream->pictureType;
+    params->hwEncodeStatus = hwEncodeStatusCompleted;
+    params->numSlices = static_cast<uint32_t>(bitstream->sliceOffsets.size());
+    if (params->sliceOffsets)
+    {
+        std::copy(bitstream->sliceOffsets.begin(), bitstream->sliceOffsets.end(), params->sliceOffsets);
+    }
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI UnlockBitstream(void *, NV_ENC_OUTPUT_PTR)
+{
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI GetSequenceParams(void *, NV_ENC_SEQUENCE_PARAM_PAYLOAD *params)
+{
+    if (params->inBufferSize < sizeof(sequenceParams)) return NV_ENC_ERR_NOT_ENOUGH_BUFFER;
+
+    std::memcpy(params->spsppsBuffer, sequenceParams, sizeof(sequenceParams));
+    *params->outSPSPPSPayloadSize = sizeof(sequenceParams);
+    return NV_ENC_SUCCESS;
+}
+
+
+}
+
+
+FakeNvenc::FakeNvenc(std::chrono::milliseconds completionDelay)
+{
+    s_state = new State();
+    s_state->completionDelay = completionDelay;
+    s_state->thread = std::thread(RunCompletionThread);
+
+    functionList_.nvEncOpenEncodeSessionEx = OpenEncodeSessionEx;
+    functionList_.nvEncGetEncodeCaps = GetEncodeCaps;
+    functionList_.nvEncGetEncodePresetConfig = GetEncodePresetConfig;
+    functionList_.nvEncInitializeEncoder = InitializeEncoder;
+    functionList_.nvEncReconfigureEncoder = ReconfigureEncoder;
+    functionList_.nvEncDestroyEncoder = DestroyEncoder;
+    functionList_.nvEncRegisterAsyncEvent = RegisterAsyncEvent;
+    functionList_.nvEncUnregisterAsyncEvent = UnregisterAsyncEvent;
+    functionList_.nvEncCreateBitstreamBuffer = CreateBitstreamBuffer;
+    functionList_.nvEncDestroyBitstreamBuffer = DestroyBitstreamBuffer;
+    functionList_.nvEncRegisterResource = RegisterResource;
+    functionList_.nvEncUnregisterResource = UnregisterResource;
+    functionList_.nvEncMapInputResource = MapInputResource;
+    functionList_.nvEncUnmapInputResource = UnmapInputResource;
+    functionList_.nvEncEncodePicture = EncodePicture;
+    functionList_.nvEncLockBitstream = LockBitstream;
+    functionList_.nvEncUnlockBitstream = UnlockBitstream;
+    functionList_.nvEncGetSequenceParams = GetSequenceParams;
+}
+
+
+FakeNvenc::~FakeNvenc()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_state->mutex);
+        s_state->shouldStop = true;
+        s_state->cond.notify_all();
+    }
+    s_state->thread.join();
+
+    delete s_state;
+    s_state = nullptr;
+}
+
+
+int FakeNvenc::GetSubmittedCount() const
+{
+    std::lock_guard<std::mutex> lock(s_state->mutex);
+    return s_state->submittedCount;
+}
+
+
+int FakeNvenc::GetMaxInFlightCount() const
+{
+    std::lock_guard<std::mutex> lock(s_state->mutex);
+    return s_state->maxInFlightCount;
+}
+
+
+}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <windows.h>
+#include "nvEncodeAPI.h"
+
+
+namespace uNvEncoder
+{
+namespace Test
+{
+
+
+// NVENC function table that encodes nothing: every picture completes on a
+// worker thread after a fixed delay, in submission order, and yields a small
+// canned Annex-B frame. Lets the encode pipeline run without an NVIDIA GPU.
+class FakeNvenc final
+{
+public:
+    explicit FakeNvenc(std::chrono::milliseconds completionDelay);
+    ~FakeNvenc();
+    FakeNvenc(const FakeNvenc &) = delete;
+    FakeNvenc & operator=(const FakeNvenc &) = delete;
+
+    const NV_ENCODE_API_FUNCTION_LIST & GetFunctionList() const { return functionList_; }
+    int GetSubmittedCount() const;
+    int GetMaxInFlightCount() const;
+
+private:
+    NV_ENCODE_API_FUNCTION_LIST functionList_ = { NV_ENCODE_API_FUNCTION_LIST_VER };
+};
+
+
+}
+}
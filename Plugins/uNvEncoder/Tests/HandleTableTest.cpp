@@ -0,0 +1,163 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "HandleTable.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+namespace
+{
+
+
+struct Object
+{
+    explicit Object(int value) : value(value) {}
+    int value;
+};
+
+
+void TestAddGetRemove()
+{
+    HandleTable<Object> table;
+
+    const auto a = table.Add(std::make_unique<Object>(1));
+    const auto b = table.Add(std::make_unique<Object>(2));
+    UNVENCODER_CHECK(a >= 0 && b >= 0 && a != b);
+
+    {
+        const auto ref = table.Get(a);
+        UNVENCODER_CHECK(ref && ref->value == 1);
+    }
+
+    auto removed = table.Remove(a);
+    UNVENCODER_CHECK(removed && removed->value == 1);
+    UNVENCODER_CHECK(!table.Get(a));
+    UNVENCODER_CHECK(!table.Remove(a));
+    UNVENCODER_CHECK(table.Get(b) && table.Get(b)->value == 2);
+
+    UNVENCODER_CHECK(!table.Get(-1));
+}
+
+
+// A reused slot gets a new generation, so the old handle stays invalid.
+void TestStaleHandle()
+{
+    HandleTable<Object> table;
+
+    const auto first = table.Add(std::make_unique<Object>(1));
+    table.Remove(first);
+    const auto second = table.Add(std::make_unique<Object>(2));
+
+    UNVENCODER_CHECK(first != second);
+    UNVENCODER_CHECK(!table.Get(first));
+    UNVENCODER_CHECK(table.Get(second) && table.Get(second)->value == 2);
+}
+
+
+void TestFull()
+{
+    HandleTable<Object> table;
+
+    std::vector<int> handles;
+    for (uint32_t i = 0; i < HandleTable<Object>::SlotCount; ++i)
+    {
+        handles.push_back(table.Add(std::make_unique<Object>(static_cast<int>(i))));
+    }
+    UNVENCODER_CHECK(handles.back() >= 0);
+    UNVENCODER_CHECK(table.Add(std::make_unique<Object>(-1)) == -1);
+
+    table.Remove(handles.front());
+    UNVENCODER_CHECK(table.Add(std::make_unique<Object>(-1)) >= 0);
+
+    int count = 0;
+    table.ForEach([&](int, Object &) { ++count; });
+    UNVENCODER_CHECK(count == static_cast<int>(HandleTable<Object>::SlotCount));
+}
+
+
+// Remove() must not hand the object back while a reader still holds a Ref.
+void TestRemoveWaitsForReaders()
+{
+    HandleTable<Object> table;
+    const auto handle = table.Add(std::make_unique<Object>(1));
+
+    std::atomic<bool> isPinned { false };
+    std::atomic<bool> isReleased { false };
+    std::thread reader([&]
+    {
+        const auto ref = table.Get(handle);
+        isPinned = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        isReleased = true;
+    });
+
+    while (!isPinned)
+    {
+        std::this_thread::yield();
+    }
+
+    const auto removed = table.Remove(handle);
+    UNVENCODER_CHECK(removed);
+    UNVENCODER_CHECK(isReleased);
+    reader.join();
+}
+
+
+void TestConcurrentLookups()
+{
+    HandleTable<Object> table;
+    std::atomic<bool> shouldStop { false };
+    std::atomic<int> handle { table.Add(std::make_unique<Object>(0)) };
+    std::atomic<bool> isValid { true };
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]
+        {
+            while (!shouldStop)
+            {
+                if (const auto ref = table.Get(handle))
+                {
+                    // The object must stay alive and unchanged while pinned.
+                    const auto value = ref->value;
+                    std::this_thread::yield();
+                    if (ref->value != value) isValid = false;
+                }
+            }
+        });
+    }
+
+    for (int i = 1; i < 2000; ++i)
+    {
+        auto object = table.Remove(handle);
+        object->value = -1;
+        object.reset();
+        handle = table.Add(std::make_unique<Object>(i));
+    }
+
+    shouldStop = true;
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    UNVENCODER_CHECK(isValid);
+}
+
+
+}
+
+
+int main()
+{
+    TestAddGetRemove();
+    TestStaleHandle();
+    TestFull();
+    TestRemoveWaitsForReaders();
+    TestConcurrentLookups();
+    return Test::Finish("HandleTableTest");
+}
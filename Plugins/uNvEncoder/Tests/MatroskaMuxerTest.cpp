@@ -0,0 +1,491 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include "MatroskaMuxer.h"
+#include "CannedStream.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+namespace
+{
+
+
+constexpr uint32_t ebmlId = 0x1A45DFA3;
+constexpr uint32_t docTypeId = 0x4282;
+constexpr uint32_t segmentId = 0x18538067;
+constexpr uint32_t seekHeadId = 0x114D9B74;
+constexpr uint32_t seekId = 0x4DBB;
+constexpr uint32_t seekIdId = 0x53AB;
+constexpr uint32_t seekPositionId = 0x53AC;
+constexpr uint32_t voidId = 0xEC;
+constexpr uint32_t infoId = 0x1549A966;
+constexpr uint32_t tracksId = 0x1654AE6B;
+constexpr uint32_t trackEntryId = 0xAE;
+constexpr uint32_t defaultDurationId = 0x23E383;
+constexpr uint32_t codecId = 0x86;
+constexpr uint32_t codecPrivateId = 0x63A2;
+constexpr uint32_t videoId = 0xE0;
+constexpr uint32_t pixelWidthId = 0xB0;
+constexpr uint32_t pixelHeightId = 0xBA;
+constexpr uint32_t clusterId = 0x1F43B675;
+constexpr uint32_t timestampId = 0xE7;
+constexpr uint32_t simpleBlockId = 0xA3;
+constexpr uint32_t cuesId = 0x1C53BB6B;
+constexpr uint32_t cuePointId = 0xBB;
+constexpr uint32_t cueTimeId = 0xB3;
+constexpr uint32_t cueTrackPositionsId = 0xB7;
+constexpr uint32_t cueClusterPositionId = 0xF1;
+
+constexpr uint64_t unknownSize = ~0ULL;
+
+
+struct Element
+{
+    uint32_t id;
+    size_t offset;      // of the element ID
+    size_t dataOffset;
+    uint64_t size;      // unknownSize for live segments and clusters
+};
+
+
+bool IsMaster(uint32_t id)
+{
+    switch (id)
+    {
+        case ebmlId:
+        case segmentId:
+        case seekHeadId:
+        case seekId:
+        case infoId:
+        case tracksId:
+        case trackEntryId:
+        case videoId:
+        case clusterId:
+        case cuesId:
+        case cuePointId:
+        case cueTrackPositionsId:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+// Reads an EBML variable-length integer. IDs keep their length marker,
+// sizes do not, and an all-ones size means unknown.
+bool ReadVint(const std::vector<uint8_t> &data, size_t &pos, bool keepMarker, uint64_t &value)
+{
+    if (pos >= data.size() || data[pos] == 0) return false;
+
+    size_t length = 1;
+    while (!(data[pos] & (0x80 >> (length - 1)))) ++length;
+    if (pos + length > data.size()) return false;
+
+    const uint8_t marker = static_cast<uint8_t>(0x80 >> (length - 1));
+    value = keepMarker ? data[pos] : (data[pos] & (marker - 1));
+    bool isAllOnes = (data[pos] & (marker - 1)) == marker - 1;
+    for (size_t i = 1; i < length; ++i)
+    {
+        value = (value << 8) | data[pos + i];
+        isAllOnes = isAllOnes && data[pos + i] == 0xFF;
+    }
+    if (!keepMarker && isAllOnes) value = unknownSize;
+    pos += length;
+    return true;
+}
+
+
+// Lists every element in document order, descending into master elements.
+// Elements of unknown size end where the next sibling starts, which a flat
+// list handles without tracking where they close.
+std::vector<Element> ReadElements(const std::vector<uint8_t> &data)
+{
+    std::vector<Element> elements;
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        Element element;
+        element.offset = pos;
+        uint64_t id = 0;
+        const bool isValid = ReadVint(data, pos, true, id) && ReadVint(data, pos, false, element.size);
+        UNVENCODER_CHECK(isValid);
+        if (!isValid) break;
+
+        element.id = static_cast<uint32_t>(id);
+        element.dataOffset = pos;
+        elements.push_back(element);
+        if (IsMaster(element.id)) continue;
+
+        UNVENCODER_CHECK(element.size != unknownSize && pos + element.size <= data.size());
+        if (element.size == unknownSize || pos + element.size > data.size()) break;
+        pos += static_cast<size_t>(element.size);
+    }
+    return elements;
+}
+
+
+uint64_t ReadUInt(const std::vector<uint8_t> &data, const Element &element)
+{
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < element.size; ++i)
+    {
+        value = (value << 8) | data[element.dataOffset + i];
+    }
+    return value;
+}
+
+
+std::string ReadString(const std::vector<uint8_t> &data, const Element &element)
+{
+    return std::string(reinterpret_cast<const char *>(&data[element.dataOffset]), static_cast<size_t>(element.size));
+}
+
+
+std::vector<const Element *> FindAll(const std::vector<Element> &elements, uint32_t id)
+{
+    std::vector<const Element *> found;
+    for (const auto &element : elements)
+    {
+        if (element.id == id) found.push_back(&element);
+    }
+    return found;
+}
+
+
+std::vector<uint8_t> Mux(const Test::CannedStream &stream, const MatroskaMuxerDesc &desc, bool canPatch = true)
+{
+    std::vector<uint8_t> output;
+    MatroskaMuxer muxer(
+        [&](const uint8_t *data, size_t size)
+        {
+            output.insert(output.end(), data, data + size);
+        },
+        desc,
+        canPatch ? MuxerPatch([&](uint64_t offset, const uint8_t *data, size_t size)
+        {
+            UNVENCODER_CHECK(offset + size <= output.size());
+            if (offset + size <= output.size()) std::memcpy(&output[static_cast<size_t>(offset)], data, size);
+        }) : nullptr);
+    stream.WriteTo(muxer);
+    muxer.Close();
+    return output;
+}
+
+
+// Checks every block against the frame it came from: the time is the
+// cluster timestamp plus the block offset, only IDR frames and recovery
+// points are keyframes, and the payload holds the length-prefixed slices
+// and SEI only. Returns the number of frames in each cluster.
+std::vector<size_t> CheckBlocks(
+    const std::vector<uint8_t> &output,
+    const std::vector<Element> &elements,
+    const Test::CannedStream &stream)
+{
+    const auto &frames = stream.GetFrames();
+    std::vector<size_t> clusterSizes;
+    uint64_t clusterTime = 0;
+    size_t frameIndex = 0;
+    for (size_t i = 0; i < elements.size(); ++i)
+    {
+        const auto &element = elements[i];
+        if (element.id == clusterId)
+        {
+            UNVENCODER_CHECK(element.size == unknownSize);
+            UNVENCODER_CHECK(i + 1 < elements.size() && elements[i + 1].id == timestampId);
+            if (i + 1 < elements.size()) clusterTime = ReadUInt(output, elements[i + 1]);
+            clusterSizes.push_back(0);
+            continue;
+        }
+        if (element.id != simpleBlockId) continue;
+
+        UNVENCODER_CHECK(!clusterSizes.empty() && frameIndex < frames.size());
+        if (clusterSizes.empty() || frameIndex >= frames.size()) break;
+        ++clusterSizes.back();
+
+        const auto &frame = frames[frameIndex++];
+        const auto block = &output[element.dataOffset];
+        UNVENCODER_CHECK(block[0] == 0x81);
+        const auto offset = static_cast<int16_t>((block[1] << 8) | block[2]);
+        UNVENCODER_CHECK(offset >= 0);
+        UNVENCODER_CHECK(clusterTime + offset == (frame.timeStamp - frames[0].timeStamp) / 1000);
+        UNVENCODER_CHECK(((block[3] & 0x80) != 0) == (frame.isIdrFrame || frame.isRecoveryPoint));
+
+        std::vector<NalUnit> units;
+        ParseLengthPrefixedNalUnits(block + 4, static_cast<size_t>(element.size - 4), units);
+        size_t unitSize = 0;
+        for (const auto &unit : units)
+        {
+            UNVENCODER_CHECK(unit.type == NalUnitTypeSlice || unit.type == NalUnitTypeIdrSlice || unit.type == NalUnitTypeSei);
+            unitSize += 4 + unit.size;
+        }
+        UNVENCODER_CHECK(unitSize == element.size - 4);
+    }
+    UNVENCODER_CHECK(frameIndex == frames.size());
+    return clusterSizes;
+}
+
+
+void TestHeader()
+{
+    const Test::CannedStream stream(1920, 1080, 30, 10, 10, 2, 128, 0);
+    MatroskaMuxerDesc desc;
+    desc.width = 1920;
+    desc.height = 1080;
+    desc.frameRate = 30;
+    const auto output = Mux(stream, desc);
+    const auto elements = ReadElements(output);
+
+    // H.264 is not allowed in WebM, so the DocType is always matroska.
+    const auto docTypes = FindAll(elements, docTypeId);
+    UNVENCODER_CHECK(docTypes.size() == 1);
+    if (docTypes.size() == 1) UNVENCODER_CHECK(ReadString(output, *docTypes[0]) == "matroska");
+
+    const auto segments = FindAll(elements, segmentId);
+    UNVENCODER_CHECK(segments.size() == 1 && segments[0]->size == unknownSize);
+
+    const auto codecs = FindAll(elements, codecId);
+    UNVENCODER_CHECK(codecs.size() == 1 && ReadString(output, *codecs[0]) == "V_MPEG4/ISO/AVC");
+
+    // CodecPrivate carries the SPS/PPS of the first IDR frame.
+    const auto &idr = stream.GetFrames()[0].data;
+    std::vector<NalUnit> units;
+    ParseNalUnits(idr.data(), idr.size(), units);
+    std::vector<uint8_t> record;
+    BuildAvcDecoderConfigurationRecord(idr.data(), units, record);
+    const auto codecPrivates = FindAll(elements, codecPrivateId);
+    UNVENCODER_CHECK(codecPrivates.size() == 1);
+    if (codecPrivates.size() == 1)
+    {
+        const auto &codecPrivate = *codecPrivates[0];
+        UNVENCODER_CHECK(codecPrivate.size == record.size() && std::memcmp(&output[codecPrivate.dataOffset], record.data(), record.size()) == 0);
+    }
+
+    const auto widths = FindAll(elements, pixelWidthId);
+    const auto heights = FindAll(elements, pixelHeightId);
+    const auto durations = FindAll(elements, defaultDurationId);
+    UNVENCODER_CHECK(widths.size() == 1 && ReadUInt(output, *widths[0]) == 1920);
+    UNVENCODER_CHECK(heights.size() == 1 && ReadUInt(output, *heights[0]) == 1080);
+    UNVENCODER_CHECK(durations.size() == 1 && ReadUInt(output, *durations[0]) == 1000000000ULL / 30);
+}
+
+
+void TestIdrClusters()
+{
+    const Test::CannedStream stream(1280, 720, 30, 30, 10, 2, 256, 0);
+    MatroskaMuxerDesc desc;
+    desc.frameRate = 30;
+    desc.clusterDuration = 0;
+    const auto output = Mux(stream, desc);
+    const auto elements = ReadElements(output);
+
+    const auto clusterSizes = CheckBlocks(output, elements, stream);
+    UNVENCODER_CHECK((clusterSizes == std::vector<size_t> { 10, 10, 10 }));
+}
+
+
+void TestTimedClusters()
+{
+    const Test::CannedStream stream(640, 480, 30, 30, 30, 1, 128, 0);
+    MatroskaMuxerDesc desc;
+    desc.frameRate = 30;
+    desc.clusterDuration = 100;
+    const auto output = Mux(stream, desc);
+    const auto elements = ReadElements(output);
+
+    const auto clusterSizes = CheckBlocks(output, elements, stream);
+    UNVENCODER_CHECK(clusterSizes.size() == 10);
+    for (const auto size : clusterSizes)
+    {
+        UNVENCODER_CHECK(size == 3);
+    }
+}
+
+
+// Recovery points start clusters and are keyframes like IDR frames.
+void TestRecoveryPointClusters()
+{
+    const Test::CannedStream stream(640, 480, 30, 30, 30, 1, 128, 10);
+    MatroskaMuxerDesc desc;
+    desc.frameRate = 30;
+    desc.clusterDuration = 0;
+    const auto output = Mux(stream, desc);
+    const auto elements = ReadElements(output);
+
+    const auto clusterSizes = CheckBlocks(output, elements, stream);
+    UNVENCODER_CHECK((clusterSizes == std::vector<size_t> { 10, 10, 10 }));
+    UNVENCODER_CHECK(FindAll(elements, cuePointId).size() == 3);
+}
+
+
+// The SeekHead opens the segment and points at Info, Tracks and, once the
+// muxer could patch it, Cues. The Void after it fills the reserved space.
+void TestSeekHead()
+{
+    const Test::CannedStream stream(640, 480, 30, 30, 10, 1, 128, 0);
+    MatroskaMuxerDesc desc;
+
+    for (const bool canPatch : { true, false })
+    {
+        const auto output = Mux(stream, desc, canPatch);
+        const auto elements = ReadElements(output);
+
+        const auto segments = FindAll(elements, segmentId);
+        const auto seekHeads = FindAll(elements, seekHeadId);
+        const auto voids = FindAll(elements, voidId);
+        UNVENCODER_CHECK(segments.size() == 1 && seekHeads.size() == 1 && voids.size() == 1);
+        if (segments.size() != 1 || seekHeads.size() != 1 || voids.size() != 1) continue;
+        UNVENCODER_CHECK(seekHeads[0]->offset == segments[0]->dataOffset);
+        UNVENCODER_CHECK(voids[0]->offset == seekHeads[0]->dataOffset + seekHeads[0]->size);
+
+        const auto ids = FindAll(elements, seekIdId);
+        const auto positions = FindAll(elements, seekPositionId);
+        const std::vector<uint32_t> expectedIds = canPatch ?
+            std::vector<uint32_t> { infoId, tracksId, cuesId } :
+            std::vector<uint32_t> { infoId, tracksId };
+        UNVENCODER_CHECK(FindAll(elements, seekId).size() == expectedIds.size());
+        UNVENCODER_CHECK(ids.size() == expectedIds.size() && positions.size() == expectedIds.size());
+        if (ids.size() != expectedIds.size() || positions.size() != expectedIds.size()) continue;
+
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            const auto id = static_cast<uint32_t>(ReadUInt(output, *ids[i]));
+            UNVENCODER_CHECK(id == expectedIds[i]);
+
+            const auto offset = segments[0]->dataOffset + ReadUInt(output, *positions[i]);
+            bool isElement = false;
+            for (const auto &element : elements)
+            {
+                if (element.offset == offset) isElement = element.id == id;
+            }
+            UNVENCODER_CHECK(isElement);
+        }
+    }
+}
+
+
+// Cues come last and point at the IDR-started clusters, relative to the
+// start of the segment data.
+void TestCues()
+{
+    const Test::CannedStream stream(640, 480, 30, 30, 10, 1, 128, 0);
+    MatroskaMuxerDesc desc;
+    desc.frameRate = 30;
+    desc.clusterDuration = 100;
+    const auto output = Mux(stream, desc);
+    const auto elements = ReadElements(output);
+
+    const auto segments = FindAll(elements, segmentId);
+    const auto cues = FindAll(elements, cuesId);
+    UNVENCODER_CHECK(segments.size() == 1 && cues.size() == 1);
+    if (segments.size() != 1 || cues.size() != 1) return;
+    UNVENCODER_CHECK(cues[0]->dataOffset + cues[0]->size == output.size());
+
+    const auto times = FindAll(elements, cueTimeId);
+    const auto positions = FindAll(elements, cueClusterPositionId);
+    UNVENCODER_CHECK(FindAll(elements, cuePointId).size() == 3);
+    UNVENCODER_CHECK(times.size() == 3 && positions.size() == 3);
+    if (times.size() != 3 || positions.size() != 3) return;
+
+    const auto &frames = stream.GetFrames();
+    for (size_t i = 0; i < times.size(); ++i)
+    {
+        const auto time = ReadUInt(output, *times[i]);
+        UNVENCODER_CHECK(time == (frames[i * 10].timeStamp - frames[0].timeStamp) / 1000);
+
+        const auto offset = segments[0]->dataOffset + ReadUInt(output, *positions[i]);
+        bool isCluster = false;
+        for (size_t e = 0; e + 1 < elements.size(); ++e)
+        {
+            if (elements[e].offset != offset) continue;
+            isCluster = elements[e].id == clusterId && ReadUInt(output, elements[e + 1]) == time;
+        }
+        UNVENCODER_CHECK(isCluster);
+    }
+}
+
+
+// Frames before the first IDR frame cannot be decoded and are skipped.
+void TestStartsAtIdrFrame()
+{
+    const Test::CannedStream stream(640, 480, 30, 20, 10, 1, 128, 0);
+    std::vector<uint8_t> output;
+    MatroskaMuxerDesc desc;
+    MatroskaMuxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, desc);
+
+    const auto &frames = stream.GetFrames();
+    for (size_t i = 5; i < frames.size(); ++i)
+    {
+        MuxerPacket packet;
+        packet.data = frames[i].data.data();
+        packet.size = frames[i].data.size();
+        packet.timeStamp = frames[i].timeStamp;
+        packet.isIdrFrame = frames[i].isIdrFrame;
+        muxer.Write(packet);
+        if (i < 10) UNVENCODER_CHECK(output.empty());
+    }
+    muxer.Close();
+
+    const auto elements = ReadElements(output);
+    UNVENCODER_CHECK(FindAll(elements, simpleBlockId).size() == 10);
+}
+
+
+// Slices delivered one by one end up in the same blocks as whole frames.
+void TestSubFrameSlices()
+{
+    const Test::CannedStream stream(640, 480, 30, 20, 10, 3, 128, 0);
+    MatroskaMuxerDesc desc;
+    const auto expected = Mux(stream, desc, false);
+
+    std::vector<uint8_t> output;
+    MatroskaMuxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, desc);
+
+    std::vector<NalUnit> units;
+    for (const auto &frame : stream.GetFrames())
+    {
+        ParseNalUnits(frame.data.data(), frame.data.size(), units);
+        size_t begin = 0;
+        for (size_t i = 0; i < units.size(); ++i)
+        {
+            if (units[i].type != NalUnitTypeSlice && units[i].type != NalUnitTypeIdrSlice) continue;
+
+            const auto end = units[i].offset + units[i].size;
+            MuxerPacket packet;
+            packet.data = frame.data.data() + begin;
+            packet.size = end - begin;
+            packet.timeStamp = frame.timeStamp;
+            packet.isIdrFrame = frame.isIdrFrame;
+            packet.isLastSlice = i + 1 == units.size();
+            muxer.Write(packet);
+            begin = end;
+        }
+    }
+    muxer.Close();
+
+    UNVENCODER_CHECK(output == expected);
+}
+
+
+}
+
+
+int main()
+{
+    TestHeader();
+    TestIdrClusters();
+    TestTimedClusters();
+    TestRecoveryPointClusters();
+    TestSeekHead();
+    TestCues();
+    TestStartsAtIdrFrame();
+    TestSubFrameSlices();
+    return Test::Finish("MatroskaMuxerTest");
+}
@@ -0,0 +1,326 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Mp4Muxer.h"
+#include "CannedStream.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+namespace
+{
+
+
+constexpr uint32_t timeScale = 90000;
+
+
+struct Box
+{
+    std::string type;
+    size_t offset; // of the box header
+    size_t size;
+
+    size_t GetBodyOffset() const { return offset + 8; }
+    size_t GetEnd() const { return offset + size; }
+};
+
+
+uint32_t ReadU32(const uint8_t *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+uint64_t ReadU64(const uint8_t *p)
+{
+    return (static_cast<uint64_t>(ReadU32(p)) << 32) | ReadU32(p + 4);
+}
+
+
+// Reads the boxes in [begin, end). Stops at the first malformed size.
+std::vector<Box> ReadBoxes(const std::vector<uint8_t> &data, size_t begin, size_t end)
+{
+    std::vector<Box> boxes;
+    while (begin + 8 <= end)
+    {
+        Box box;
+        box.offset = begin;
+        box.size = ReadU32(&data[begin]);
+        box.type.assign(reinterpret_cast<const char *>(&data[begin + 4]), 4);
+        if (box.size < 8 || box.GetEnd() > end) break;
+        boxes.push_back(box);
+        begin = box.GetEnd();
+    }
+    return boxes;
+}
+
+
+// Finds a box by its path from the top level, e.g. { "moov", "trak" }.
+// stsd and avc1 have fields in front of their child boxes, which are skipped.
+bool FindBox(
+    const std::vector<uint8_t> &data,
+    size_t begin,
+    size_t end,
+    const std::vector<std::string> &path,
+    Box &result)
+{
+    for (size_t i = 0; i < path.size(); ++i)
+    {
+        bool isFound = false;
+        for (const auto &box : ReadBoxes(data, begin, end))
+        {
+            if (box.type != path[i]) continue;
+
+            result = box;
+            begin = box.GetBodyOffset();
+            if (box.type == "stsd") begin += 8;
+            if (box.type == "avc1") begin += 78;
+            end = box.GetEnd();
+            isFound = true;
+            break;
+        }
+        if (!isFound) return false;
+    }
+    return true;
+}
+
+
+std::vector<std::string> GetTypes(const std::vector<Box> &boxes)
+{
+    std::vector<std::string> types;
+    for (const auto &box : boxes) types.push_back(box.type);
+    return types;
+}
+
+
+std::vector<uint8_t> Mux(const Test::CannedStream &stream, const Mp4MuxerDesc &desc)
+{
+    std::vector<uint8_t> output;
+    Mp4Muxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, desc);
+    stream.WriteTo(muxer);
+    muxer.Close();
+    return output;
+}
+
+
+// Checks every fragment: tfdt continues where the previous one ended, trun
+// sizes add up to mdat, the data offset points at the first sample, only
+// every syncInterval-th frame (IDR frames and recovery points) is a sync
+// sample, and mdat holds length-prefixed slices and SEI only.
+void CheckFragments(
+    const std::vector<uint8_t> &output,
+    const std::vector<Box> &boxes,
+    uint32_t frameDuration,
+    uint32_t syncInterval,
+    std::vector<uint32_t> &sampleCounts)
+{
+    constexpr uint32_t syncSampleFlags = 0x02000000;
+    uint64_t expectedTime = 0;
+    uint32_t frameIndex = 0;
+    for (size_t i = 2; i + 1 < boxes.size(); i += 2)
+    {
+        const auto &moof = boxes[i];
+        const auto &mdat = boxes[i + 1];
+        UNVENCODER_CHECK(moof.type == "moof" && mdat.type == "mdat");
+
+        Box tfdt, trun;
+        UNVENCODER_CHECK(FindBox(output, moof.offset, moof.GetEnd(), { "moof", "traf", "tfdt" }, tfdt));
+        UNVENCODER_CHECK(FindBox(output, moof.offset, moof.GetEnd(), { "moof", "traf", "trun" }, trun));
+        UNVENCODER_CHECK(ReadU64(&output[tfdt.GetBodyOffset() + 4]) == expectedTime);
+
+        const auto body = &output[trun.GetBodyOffset()];
+        const auto sampleCount = ReadU32(body + 4);
+        const auto dataOffset = ReadU32(body + 8);
+        UNVENCODER_CHECK(trun.size == 8 + 12 + sampleCount * 12);
+        UNVENCODER_CHECK(dataOffset == moof.size + 8);
+        sampleCounts.push_back(sampleCount);
+
+        uint64_t totalSize = 0;
+        for (uint32_t s = 0; s < sampleCount; ++s)
+        {
+            const auto sample = body + 12 + s * 12;
+            // Microsecond timestamps round to +-1 tick of the 90 kHz clock.
+            const auto duration = ReadU32(sample);
+            UNVENCODER_CHECK(duration + 1 >= frameDuration && duration <= frameDuration + 1);
+            totalSize += ReadU32(sample + 4);
+            expectedTime += duration;
+            const bool isSync = ReadU32(sample + 8) == syncSampleFlags;
+            UNVENCODER_CHECK(isSync == (frameIndex++ % syncInterval == 0));
+        }
+        UNVENCODER_CHECK(totalSize == mdat.size - 8);
+
+        std::vector<NalUnit> units;
+        ParseLengthPrefixedNalUnits(&output[mdat.GetBodyOffset()], mdat.size - 8, units);
+        size_t unitSize = 0;
+        for (const auto &unit : units)
+        {
+            UNVENCODER_CHECK(unit.type == NalUnitTypeSlice || unit.type == NalUnitTypeIdrSlice || unit.type == NalUnitTypeSei);
+            unitSize += 4 + unit.size;
+        }
+        UNVENCODER_CHECK(unitSize == mdat.size - 8);
+    }
+}
+
+
+void TestIdrFragments()
+{
+    const Test::CannedStream stream(1280, 720, 30, 30, 10, 2, 256, 0);
+    Mp4MuxerDesc desc;
+    desc.width = 1280;
+    desc.height = 720;
+    desc.frameRate = 30;
+    desc.fragmentDuration = 0;
+    const auto output = Mux(stream, desc);
+
+    const auto boxes = ReadBoxes(output, 0, output.size());
+    UNVENCODER_CHECK((GetTypes(boxes) == std::vector<std::string> {
+        "ftyp", "moov", "moof", "mdat", "moof", "mdat", "moof", "mdat" }));
+    UNVENCODER_CHECK(!boxes.empty() && boxes.back().GetEnd() == output.size());
+
+    // avcC carries the SPS/PPS of the first IDR frame.
+    const auto &idr = stream.GetFrames()[0].data;
+    std::vector<NalUnit> units;
+    ParseNalUnits(idr.data(), idr.size(), units);
+    std::vector<uint8_t> record;
+    BuildAvcDecoderConfigurationRecord(idr.data(), units, record);
+
+    Box avcC;
+    UNVENCODER_CHECK(FindBox(output, 0, output.size(), { "moov", "trak", "mdia", "minf", "stbl", "stsd", "avc1", "avcC" }, avcC));
+    UNVENCODER_CHECK(avcC.size == 8 + record.size());
+    UNVENCODER_CHECK(avcC.size == 8 + record.size() && std::memcmp(&output[avcC.GetBodyOffset()], record.data(), record.size()) == 0);
+
+    Box tkhd;
+    UNVENCODER_CHECK(FindBox(output, 0, output.size(), { "moov", "trak", "tkhd" }, tkhd));
+    UNVENCODER_CHECK(ReadU32(&output[tkhd.GetEnd() - 8]) == (1280U << 16));
+    UNVENCODER_CHECK(ReadU32(&output[tkhd.GetEnd() - 4]) == (720U << 16));
+
+    std::vector<uint32_t> sampleCounts;
+    CheckFragments(output, boxes, timeScale / 30, 10, sampleCounts);
+    UNVENCODER_CHECK((sampleCounts == std::vector<uint32_t> { 10, 10, 10 }));
+}
+
+
+void TestTimedFragments()
+{
+    const Test::CannedStream stream(640, 480, 30, 30, 30, 1, 128, 0);
+    Mp4MuxerDesc desc;
+    desc.width = 640;
+    desc.height = 480;
+    desc.frameRate = 30;
+    desc.fragmentDuration = 100;
+    const auto output = Mux(stream, desc);
+
+    const auto boxes = ReadBoxes(output, 0, output.size());
+    std::vector<uint32_t> sampleCounts;
+    CheckFragments(output, boxes, timeScale / 30, 30, sampleCounts);
+    UNVENCODER_CHECK(sampleCounts.size() == 10);
+    for (const auto count : sampleCounts)
+    {
+        UNVENCODER_CHECK(count == 3);
+    }
+}
+
+
+// Recovery points are sync samples and start fragments like IDR frames.
+void TestRecoveryPointFragments()
+{
+    const Test::CannedStream stream(640, 480, 30, 30, 30, 1, 128, 10);
+    Mp4MuxerDesc desc;
+    desc.width = 640;
+    desc.height = 480;
+    desc.frameRate = 30;
+    desc.fragmentDuration = 0;
+    const auto output = Mux(stream, desc);
+
+    const auto boxes = ReadBoxes(output, 0, output.size());
+    std::vector<uint32_t> sampleCounts;
+    CheckFragments(output, boxes, timeScale / 30, 10, sampleCounts);
+    UNVENCODER_CHECK((sampleCounts == std::vector<uint32_t> { 10, 10, 10 }));
+}
+
+
+// Frames before the first IDR frame cannot be decoded and are skipped.
+void TestStartsAtIdrFrame()
+{
+    const Test::CannedStream stream(640, 480, 30, 20, 10, 1, 128, 0);
+    std::vector<uint8_t> output;
+    Mp4MuxerDesc desc;
+    desc.fragmentDuration = 0;
+    Mp4Muxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, desc);
+
+    const auto &frames = stream.GetFrames();
+    for (size_t i = 5; i < frames.size(); ++i)
+    {
+        MuxerPacket packet;
+        packet.data = frames[i].data.data();
+        packet.size = frames[i].data.size();
+        packet.timeStamp = frames[i].timeStamp;
+        packet.isIdrFrame = frames[i].isIdrFrame;
+        muxer.Write(packet);
+        if (i < 10) UNVENCODER_CHECK(output.empty());
+    }
+    muxer.Close();
+
+    const auto boxes = ReadBoxes(output, 0, output.size());
+    UNVENCODER_CHECK((GetTypes(boxes) == std::vector<std::string> { "ftyp", "moov", "moof", "mdat" }));
+}
+
+
+// Slices delivered one by one end up in the same samples as whole frames.
+void TestSubFrameSlices()
+{
+    const Test::CannedStream stream(640, 480, 30, 20, 10, 3, 128, 0);
+    Mp4MuxerDesc desc;
+    const auto expected = Mux(stream, desc);
+
+    std::vector<uint8_t> output;
+    Mp4Muxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, desc);
+
+    std::vector<NalUnit> units;
+    for (const auto &frame : stream.GetFrames())
+    {
+        ParseNalUnits(frame.data.data(), frame.data.size(), units);
+        size_t begin = 0;
+        for (size_t i = 0; i < units.size(); ++i)
+        {
+            if (units[i].type != NalUnitTypeSlice && units[i].type != NalUnitTypeIdrSlice) continue;
+
+            const auto end = units[i].offset + units[i].size;
+            MuxerPacket packet;
+            packet.data = frame.data.data() + begin;
+            packet.size = end - begin;
+            packet.timeStamp = frame.timeStamp;
+            packet.isIdrFrame = frame.isIdrFrame;
+            packet.isLastSlice = i + 1 == units.size();
+            muxer.Write(packet);
+            begin = end;
+        }
+    }
+    muxer.Close();
+
+    UNVENCODER_CHECK(output == expected);
+}
+
+
+}
+
+
+int main()
+{
+    TestIdrFragments();
+    TestTimedFragments();
+    TestRecoveryPointFragments();
+    TestStartsAtIdrFrame();
+    TestSubFrameSlices();
+    return Test::Finish("Mp4MuxerTest");
+}
@@ -0,0 +1,375 @@
+#include <cstring>
+#include <map>
+#include <vector>
+#include "MpegTsMuxer.h"
+#include "CannedStream.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+namespace
+{
+
+
+constexpr size_t tsPacketSize = 188;
+constexpr uint16_t patPid = 0x0000;
+constexpr uint16_t pmtPid = 0x1000;
+constexpr uint16_t videoPid = 0x0100;
+constexpr uint64_t maxPcrInterval = 90000 / 10;
+
+const uint8_t accessUnitDelimiter[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+
+
+uint32_t CalcCrc32(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc ^= static_cast<uint32_t>(data[i]) << 24;
+        for (int j = 0; j < 8; ++j)
+        {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+
+uint64_t ReadTimeStamp(const uint8_t *p)
+{
+    return
+        (static_cast<uint64_t>((p[0] >> 1) & 0x07) << 30) |
+        (static_cast<uint64_t>(p[1]) << 22) |
+        (static_cast<uint64_t>(p[2] >> 1) << 15) |
+        (static_cast<uint64_t>(p[3]) << 7) |
+        (p[4] >> 1);
+}
+
+
+struct Pes
+{
+    std::vector<uint8_t> data;
+    uint64_t pcr = 0;
+    bool isRandomAccess = false;
+};
+
+
+// Splits a transport stream into PES packets and checks the packet layer
+// on the way: sync bytes, continuity counters, PSI CRCs and PCR spacing.
+struct TsReader
+{
+    std::vector<Pes> pesList;
+    std::vector<uint64_t> pcrs;
+    int patCount = 0;
+    int pmtCount = 0;
+    int pcrOnlyCount = 0;
+
+    void Read(const std::vector<uint8_t> &ts)
+    {
+        UNVENCODER_CHECK(ts.size() % tsPacketSize == 0);
+
+        std::map<uint16_t, int> continuityCounters;
+        for (size_t offset = 0; offset + tsPacketSize <= ts.size(); offset += tsPacketSize)
+        {
+            const auto packet = &ts[offset];
+            UNVENCODER_CHECK(packet[0] == 0x47);
+
+            const bool isPayloadStart = (packet[1] & 0x40) != 0;
+            const auto pid = static_cast<uint16_t>(((packet[1] & 0x1F) << 8) | packet[2]);
+            const bool hasAdaptation = (packet[3] & 0x20) != 0;
+            const bool hasPayload = (packet[3] & 0x10) != 0;
+            const auto continuityCounter = packet[3] & 0x0F;
+
+            // Packets without payload repeat the counter, the others advance it.
+            const auto it = continuityCounters.find(pid);
+            if (it != continuityCounters.end())
+            {
+                const auto expected = hasPayload ? (it->second + 1) & 0x0F : it->second;
+                UNVENCODER_CHECK(continuityCounter == expected);
+            }
+            continuityCounters[pid] = continuityCounter;
+
+            size_t payloadOffset = 4;
+            bool isRandomAccess = false;
+            bool hasPcr = false;
+            uint64_t pcr = 0;
+            if (hasAdaptation)
+            {
+                const auto length = packet[4];
+                UNVENCODER_CHECK(length <= tsPacketSize - 5);
+                UNVENCODER_CHECK(hasPayload || length == tsPacketSize - 5);
+                if (length > 0)
+                {
+                    isRandomAccess = (packet[5] & 0x40) != 0;
+                    hasPcr = (packet[5] & 0x10) != 0;
+                    if (hasPcr)
+                    {
+                        pcr =
+                            (static_cast<uint64_t>(packet[6]) << 25) |
+                            (static_cast<uint64_t>(packet[7]) << 17) |
+                            (static_cast<uint64_t>(packet[8]) << 9) |
+                            (static_cast<uint64_t>(packet[9]) << 1) |
+                            (packet[10] >> 7);
+                    }
+                }
+                payloadOffset += 1 + length;
+            }
+
+            if (hasPcr)
+            {
+                UNVENCODER_CHECK(pid == videoPid);
+                if (!pcrs.empty())
+                {
+                    UNVENCODER_CHECK(pcr >= pcrs.back());
+                    UNVENCODER_CHECK(pcr - pcrs.back() <= maxPcrInterval);
+                }
+                pcrs.push_back(pcr);
+                if (!hasPayload) ++pcrOnlyCount;
+            }
+
+            if (!hasPayload) continue;
+
+            const auto payload = packet + payloadOffset;
+            const auto payloadSize = tsPacketSize - payloadOffset;
+
+            if (pid == patPid || pid == pmtPid)
+            {
+                UNVENCODER_CHECK(isPayloadStart && payload[0] == 0);
+                const auto section = payload + 1;
+                const auto sectionSize = 3 + (((section[1] & 0x0F) << 8) | section[2]);
+                UNVENCODER_CHECK(CalcCrc32(section, sectionSize) == 0);
+                if (pid == patPid)
+                {
+                    UNVENCODER_CHECK(section[0] == 0x00);
+                    UNVENCODER_CHECK((((section[10] & 0x1F) << 8) | section[11]) == pmtPid);
+                    ++patCount;
+                }
+                else
+                {
+                    UNVENCODER_CHECK(section[0] == 0x02);
+                    UNVENCODER_CHECK((((section[8] & 0x1F) << 8) | section[9]) == videoPid);
+                    UNVENCODER_CHECK(section[12] == 0x1B);
+                    UNVENCODER_CHECK((((section[13] & 0x1F) << 8) | section[14]) == videoPid);
+                    ++pmtCount;
+                }
+                continue;
+            }
+
+            UNVENCODER_CHECK(pid == videoPid);
+            if (isPayloadStart)
+            {
+                // Every PES starts with a PCR in its first packet.
+                UNVENCODER_CHECK(hasPcr);
+                Pes pes;
+                pes.pcr = pcr;
+                pes.isRandomAccess = isRandomAccess;
+                pesList.push_back(pes);
+            }
+            UNVENCODER_CHECK(!pesList.empty());
+            if (pesList.empty()) continue;
+            pesList.back().data.insert(pesList.back().data.end(), payload, payload + payloadSize);
+        }
+    }
+};
+
+
+// Checks the PES header and returns the elementary stream data after it.
+std::vector<uint8_t> GetElementaryStream(const Pes &pes, uint64_t expectedPtsDelay)
+{
+    const auto &data = pes.data;
+    UNVENCODER_CHECK(data.size() > 14);
+    if (data.size() <= 14) return {};
+
+    UNVENCODER_CHECK(data[0] == 0x00 && data[1] == 0x00 && data[2] == 0x01 && data[3] == 0xE0);
+    UNVENCODER_CHECK(data[4] == 0x00 && data[5] == 0x00);
+    UNVENCODER_CHECK((data[7] & 0xC0) == 0x80 && data[8] == 5);
+    UNVENCODER_CHECK(ReadTimeStamp(&data[9]) == pes.pcr + expectedPtsDelay);
+
+    return std::vector<uint8_t>(data.begin() + 14, data.end());
+}
+
+
+std::vector<uint8_t> WithAccessUnitDelimiter(const std::vector<uint8_t> &frame)
+{
+    std::vector<uint8_t> data(sizeof(accessUnitDelimiter) + frame.size());
+    std::memcpy(data.data(), accessUnitDelimiter, sizeof(accessUnitDelimiter));
+    std::memcpy(data.data() + sizeof(accessUnitDelimiter), frame.data(), frame.size());
+    return data;
+}
+
+
+std::vector<uint8_t> Mux(const Test::CannedStream &stream, int frameRate)
+{
+    std::vector<uint8_t> output;
+    MpegTsMuxerDesc desc;
+    desc.frameRate = frameRate;
+    MpegTsMuxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, desc);
+    stream.WriteTo(muxer);
+    muxer.Close();
+    return output;
+}
+
+
+void TestFrames()
+{
+    const Test::CannedStream stream(1280, 720, 30, 40, 10, 2, 1000, 0);
+    const auto output = Mux(stream, 30);
+
+    TsReader reader;
+    reader.Read(output);
+
+    const auto &frames = stream.GetFrames();
+    UNVENCODER_CHECK(reader.pesList.size() == frames.size());
+    for (size_t i = 0; i < reader.pesList.size() && i < frames.size(); ++i)
+    {
+        const auto &pes = reader.pesList[i];
+        UNVENCODER_CHECK(pes.isRandomAccess == frames[i].isIdrFrame);
+
+        // The stream starts at zero and PTS runs 700 ms ahead of PCR.
+        const auto es = GetElementaryStream(pes, 63000);
+        UNVENCODER_CHECK(es == WithAccessUnitDelimiter(frames[i].data));
+        UNVENCODER_CHECK(pes.pcr + 1 >= i * 3000 && pes.pcr <= i * 3000 + 1);
+    }
+
+    // PAT/PMT at every IDR frame and at least every 100 ms in between.
+    UNVENCODER_CHECK(reader.patCount == reader.pmtCount);
+    UNVENCODER_CHECK(reader.patCount >= 40 / 3);
+    UNVENCODER_CHECK(reader.pcrOnlyCount == 0);
+}
+
+
+// An access unit delimiter that is already there is not added again.
+void TestExistingAccessUnitDelimiter()
+{
+    const Test::CannedStream stream(640, 480, 30, 2, 2, 1, 100, 0);
+    const auto frame = WithAccessUnitDelimiter(stream.GetFrames()[0].data);
+
+    std::vector<uint8_t> output;
+    MpegTsMuxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, MpegTsMuxerDesc());
+
+    MuxerPacket packet;
+    packet.data = frame.data();
+    packet.size = frame.size();
+    packet.isIdrFrame = true;
+    muxer.Write(packet);
+    muxer.Close();
+
+    TsReader reader;
+    reader.Read(output);
+    UNVENCODER_CHECK(reader.pesList.size() == 1);
+    if (reader.pesList.empty()) return;
+    UNVENCODER_CHECK(GetElementaryStream(reader.pesList[0], 63000) == frame);
+}
+
+
+// Frames more than 100 ms apart are bridged with PCR-only packets.
+void TestPcrInterval()
+{
+    const Test::CannedStream stream(640, 480, 2, 6, 3, 1, 100, 0);
+    const auto output = Mux(stream, 2);
+
+    TsReader reader;
+    reader.Read(output);
+
+    // 500 ms between frames needs four PCR-only packets each.
+    UNVENCODER_CHECK(reader.pesList.size() == 6);
+    UNVENCODER_CHECK(reader.pcrOnlyCount == 5 * 4);
+    UNVENCODER_CHECK(reader.pcrs.size() == 6 + 5 * 4);
+    UNVENCODER_CHECK(!reader.pcrs.empty() && reader.pcrs.back() == 5 * 45000);
+}
+
+
+// Slices continue the PES of their frame instead of starting new ones.
+void TestSubFrameSlices()
+{
+    const Test::CannedStream stream(1280, 720, 30, 12, 6, 4, 300, 0);
+
+    std::vector<uint8_t> output;
+    MpegTsMuxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, MpegTsMuxerDesc());
+
+    std::vector<NalUnit> units;
+    for (const auto &frame : stream.GetFrames())
+    {
+        ParseNalUnits(frame.data.data(), frame.data.size(), units);
+        size_t begin = 0;
+        for (size_t i = 0; i < units.size(); ++i)
+        {
+            if (units[i].type != NalUnitTypeSlice && units[i].type != NalUnitTypeIdrSlice) continue;
+
+            const auto end = units[i].offset + units[i].size;
+            MuxerPacket packet;
+            packet.data = frame.data.data() + begin;
+            packet.size = end - begin;
+            packet.timeStamp = frame.timeStamp;
+            packet.isIdrFrame = frame.isIdrFrame;
+            packet.isLastSlice = i + 1 == units.size();
+            muxer.Write(packet);
+            begin = end;
+        }
+    }
+    muxer.Close();
+
+    TsReader reader;
+    reader.Read(output);
+
+    const auto &frames = stream.GetFrames();
+    UNVENCODER_CHECK(reader.pesList.size() == frames.size());
+    for (size_t i = 0; i < reader.pesList.size() && i < frames.size(); ++i)
+    {
+        UNVENCODER_CHECK(GetElementaryStream(reader.pesList[i], 63000) == WithAccessUnitDelimiter(frames[i].data));
+    }
+}
+
+
+void TestStartsAtIdrFrame()
+{
+    const Test::CannedStream stream(640, 480, 30, 20, 10, 1, 100, 0);
+
+    std::vector<uint8_t> output;
+    MpegTsMuxer muxer([&](const uint8_t *data, size_t size)
+    {
+        output.insert(output.end(), data, data + size);
+    }, MpegTsMuxerDesc());
+
+    const auto &frames = stream.GetFrames();
+    for (size_t i = 3; i < frames.size(); ++i)
+    {
+        MuxerPacket packet;
+        packet.data = frames[i].data.data();
+        packet.size = frames[i].data.size();
+        packet.timeStamp = frames[i].timeStamp;
+        packet.isIdrFrame = frames[i].isIdrFrame;
+        muxer.Write(packet);
+        if (i < 10) UNVENCODER_CHECK(output.empty());
+    }
+    muxer.Close();
+
+    TsReader reader;
+    reader.Read(output);
+    UNVENCODER_CHECK(reader.pesList.size() == 10);
+    UNVENCODER_CHECK(!reader.pesList.empty() && reader.pesList[0].isRandomAccess);
+}
+
+
+}
+
+
+int main()
+{
+    TestFrames();
+    TestExistingAccessUnitDelimiter();
+    TestPcrInterval();
+    TestSubFrameSlices();
+    TestStartsAtIdrFrame();
+    return Test::Finish("MpegTsMuxerTest");
+}
@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <memory>
+#include "Mp4Muxer.h"
+#include "MpegTsMuxer.h"
+#include "MatroskaMuxer.h"
+#include "CannedStream.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+// Measures how fast each container writer turns a canned 1080p60 stream into
+// bytes. The output callback only counts, so the numbers are the muxer's own
+// cost per frame, which runs on the drain thread for every recorded frame.
+
+namespace
+{
+
+
+constexpr int width = 1920;
+constexpr int height = 1080;
+constexpr int frameRate = 60;
+constexpr int gopLength = 120;
+constexpr int sliceCount = 4;
+constexpr size_t sliceSize = 16 * 1024; // [byte], about 15 Mbps at 60 fps
+
+
+struct Result
+{
+    double seconds = 0.0;
+    uint64_t inputSize = 0;
+    uint64_t outputSize = 0;
+};
+
+
+template <class MuxerType, class Desc>
+Result Run(const Test::CannedStream &stream, const Desc &desc, int repeatCount)
+{
+    Result result;
+    for (const auto &frame : stream.GetFrames())
+    {
+        result.inputSize += frame.data.size();
+    }
+    result.inputSize *= repeatCount;
+
+    const Test::Stopwatch stopwatch;
+    for (int i = 0; i < repeatCount; ++i)
+    {
+        MuxerType muxer([&](const uint8_t *, size_t size)
+        {
+            result.outputSize += size;
+        }, desc);
+        stream.WriteTo(muxer);
+        muxer.Close();
+    }
+    result.seconds = stopwatch.GetSeconds();
+    return result;
+}
+
+
+void Print(const char *name, uint64_t frameCount, const Result &result)
+{
+    std::printf(
+        "%-10s %8.1f ns/frame  %8.1f MB/s in  %8.1f MB/s out\n",
+        name,
+        result.seconds * 1e9 / static_cast<double>(frameCount),
+        static_cast<double>(result.inputSize) / result.seconds / 1e6,
+        static_cast<double>(result.outputSize) / result.seconds / 1e6);
+}
+
+
+}
+
+
+int main(int argc, char **argv)
+{
+    const bool isQuickRun = Test::IsQuickRun(argc, argv);
+    const int frameCount = isQuickRun ? 60 : 600;
+    const int repeatCount = isQuickRun ? 1 : 20;
+    const auto totalFrameCount = static_cast<uint64_t>(frameCount) * repeatCount;
+
+    const Test::CannedStream stream(width, height, frameRate, frameCount, gopLength, sliceCount, sliceSize);
+
+    Mp4MuxerDesc mp4Desc;
+    mp4Desc.width = width;
+    mp4Desc.height = height;
+    mp4Desc.frameRate = frameRate;
+    Print("mp4", totalFrameCount, Run<Mp4Muxer>(stream, mp4Desc, repeatCount));
+
+    MpegTsMuxerDesc tsDesc;
+    tsDesc.frameRate = frameRate;
+    Print("mpeg-ts", totalFrameCount, Run<MpegTsMuxer>(stream, tsDesc, repeatCount));
+
+    MatroskaMuxerDesc mkvDesc;
+    mkvDesc.width = width;
+    mkvDesc.height = height;
+    mkvDesc.frameRate = frameRate;
+    Print("matroska", totalFrameCount, Run<MatroskaMuxer>(stream, mkvDesc, repeatCount));
+
+    return 0;
+}
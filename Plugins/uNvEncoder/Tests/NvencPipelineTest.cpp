@@ -0,0 +1,242 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <d3d11.h>
+#include "Nvenc.h"
+#include "FakeNvenc.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+// Common.cpp expects the Unity interfaces that Main.cpp keeps. Encode() is
+// only called without a source texture here, so they are never used.
+struct IUnityInterfaces;
+namespace uNvEncoder
+{
+    IUnityInterfaces *g_unity = nullptr;
+}
+
+
+namespace
+{
+
+
+ComPtr<ID3D11Device> CreateDevice()
+{
+    // WARP does not need a GPU, and NVENC itself is replaced by FakeNvenc.
+    ComPtr<ID3D11Device> device;
+    ::D3D11CreateDevice(
+        nullptr,
+        D3D_DRIVER_TYPE_WARP,
+        nullptr,
+        0,
+        nullptr,
+        0,
+        D3D11_SDK_VERSION,
+        &device,
+        nullptr,
+        nullptr);
+    return device;
+}
+
+
+NvencDesc CreateDesc(const ComPtr<ID3D11Device> &device, uint32_t pipelineDepth)
+{
+    NvencDesc desc;
+    desc.d3d11Device = device;
+    desc.width = 256;
+    desc.height = 256;
+    desc.pipelineDepth = pipelineDepth;
+    return desc;
+}
+
+
+// With a slow encoder every slot must be usable before the first completion.
+void TestFramesInFlight(const ComPtr<ID3D11Device> &device)
+{
+    Test::FakeNvenc fake(std::chrono::milliseconds(50));
+    Nvenc::SetFunctionList(&fake.GetFunctionList());
+
+    Nvenc nvenc(CreateDesc(device, 4));
+    nvenc.Initialize();
+
+    for (uint64_t i = 0; i < 4; ++i)
+    {
+        UNVENCODER_CHECK(nvenc.CanEncode());
+        nvenc.Encode(nullptr, i == 0, i);
+    }
+    UNVENCODER_CHECK(!nvenc.CanEncode());
+
+    std::vector<NvencEncodedData> data;
+    nvenc.GetEncodedData(data);
+
+    UNVENCODER_CHECK(data.size() == 4);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        UNVENCODER_CHECK(data[i].index == i);
+        UNVENCODER_CHECK(data[i].timeStamp == i);
+        UNVENCODER_CHECK(data[i].isIdrFrame == (i == 0));
+    }
+    UNVENCODER_CHECK(fake.GetMaxInFlightCount() == 4);
+    UNVENCODER_CHECK(nvenc.CanEncode());
+
+    data.clear();
+    nvenc.Finalize();
+    Nvenc::SetFunctionList(nullptr);
+}
+
+
+// The Unity thread submits while the encode thread drains, as Encoder does.
+void TestConcurrentDrain(const ComPtr<ID3D11Device> &device)
+{
+    constexpr uint64_t frameCount = 200;
+
+    Test::FakeNvenc fake(std::chrono::milliseconds(5));
+    Nvenc::SetFunctionList(&fake.GetFunctionList());
+
+    Nvenc nvenc(CreateDesc(device, 3));
+    nvenc.Initialize();
+
+    std::atomic<bool> isSubmitting { true };
+    std::vector<NvencEncodedData> data;
+    std::thread drainThread([&]
+    {
+        while (isSubmitting || data.size() < frameCount)
+        {
+            nvenc.GetEncodedData(data);
+            std::this_thread::yield();
+        }
+    });
+
+    for (uint64_t i = 0; i < frameCount; ++i)
+    {
+        while (!nvenc.CanEncode())
+        {
+            std::this_thread::yield();
+        }
+        nvenc.Encode(nullptr, i == 0, i);
+    }
+    isSubmitting = false;
+    drainThread.join();
+
+    UNVENCODER_CHECK(data.size() == frameCount);
+    bool isOrdered = true;
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        isOrdered = isOrdered && data[i].index == i && data[i].timeStamp == i;
+    }
+    UNVENCODER_CHECK(isOrdered);
+    UNVENCODER_CHECK(fake.GetMaxInFlightCount() > 1);
+
+    data.clear();
+    nvenc.Finalize();
+    Nvenc::SetFunctionList(nullptr);
+}
+
+
+// Locked bitstreams held by the consumer must not stop new frames.
+void TestZeroCopy(const ComPtr<ID3D11Device> &device)
+{
+    Test::FakeNvenc fake(std::chrono::milliseconds(1));
+    Nvenc::SetFunctionList(&fake.GetFunctionList());
+
+    auto desc = CreateDesc(device, 2);
+    desc.zeroCopy = true;
+    Nvenc nvenc(desc);
+    nvenc.Initialize();
+
+    std::vector<NvencEncodedData> held;
+    for (uint64_t i = 0; i < 2; ++i)
+    {
+        nvenc.Encode(nullptr, i == 0, i);
+    }
+    nvenc.GetEncodedData(held);
+    UNVENCODER_CHECK(held.size() == 2);
+
+    std::vector<NvencEncodedData> data;
+    for (uint64_t i = 2; i < 4; ++i)
+    {
+        UNVENCODER_CHECK(nvenc.CanEncode());
+        nvenc.Encode(nullptr, false, i);
+    }
+    UNVENCODER_CHECK(!nvenc.CanEncode());
+    nvenc.GetEncodedData(data);
+    UNVENCODER_CHECK(data.size() == 2);
+
+    held.clear();
+    UNVENCODER_CHECK(nvenc.CanEncode());
+
+    data.clear();
+    nvenc.Finalize();
+    Nvenc::SetFunctionList(nullptr);
+}
+
+
+
+
+// Each finished slice comes out as its own packet, the first one with the
+// parameter sets in front of it.
+void TestSubFrameOutput(const ComPtr<ID3D11Device> &device)
+{
+    Test::FakeNvenc fake(std::chrono::milliseconds(5));
+    Nvenc::SetFunctionList(&fake.GetFunctionList());
+
+    auto desc = CreateDesc(device, 2);
+    desc.subFrameOutput = true;
+    desc.sliceCount = 2;
+    Nvenc nvenc(desc);
+    nvenc.Initialize();
+
+    std::vector<NvencEncodedData> data;
+    for (uint64_t i = 0; i < 2; ++i)
+    {
+        nvenc.Encode(nullptr, i == 0, i);
+        nvenc.GetEncodedData(data);
+    }
+
+    UNVENCODER_CHECK(data.size() == 4);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        UNVENCODER_CHECK(data[i].index == i / 2);
+        UNVENCODER_CHECK(data[i].isLastSlice == (i % 2 == 1));
+        UNVENCODER_CHECK(data[i].nalIndex.isComplete);
+    }
+    if (data.size() == 4)
+    {
+        UNVENCODER_CHECK(data[0].nalIndex.count == 3);
+        UNVENCODER_CHECK(data[1].nalIndex.count == 1);
+        UNVENCODER_CHECK(data[2].nalIndex.count == 1);
+        UNVENCODER_CHECK(data[0].isIdrFrame && !data[2].isIdrFrame);
+    }
+
+    data.clear();
+    nvenc.Finalize();
+    Nvenc::SetFunctionList(nullptr);
+}
+
+
+}
+
+
+int main()
+{
+    const auto device = CreateDevice();
+    UNVENCODER_CHECK(device);
+    if (!device) return Test::Finish("NvencPipelineTest");
+
+    try
+    {
+        TestFramesInFlight(device);
+        TestConcurrentDrain(device);
+        TestZeroCopy(device);
+        TestSubFrameOutput(device);
+    }
+    catch (const std::exception &e)
+    {
+        std::printf("exception: %s\n", e.what());
+        ++Test::GetFailureCount();
+    }
+
+    return Test::Finish("NvencPipelineTest");
+}
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "BufferPool.h"
+#include "SpscQueue.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+// Compares the packet handoff between the drain thread and the Unity thread:
+// the old scheme pushed into a vector under a mutex and swapped it out once
+// per frame, the current one goes through SpscQueue. Each encoder is one
+// producer/consumer pair, and several run at once as in a multi-encoder scene.
+
+namespace
+{
+
+
+struct Packet
+{
+    PooledBuffer buffer;
+    uint32_t size = 0;
+    uint64_t timeStamp = 0;
+};
+
+using PacketRef = std::shared_ptr<const Packet>;
+
+
+struct Result
+{
+    double seconds = 0.0;
+    double maxPushMicroseconds = 0.0;
+};
+
+
+PacketRef CreatePacket(BufferPool &pool, uint64_t index)
+{
+    auto packet = std::make_shared<Packet>();
+    packet->size = 1024;
+    packet->buffer = pool.Acquire(packet->size);
+    packet->timeStamp = index;
+    return packet;
+}
+
+
+class LockedSwapChannel final
+{
+public:
+    void Push(PacketRef &&packet)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        list_.push_back(std::move(packet));
+    }
+
+    size_t Drain()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(list_, listCopied_);
+        }
+        const auto count = listCopied_.size();
+        listCopied_.clear();
+        return count;
+    }
+
+private:
+    std::vector<PacketRef> list_;
+    std::vector<PacketRef> listCopied_;
+    std::mutex mutex_;
+};
+
+
+class SpscChannel final
+{
+public:
+    SpscChannel() : queue_(64) {}
+
+    void Push(PacketRef &&packet)
+    {
+        while (!queue_.Push(std::move(packet)))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    size_t Drain()
+    {
+        size_t count = 0;
+        PacketRef packet;
+        while (queue_.Pop(packet))
+        {
+            packet.reset();
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    SpscQueue<PacketRef> queue_;
+};
+
+
+template <class Channel>
+Result Run(int encoderCount, uint64_t packetCount)
+{
+    std::vector<std::thread> threads;
+    std::vector<double> maxPushTimes(encoderCount, 0.0);
+
+    const Test::Stopwatch stopwatch;
+
+    for (int i = 0; i < encoderCount; ++i)
+    {
+        threads.emplace_back([&, i]
+        {
+            Channel channel;
+            BufferPool pool(1024);
+            std::atomic<bool> isProducing { true };
+
+            std::thread producer([&]
+            {
+                double maxPushTime = 0.0;
+                for (uint64_t n = 0; n < packetCount; ++n)
+                {
+                    auto packet = CreatePacket(pool, n);
+                    const Test::Stopwatch pushStopwatch;
+                    channel.Push(std::move(packet));
+                    maxPushTime = (std::max)(maxPushTime, pushStopwatch.GetSeconds());
+                }
+                maxPushTimes[i] = maxPushTime;
+                isProducing = false;
+            });
+
+            uint64_t received = 0;
+            while (received < packetCount)
+            {
+                received += channel.Drain();
+                if (isProducing) std::this_thread::yield();
+            }
+
+            producer.join();
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    Result result;
+    result.seconds = stopwatch.GetSeconds();
+    result.maxPushMicroseconds = *std::max_element(maxPushTimes.begin(), maxPushTimes.end()) * 1e6;
+    return result;
+}
+
+
+void Print(const char *name, int encoderCount, uint64_t packetCount, const Result &result)
+{
+    const auto totalCount = static_cast<double>(packetCount) * encoderCount;
+    std::printf(
+        "%-12s encoders=%d  %8.1f ns/packet  %7.2f Mpackets/s  max push %8.1f us\n",
+        name,
+        encoderCount,
+        result.seconds * 1e9 / totalCount,
+        totalCount / result.seconds / 1e6,
+        result.maxPushMicroseconds);
+}
+
+
+}
+
+
+int main(int argc, char **argv)
+{
+    const uint64_t packetCount = Test::IsQuickRun(argc, argv) ? 20000 : 2000000;
+
+    for (const int encoderCount : { 1, 8 })
+    {
+        Print("locked swap", encoderCount, packetCount, Run<LockedSwapChannel>(encoderCount, packetCount));
+        Print("spsc", encoderCount, packetCount, Run<SpscChannel>(encoderCount, packetCount));
+    }
+
+    return 0;
+}
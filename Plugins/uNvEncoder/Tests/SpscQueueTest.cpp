@@ -0,0 +1,123 @@
+#include <memory>
+#include <thread>
+#include "SpscQueue.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+namespace
+{
+
+
+void TestCapacity()
+{
+    SpscQueue<int> queue(5);
+    UNVENCODER_CHECK(queue.GetCapacity() == 8);
+    UNVENCODER_CHECK(queue.IsEmpty());
+
+    for (int i = 0; i < 8; ++i)
+    {
+        UNVENCODER_CHECK(queue.Push(int(i)));
+    }
+    UNVENCODER_CHECK(!queue.Push(8));
+    UNVENCODER_CHECK(queue.GetSize() == 8);
+
+    int value = -1;
+    UNVENCODER_CHECK(queue.Pop(value) && value == 0);
+    UNVENCODER_CHECK(queue.Push(8));
+    UNVENCODER_CHECK(!queue.Push(9));
+}
+
+
+void TestWrapAround()
+{
+    SpscQueue<int> queue(4);
+    int next = 0;
+    int expected = 0;
+
+    for (int round = 0; round < 100; ++round)
+    {
+        while (queue.Push(int(next))) ++next;
+
+        int value = -1;
+        for (int i = 0; i < 3 && queue.Pop(value); ++i)
+        {
+            UNVENCODER_CHECK(value == expected);
+            ++expected;
+        }
+    }
+
+    int value = -1;
+    while (queue.Pop(value))
+    {
+        UNVENCODER_CHECK(value == expected);
+        ++expected;
+    }
+    UNVENCODER_CHECK(expected == next);
+    UNVENCODER_CHECK(queue.IsEmpty());
+}
+
+
+void TestMoveOnly()
+{
+    SpscQueue<std::unique_ptr<int>> queue(2);
+    UNVENCODER_CHECK(queue.Push(std::make_unique<int>(42)));
+
+    std::unique_ptr<int> value;
+    UNVENCODER_CHECK(queue.Pop(value));
+    UNVENCODER_CHECK(value && *value == 42);
+    UNVENCODER_CHECK(!queue.Pop(value));
+}
+
+
+// The consumer must see every value exactly once and in order while the
+// producer keeps running into a full queue.
+void TestTwoThreads()
+{
+    constexpr uint64_t count = 1000000;
+    SpscQueue<uint64_t> queue(64);
+
+    std::thread producer([&]
+    {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            while (!queue.Push(uint64_t(i)))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint64_t expected = 0;
+    bool isOrdered = true;
+    while (expected < count)
+    {
+        uint64_t value = 0;
+        if (!queue.Pop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        isOrdered = isOrdered && value == expected;
+        ++expected;
+    }
+
+    producer.join();
+
+    UNVENCODER_CHECK(isOrdered);
+    UNVENCODER_CHECK(queue.IsEmpty());
+}
+
+
+}
+
+
+int main()
+{
+    TestCapacity();
+    TestWrapAround();
+    TestMoveOnly();
+    TestTwoThreads();
+    return Test::Finish("SpscQueueTest");
+}
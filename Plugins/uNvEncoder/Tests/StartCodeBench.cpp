@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "AnnexB.h"
+#include "CannedStream.h"
+#include "TestUtility.h"
+
+using namespace uNvEncoder;
+
+
+// Compares FindStartCode(), which scans 16 or 32 bytes at a time with SSE2 or
+// AVX2, against the byte-by-byte loop it replaced. Every encoded frame is
+// scanned once to index its NAL units, so this is a per-byte cost on the
+// drain thread. Slice data rarely contains zeros; the zero-heavy input is the
+// worst case where most blocks have candidates to check.
+
+namespace
+{
+
+
+const uint8_t * FindStartCodeScalar(const uint8_t *begin, const uint8_t *end)
+{
+    for (const uint8_t *p = begin; p + 3 <= end; ++p)
+    {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) return p;
+    }
+    return end;
+}
+
+
+struct Result
+{
+    double seconds = 0.0;
+    size_t count = 0;
+};
+
+
+template <class Scanner>
+Result Run(const std::vector<uint8_t> &data, int repeatCount, Scanner scanner)
+{
+    Result result;
+    const auto end = data.data() + data.size();
+
+    const Test::Stopwatch stopwatch;
+    for (int i = 0; i < repeatCount; ++i)
+    {
+        for (auto p = scanner(data.data(), end); p < end; p = scanner(p + 3, end))
+        {
+            ++result.count;
+        }
+    }
+    result.seconds = stopwatch.GetSeconds();
+    return result;
+}
+
+
+void Print(const char *input, const char *name, size_t size, int repeatCount, const Result &result)
+{
+    const auto totalSize = static_cast<double>(size) * repeatCount;
+    std::printf(
+        "%-10s %-8s %8.2f GB/s  %8.1f us/MB\n",
+        input,
+        name,
+        totalSize / result.seconds / 1e9,
+        result.seconds * 1e6 / (totalSize / 1e6));
+}
+
+
+void Compare(const char *input, const std::vector<uint8_t> &data, int repeatCount)
+{
+    const auto simd = Run(data, repeatCount, FindStartCode);
+    const auto scalar = Run(data, repeatCount, FindStartCodeScalar);
+    UNVENCODER_CHECK(simd.count == scalar.count);
+
+    Print(input, "simd", data.size(), repeatCount, simd);
+    Print(input, "scalar", data.size(), repeatCount, scalar);
+}
+
+
+}
+
+
+int main(int argc, char **argv)
+{
+    const bool isQuickRun = Test::IsQuickRun(argc, argv);
+    const int frameCount = isQuickRun ? 30 : 600;
+    const int repeatCount = isQuickRun ? 1 : 10;
+
+    // 1080p60 at about 15 Mbps in 4 slices per frame.
+    const Test::CannedStream stream(1920, 1080, 60, frameCount, 120, 4, 8 * 1024);
+    std::vector<uint8_t> slices;
+    for (const auto &frame : stream.GetFrames())
+    {
+        slices.insert(slices.end(), frame.data.begin(), frame.data.end());
+    }
+    Compare("slices", slices, repeatCount);
+
+    std::mt19937 random(1);
+    std::vector<uint8_t> zeros(slices.size());
+    for (auto &byte : zeros)
+    {
+        const auto value = random() % 8;
+        byte = static_cast<uint8_t>(value < 4 ? 0 : value < 6 ? 1 : value);
+    }
+    Compare("zero-heavy", zeros, repeatCount);
+
+    return Test::Finish("StartCodeBench");
+}
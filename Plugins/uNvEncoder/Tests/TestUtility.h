@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+
+namespace uNvEncoder
+{
+namespace Test
+{
+
+
+inline int & GetFailureCount()
+{
+    static int count = 0;
+    return count;
+}
+
+
+inline int Finish(const char *name)
+{
+    const auto count = GetFailureCount();
+    if (count == 0)
+    {
+        std::printf("%s: OK\n", name);
+    }
+    else
+    {
+        std::printf("%s: %d failure(s)\n", name, count);
+    }
+    return count == 0 ? 0 : 1;
+}
+
+
+// Benchmarks run a reduced workload when started with --quick (as ctest does).
+inline bool IsQuickRun(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0) return true;
+    }
+    return false;
+}
+
+
+class Stopwatch final
+{
+public:
+    Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+
+    double GetSeconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    const std::chrono::steady_clock::time_point start_;
+};
+
+
+}
+}
+
+
+#define UNVENCODER_CHECK(expr) \
+    do \
+    { \
+        if (!(expr)) \
+        { \
+            std::printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); \
+            ++::uNvEncoder::Test::GetFailureCount(); \
+        } \
+    } while (0)
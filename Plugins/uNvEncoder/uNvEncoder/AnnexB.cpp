@@ -0,0 +1,457 @@
+#include <cstring>
+#include "AnnexB.h"
+#include "ByteWriter.h"
+#include "BitReader.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define UNVENCODER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define UNVENCODER_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    using FindStartCodeFunc = const uint8_t * (*)(const uint8_t *begin, const uint8_t *end);
+
+    const uint8_t * FindStartCodeScalar(const uint8_t *begin, const uint8_t *end)
+    {
+        for (auto p = begin; p + 2 < end; ++p)
+        {
+            if (p[0] == 0 && p[1] == 0 && p[2] == 1) return p;
+        }
+        return end;
+    }
+
+    uint32_t CountTrailingZeros(uint32_t mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index = 0;
+        _BitScanForward(&index, mask);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+    }
+
+#ifdef UNVENCODER_SSE2
+    // Compares 16 positions at once against 00, 00 and 01 using three
+    // overlapping loads, so each match found is an exact start code.
+    const uint8_t * FindStartCodeSse2(const uint8_t *begin, const uint8_t *end)
+    {
+        const auto zero = _mm_setzero_si128();
+        const auto one = _mm_set1_epi8(1);
+
+        auto p = begin;
+        for (; end - p >= 16 + 2; p += 16)
+        {
+            const auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            const auto b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+            const auto b2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 2));
+            const auto match = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)), 
+                _mm_cmpeq_epi8(b2, one));
+            const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(match));
+            if (mask) return p + CountTrailingZeros(mask);
+        }
+
+        return FindStartCodeScalar(p, end);
+    }
+#endif
+
+#ifdef UNVENCODER_AVX2
+    const uint8_t * FindStartCodeAvx2(const uint8_t *begin, const uint8_t *end)
+    {
+        const auto zero = _mm256_setzero_si256();
+        const auto one = _mm256_set1_epi8(1);
+
+        auto p = begin;
+        for (; end - p >= 32 + 2; p += 32)
+        {
+            const auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            const auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+            const auto b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 2));
+            const auto match = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)), 
+                _mm256_cmpeq_epi8(b2, one));
+            const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+            if (mask) return p + CountTrailingZeros(mask);
+        }
+
+        return FindStartCodeSse2(p, end);
+    }
+
+    bool IsAvx2Supported()
+    {
+        int info[4] = {};
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+
+        // The OS has to save the YMM registers as well (OSXSAVE + XCR0).
+        __cpuid(info, 1);
+        const bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+        const bool hasAvx = (info[2] & (1 << 28)) != 0;
+        if (!hasOsxsave || !hasAvx || (_xgetbv(0) & 0x6) != 0x6) return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+#endif
+
+    FindStartCodeFunc SelectFindStartCode()
+    {
+#if defined(UNVENCODER_AVX2)
+        if (IsAvx2Supported()) return FindStartCodeAvx2;
+#endif
+#if defined(UNVENCODER_SSE2)
+        return FindStartCodeSse2;
+#else
+        return FindStartCodeScalar;
+#endif
+    }
+
+    // Calls func(unit) for every non-empty NAL unit in data and stops when
+    // func returns false.
+    template <class Func>
+    void ForEachNalUnit(const uint8_t *data, size_t size, Func &&func)
+    {
+        const auto end = data + size;
+        auto startCode = FindStartCode(data, end);
+        while (startCode < end)
+        {
+            const auto nal = startCode + 3;
+            const auto next = FindStartCode(nal, end);
+
+            auto nalEnd = next;
+            if (next < end && next > nal && next[-1] == 0) --nalEnd;
+
+            NalUnit unit;
+            unit.offset = static_cast<uint32_t>(nal - data);
+            unit.size = static_cast<uint32_t>(nalEnd - nal);
+            unit.startCodeSize = (startCode > data && startCode[-1] == 0) ? 4 : 3;
+            if (unit.size > 0)
+            {
+                unit.type = nal[0] & 0x1F;
+                unit.refIdc = (nal[0] >> 5) & 0x03;
+                if (!func(unit)) return;
+            }
+
+            startCode = next;
+        }
+    }
+
+    bool IsRecoveryPointSei(const uint8_t *data, const NalUnit &unit)
+    {
+        if (unit.type != NalUnitTypeSei) return false;
+
+        // sei_message()s follow the 1-byte NAL header until the trailing bits,
+        // which end the loop with a read error.
+        BitReader reader(data + unit.offset + 1, unit.size - 1);
+        for (;;)
+        {
+            uint32_t payloadType = 0;
+            uint32_t byte;
+            do { byte = reader.U(8); payloadType += byte; } while (byte == 0xFF && !reader.HasError());
+
+            uint32_t payloadSize = 0;
+            do { byte = reader.U(8); payloadSize += byte; } while (byte == 0xFF && !reader.HasError());
+
+            if (reader.HasError()) return false;
+            if (payloadType == SeiPayloadTypeRecoveryPoint) return true;
+
+            for (uint32_t i = 0; i < payloadSize && !reader.HasError(); ++i) reader.U(8);
+        }
+    }
+}
+
+
+const uint8_t * FindStartCode(const uint8_t *begin, const uint8_t *end)
+{
+    static const auto func = SelectFindStartCode();
+    return func(begin, end);
+}
+
+
+void ParseNalUnits(const uint8_t *data, size_t size, std::vector<NalUnit> &units)
+{
+    units.clear();
+    AppendNalUnits(data, size, nullptr, 0, units);
+}
+
+
+void AppendNalUnits(
+    const uint8_t *data, 
+    size_t size, 
+    const NalIndex *index, 
+    uint32_t baseOffset, 
+    std::vector<NalUnit> &units)
+{
+    if (index && index->isComplete)
+    {
+        for (uint32_t i = 0; i < index->count; ++i)
+        {
+            units.push_back(index->units[i]);
+            units.back().offset += baseOffset;
+        }
+        return;
+    }
+
+    ForEachNalUnit(data, size, [&](NalUnit unit)
+    {
+        unit.offset += baseOffset;
+        units.push_back(unit);
+        return true;
+    });
+}
+
+
+void BuildNalIndex(const uint8_t *data, size_t size, NalIndex &index)
+{
+    index.count = 0;
+    index.isComplete = true;
+
+    ForEachNalUnit(data, size, [&](const NalUnit &unit)
+    {
+        if (index.count == NalIndex::MaxCount)
+        {
+            index.isComplete = false;
+            return false;
+        }
+        index.units[index.count++] = unit;
+        return true;
+    });
+}
+
+
+
+void BuildNalIndex(const std::vector<NalUnit> &units, NalIndex &index)
+{
+    index.isComplete = units.size() <= NalIndex::MaxCount;
+    index.count = static_cast<uint32_t>(index.isComplete ? units.size() : 0);
+    for (uint32_t i = 0; i < index.count; ++i)
+    {
+        index.units[i] = units[i];
+    }
+}
+
+
+bool HasRecoveryPointSei(const uint8_t *data, size_t size, const NalIndex &index)
+{
+    // SEI messages precede the first slice of the access unit.
+    if (index.isComplete)
+    {
+        for (uint32_t i = 0; i < index.count; ++i)
+        {
+            const auto &unit = index.units[i];
+            if (unit.type == NalUnitTypeSlice || unit.type == NalUnitTypeIdrSlice) break;
+            if (IsRecoveryPointSei(data, unit)) return true;
+        }
+        return false;
+    }
+
+    bool hasRecoveryPoint = false;
+    ForEachNalUnit(data, size, [&](const NalUnit &unit)
+    {
+        if (unit.type == NalUnitTypeSlice || unit.type == NalUnitTypeIdrSlice) return false;
+        hasRecoveryPoint = IsRecoveryPointSei(data, unit);
+        return !hasRecoveryPoint;
+    });
+    return hasRecoveryPoint;
+}
+
+
+void ParseLengthPrefixedNalUnits(const uint8_t *data, size_t size, std::vector<NalUnit> &units)
+{
+    units.clear();
+
+    size_t offset = 0;
+    while (offset + 4 <= size)
+    {
+        const auto length = 
+            (static_cast<uint32_t>(data[offset + 0]) << 24) | 
+            (static_cast<uint32_t>(data[offset + 1]) << 16) | 
+            (static_cast<uint32_t>(data[offset + 2]) << 8) | 
+            static_cast<uint32_t>(data[offset + 3]);
+        offset += 4;
+        if (length == 0 || length > size - offset) break;
+
+        NalUnit unit;
+        unit.offset = static_cast<uint32_t>(offset);
+        unit.size = length;
+        unit.startCodeSize = 4;
+        unit.type = data[offset] & 0x1F;
+        unit.refIdc = (data[offset] >> 5) & 0x03;
+        units.push_back(unit);
+
+        offset += length;
+    }
+}
+
+
+size_t GetLengthPrefixedSize(const std::vector<NalUnit> &units, bool stripParameterSets)
+{
+    size_t size = 0;
+    for (const auto &unit : units)
+    {
+        if (stripParameterSets && IsParameterSetOrDelimiter(unit.type)) continue;
+        size += 4 + unit.size;
+    }
+    return size;
+}
+
+
+bool CanConvertInPlace(const std::vector<NalUnit> &units, bool stripParameterSets)
+{
+    for (const auto &unit : units)
+    {
+        if (stripParameterSets && IsParameterSetOrDelimiter(unit.type)) continue;
+        if (unit.startCodeSize != 4) return false;
+    }
+    return true;
+}
+
+
+bool CanOverwriteStartCodes(const std::vector<NalUnit> &units)
+{
+    uint32_t offset = 0;
+    for (const auto &unit : units)
+    {
+        if (unit.startCodeSize != 4 || unit.offset != offset + 4) return false;
+        offset = unit.offset + unit.size;
+    }
+    return true;
+}
+
+
+size_t ConvertToLengthPrefixed(
+    const uint8_t *src, 
+    std::vector<NalUnit> &units, 
+    bool stripParameterSets, 
+    uint8_t *dst)
+{
+    size_t size = 0;
+    size_t count = 0;
+    for (const auto &unit : units)
+    {
+        if (stripParameterSets && IsParameterSetOrDelimiter(unit.type)) continue;
+
+        dst[size + 0] = static_cast<uint8_t>(unit.size >> 24);
+        dst[size + 1] = static_cast<uint8_t>(unit.size >> 16);
+        dst[size + 2] = static_cast<uint8_t>(unit.size >> 8);
+        dst[size + 3] = static_cast<uint8_t>(unit.size);
+        size += 4;
+
+        if (dst + size != src + unit.offset)
+        {
+            ::memmove(dst + size, src + unit.offset, unit.size);
+        }
+
+        auto &converted = units[count++];
+        converted = unit;
+        converted.offset = static_cast<uint32_t>(size);
+        converted.startCodeSize = 4;
+        size += unit.size;
+    }
+
+    units.resize(count);
+    return size;
+}
+
+
+
+size_t StripNalUnits(const uint8_t *src, std::vector<NalUnit> &units, uint32_t typeMask, uint8_t *dst)
+{
+    static constexpr uint8_t startCode[] = { 0x00, 0x00, 0x00, 0x01 };
+
+    size_t size = 0;
+    size_t count = 0;
+    for (const auto &unit : units)
+    {
+        if (typeMask & (1U << unit.type)) continue;
+
+        const auto startCodeSize = unit.startCodeSize;
+        ::memcpy(dst + size, startCode + 4 - startCodeSize, startCodeSize);
+        size += startCodeSize;
+
+        if (dst + size != src + unit.offset)
+        {
+            ::memmove(dst + size, src + unit.offset, unit.size);
+        }
+
+        auto &kept = units[count++];
+        kept = unit;
+        kept.offset = static_cast<uint32_t>(size);
+        size += unit.size;
+    }
+
+    units.resize(count);
+    return size;
+}
+
+void RestoreStartCodes(uint8_t *data, const std::vector<NalUnit> &units)
+{
+    for (const auto &unit : units)
+    {
+        const auto startCode = data + unit.offset - 4;
+        startCode[0] = 0x00;
+        startCode[1] = 0x00;
+        startCode[2] = 0x00;
+        startCode[3] = 0x01;
+    }
+}
+
+bool BuildAvcDecoderConfigurationRecord(
+    const uint8_t *data, 
+    const std::vector<NalUnit> &units, 
+    std::vector<uint8_t> &record)
+{
+    const NalUnit *sps = nullptr;
+    const NalUnit *pps = nullptr;
+    for (const auto &unit : units)
+    {
+        if (unit.type == NalUnitTypeSps && !sps) sps = &unit;
+        if (unit.type == NalUnitTypePps && !pps) pps = &unit;
+    }
+    if (!sps || !pps || sps->size < 4) return false;
+
+    const auto spsData = data + sps->offset;
+    const auto ppsData = data + pps->offset;
+    const auto profile = spsData[1];
+
+    record.clear();
+    ByteWriter writer(record);
+    writer.U8(1);
+    writer.U8(profile);
+    writer.U8(spsData[2]);
+    writer.U8(spsData[3]);
+    writer.U8(0xFF);
+    writer.U8(0xE1);
+    writer.U16(static_cast<uint16_t>(sps->size));
+    writer.Bytes(spsData, sps->size);
+    writer.U8(1);
+    writer.U16(static_cast<uint16_t>(pps->size));
+    writer.Bytes(ppsData, pps->size);
+
+    // NVENC always produces 8-bit 4:2:0 here.
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244)
+    {
+        writer.U8(0xFC | 1);
+        writer.U8(0xF8);
+        writer.U8(0xF8);
+        writer.U8(0);
+    }
+
+    return true;
+}
+
+
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace uNvEncoder
+{
+
+
+constexpr uint8_t NalUnitTypeSlice = 1;
+constexpr uint8_t NalUnitTypeIdrSlice = 5;
+constexpr uint8_t NalUnitTypeSei = 6;
+constexpr uint8_t NalUnitTypeSps = 7;
+constexpr uint8_t NalUnitTypePps = 8;
+constexpr uint8_t NalUnitTypeAud = 9;
+
+constexpr uint32_t SeiPayloadTypeRecoveryPoint = 6;
+
+
+// How NAL units are delimited in a packet. Length-prefixed is the AVCC form
+// used by MP4/Matroska, where every unit starts with its 4-byte big-endian
+// size; the second variant also drops SPS, PPS and AUD, which those
+// containers carry out of band.
+enum class BitstreamFormat : int
+{
+    AnnexB = 0,
+    LengthPrefixed = 1,
+    LengthPrefixedWithoutParameterSets = 2,
+};
+
+
+// One H.264 NAL unit in an Annex-B buffer. offset points at the NAL header
+// right after the start code, and size does not include the start code.
+struct NalUnit
+{
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    uint8_t startCodeSize = 0;
+    uint8_t type = 0;
+    uint8_t refIdc = 0;
+};
+
+
+// NAL units of one encoded packet, built once on the drain thread so that
+// sinks and the C# side do not each scan the bitstream again. Packets with
+// more than MaxCount units are marked incomplete and scanned by the reader.
+struct NalIndex
+{
+    static constexpr size_t MaxCount = 16;
+    NalUnit units[MaxCount];
+    uint32_t count = 0;
+    bool isComplete = false;
+};
+
+
+// Units that containers carry out of band or drop entirely.
+inline bool IsParameterSetOrDelimiter(uint8_t type)
+{
+    return type == NalUnitTypeSps || type == NalUnitTypePps || type == NalUnitTypeAud;
+}
+
+// Returns the first 00 00 01 in [begin, end), or end. Uses AVX2 or SSE2 when
+// the CPU has them.
+const uint8_t * FindStartCode(const uint8_t *begin, const uint8_t *end);
+
+// Replaces units with the NAL units found in data. A zero byte in front of
+// 00 00 01 is counted as part of a 4-byte start code.
+void ParseNalUnits(const uint8_t *data, size_t size, std::vector<NalUnit> &units);
+
+// Appends the NAL units of data to units with baseOffset added to their
+// offsets. index is used instead of scanning when it is complete.
+void AppendNalUnits(
+    const uint8_t *data, 
+    size_t size, 
+    const NalIndex *index, 
+    uint32_t baseOffset, 
+    std::vector<NalUnit> &units);
+
+void BuildNalIndex(const uint8_t *data, size_t size, NalIndex &index);
+void BuildNalIndex(const std::vector<NalUnit> &units, NalIndex &index);
+
+// True when an SEI before the first slice carries a recovery point message,
+// which NVENC writes at the start of each intra refresh wave.
+bool HasRecoveryPointSei(const uint8_t *data, size_t size, const NalIndex &index);
+
+// Replaces units with the NAL units of a length-prefixed buffer.
+void ParseLengthPrefixedNalUnits(const uint8_t *data, size_t size, std::vector<NalUnit> &units);
+
+size_t GetLengthPrefixedSize(const std::vector<NalUnit> &units, bool stripParameterSets);
+
+// True when every unit that is kept has a 4-byte start code. The output then
+// never overtakes the input, so ConvertToLengthPrefixed() can write over src.
+bool CanConvertInPlace(const std::vector<NalUnit> &units, bool stripParameterSets);
+
+// True when the units tile the buffer with 4-byte start codes from offset 0,
+// so that converting in place only overwrites the start codes and
+// RestoreStartCodes() can undo it.
+bool CanOverwriteStartCodes(const std::vector<NalUnit> &units);
+
+// Writes the units of src to dst as 4-byte lengths followed by the payload
+// and updates units to describe dst. Returns the size written.
+size_t ConvertToLengthPrefixed(
+    const uint8_t *src, 
+    std::vector<NalUnit> &units, 
+    bool stripParameterSets, 
+    uint8_t *dst);
+
+// Copies the units of src whose type bit is not set in typeMask to dst with
+// their start codes and updates units to describe dst. dst may be src.
+// Returns the size written.
+size_t StripNalUnits(const uint8_t *src, std::vector<NalUnit> &units, uint32_t typeMask, uint8_t *dst);
+
+// Puts 00 00 00 01 back in front of units converted by overwriting.
+void RestoreStartCodes(uint8_t *data, const std::vector<NalUnit> &units);
+
+// Replaces record with an AVCDecoderConfigurationRecord (avcC) built from the
+// first SPS and PPS in units. Returns false when either one is missing.
+bool BuildAvcDecoderConfigurationRecord(
+    const uint8_t *data, 
+    const std::vector<NalUnit> &units, 
+    std::vector<uint8_t> &record);
+
+
+}
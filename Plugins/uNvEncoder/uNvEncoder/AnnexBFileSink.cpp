@@ -0,0 +1,26 @@
+#include "AnnexBFileSink.h"
+
+
+namespace uNvEncoder
+{
+
+
+AnnexBFileSink::AnnexBFileSink(const std::string &path)
+    : writer_(path)
+{
+}
+
+
+void AnnexBFileSink::Write(const NvencEncodedData &data)
+{
+    if (!hasIdrFrame_)
+    {
+        if (!data.isIdrFrame) return;
+        hasIdrFrame_ = true;
+    }
+
+    writer_.Write(data.buffer.get(), data.size);
+}
+
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include "PacketSink.h"
+#include "FileWriter.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Writes the raw H.264 elementary stream to a file, starting at the first
+// IDR frame so that the file can be played from its beginning.
+class AnnexBFileSink final : public PacketSink
+{
+public:
+    explicit AnnexBFileSink(const std::string &path);
+    void Write(const NvencEncodedData &data) override;
+
+private:
+    FileWriter writer_;
+    bool hasIdrFrame_ = false;
+};
+
+
+}
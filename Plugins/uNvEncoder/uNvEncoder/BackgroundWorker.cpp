@@ -0,0 +1,61 @@
+#include "BackgroundWorker.h"
+
+
+namespace uNvEncoder
+{
+
+
+BackgroundWorker::BackgroundWorker()
+{
+    thread_ = std::thread([this] { Run(); });
+}
+
+
+BackgroundWorker::~BackgroundWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shouldStop_ = true;
+    }
+    cond_.notify_one();
+
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+
+void BackgroundWorker::Post(Task &&task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+}
+
+
+void BackgroundWorker::Run()
+{
+    for (;;)
+    {
+        Task task;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [&] { return !tasks_.empty() || shouldStop_; });
+
+            // Pending tasks still run on shutdown so that nothing posted is lost.
+            if (tasks_.empty()) break;
+
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+
+        task();
+    }
+}
+
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace uNvEncoder
+{
+
+
+// Runs posted tasks one by one, in order, on a single background thread.
+class BackgroundWorker final
+{
+public:
+    using Task = std::function<void()>;
+
+    BackgroundWorker();
+    ~BackgroundWorker();
+    BackgroundWorker(const BackgroundWorker &) = delete;
+    BackgroundWorker & operator=(const BackgroundWorker &) = delete;
+
+    void Post(Task &&task);
+
+private:
+    void Run();
+
+    std::thread thread_;
+    std::deque<Task> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool shouldStop_ = false;
+};
+
+
+}
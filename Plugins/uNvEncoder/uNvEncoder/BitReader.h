@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace uNvEncoder
+{
+
+
+// Reads an H.264 RBSP bit by bit straight from a NAL unit payload, dropping
+// emulation prevention bytes (00 00 03) on the way. Reads past the end
+// return zeros and set HasError().
+class BitReader final
+{
+public:
+    BitReader(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+    bool HasError() const { return hasError_; }
+
+    uint32_t U1()
+    {
+        if (bitOffset_ == 0 && !LoadByte()) return 0;
+
+        const auto bit = (byte_ >> (7 - bitOffset_)) & 1;
+        bitOffset_ = (bitOffset_ + 1) & 7;
+        return bit;
+    }
+
+    uint32_t U(int bitCount)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < bitCount; ++i) value = (value << 1) | U1();
+        return value;
+    }
+
+    // Exp-Golomb ue(v)
+    uint32_t Ue()
+    {
+        int leadingZeros = 0;
+        while (U1() == 0)
+        {
+            if (hasError_ || ++leadingZeros > 31) 
+            {
+                hasError_ = true;
+                return 0;
+            }
+        }
+        return ((1U << leadingZeros) - 1) + U(leadingZeros);
+    }
+
+    // Exp-Golomb se(v)
+    int32_t Se()
+    {
+        const auto value = Ue();
+        return (value & 1) ? static_cast<int32_t>((value + 1) / 2) : -static_cast<int32_t>(value / 2);
+    }
+
+private:
+    bool LoadByte()
+    {
+        if (offset_ < size_ && zeroCount_ >= 2 && data_[offset_] == 0x03)
+        {
+            ++offset_;
+            zeroCount_ = 0;
+        }
+
+        if (offset_ >= size_)
+        {
+            hasError_ = true;
+            byte_ = 0;
+            return false;
+        }
+
+        byte_ = data_[offset_++];
+        zeroCount_ = byte_ == 0 ? zeroCount_ + 1 : 0;
+        return true;
+    }
+
+    const uint8_t *data_;
+    const size_t size_;
+    size_t offset_ = 0;
+    int bitOffset_ = 0;
+    int zeroCount_ = 0;
+    uint8_t byte_ = 0;
+    bool hasError_ = false;
+};
+
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Nvenc.h"
+#include "BufferPool.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Rewrites every encoded packet on the thread that drains the encoder, once,
+// before sinks and the consumer see it. A filter either edits data.buffer in
+// place or swaps in a buffer from pool, keeps the payload in Annex-B form and
+// leaves data.nalIndex describing it. Locked NVENC bitstreams in zero-copy
+// mode must not be written, which isWritable tells.
+class BitstreamFilter
+{
+public:
+    virtual ~BitstreamFilter() = default;
+
+    // Returning false drops the packet.
+    virtual bool Filter(NvencEncodedData &data, bool isWritable, BufferPool &pool) = 0;
+};
+
+
+}
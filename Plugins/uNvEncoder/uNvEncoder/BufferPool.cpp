@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <new>
+#include "BufferPool.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    constexpr int sizeClassCount = 6;
+    constexpr size_t defaultMaxFreeBufferCount = 16;
+    constexpr size_t pageSize = 4096;
+}
+
+
+void PooledBufferDeleter::operator()(uint8_t *buffer) const
+{
+    if (!buffer) return;
+
+    if (owner)
+    {
+        owner->ReleaseBuffer(buffer, tag);
+    }
+    else
+    {
+        delete[] buffer;
+    }
+}
+
+
+BufferPool::BufferPool(size_t baseSize)
+    : sizeClasses_(sizeClassCount)
+    , maxFreeBufferCount_(defaultMaxFreeBufferCount)
+{
+    // Each class doubles the previous one so that the largest class can hold
+    // an IDR frame many times bigger than the average frame.
+    auto size = (std::max<size_t>(baseSize, 1) + pageSize - 1) / pageSize * pageSize;
+    for (auto &sizeClass : sizeClasses_)
+    {
+        sizeClass.size = size;
+        sizeClass.freeList.reserve(maxFreeBufferCount_);
+        size *= 2;
+    }
+}
+
+
+BufferPool::~BufferPool()
+{
+    for (auto &sizeClass : sizeClasses_)
+    {
+        for (auto buffer : sizeClass.freeList)
+        {
+            delete[] buffer;
+        }
+    }
+}
+
+
+PooledBuffer BufferPool::Acquire(size_t size)
+{
+    for (int i = 0; i < sizeClassCount; ++i)
+    {
+        auto &sizeClass = sizeClasses_[i];
+        if (size > sizeClass.size) continue;
+
+        uint8_t *buffer = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!sizeClass.freeList.empty())
+            {
+                buffer = sizeClass.freeList.back();
+                sizeClass.freeList.pop_back();
+            }
+        }
+
+        if (!buffer)
+        {
+            buffer = new uint8_t[sizeClass.size];
+        }
+
+        return PooledBuffer(buffer, PooledBufferDeleter { this, i });
+    }
+
+    // Larger than the largest class: fall back to a one-off allocation.
+    return PooledBuffer(new uint8_t[size], PooledBufferDeleter {});
+}
+
+
+void BufferPool::SetMaxFreeBufferCount(size_t count)
+{
+    std::vector<uint8_t *> excess;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        maxFreeBufferCount_ = count;
+        for (auto &sizeClass : sizeClasses_)
+        {
+            auto &freeList = sizeClass.freeList;
+            if (freeList.size() > count)
+            {
+                excess.insert(excess.end(), freeList.begin() + count, freeList.end());
+                freeList.resize(count);
+            }
+            // Returning a buffer never grows the list under the lock.
+            freeList.reserve(count);
+        }
+    }
+
+    for (auto buffer : excess)
+    {
+        delete[] buffer;
+    }
+}
+
+
+void BufferPool::ReleaseBuffer(uint8_t *buffer, int sizeClass)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &freeList = sizeClasses_[sizeClass].freeList;
+        if (freeList.size() < maxFreeBufferCount_)
+        {
+            freeList.push_back(buffer);
+            return;
+        }
+    }
+
+    delete[] buffer;
+}
+
+
+BlockPool::BlockPool(size_t maxFreeBlockCount)
+    : maxFreeBlockCount_(maxFreeBlockCount)
+{
+    freeList_.reserve(maxFreeBlockCount_);
+}
+
+
+BlockPool::~BlockPool()
+{
+    for (auto block : freeList_)
+    {
+        ::operator delete(block);
+    }
+}
+
+
+void * BlockPool::Allocate(size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (blockSize_ == 0) blockSize_ = size;
+        if (size == blockSize_ && !freeList_.empty())
+        {
+            const auto block = freeList_.back();
+            freeList_.pop_back();
+            return block;
+        }
+    }
+
+    return ::operator new(size);
+}
+
+
+void BlockPool::Free(void *block, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size == blockSize_ && freeList_.size() < maxFreeBlockCount_)
+        {
+            freeList_.push_back(block);
+            return;
+        }
+    }
+
+    ::operator delete(block);
+}
+
+
+void BlockPool::SetMaxFreeBlockCount(size_t count)
+{
+    std::vector<void *> excess;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        maxFreeBlockCount_ = count;
+        if (freeList_.size() > count)
+        {
+            excess.assign(freeList_.begin() + count, freeList_.end());
+            freeList_.resize(count);
+        }
+        freeList_.reserve(count);
+    }
+
+    for (auto block : excess)
+    {
+        ::operator delete(block);
+    }
+}
+
+
+}
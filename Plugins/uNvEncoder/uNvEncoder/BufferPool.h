@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace uNvEncoder
+{
+
+
+// Anything that lends out memory behind a PooledBuffer and wants it back.
+class BufferOwner
+{
+public:
+    virtual ~BufferOwner() = default;
+    virtual void ReleaseBuffer(uint8_t *buffer, int tag) = 0;
+};
+
+
+struct PooledBufferDeleter
+{
+    BufferOwner *owner = nullptr;
+    int tag = -1;
+    void operator()(uint8_t *buffer) const;
+};
+
+using PooledBuffer = std::unique_ptr<uint8_t[], PooledBufferDeleter>;
+
+
+// Size-classed free lists of bitstream buffers. Buffers are acquired on the
+// encode thread and returned from whichever thread drops the last PooledBuffer,
+// so once the pool is warmed up no heap allocation happens per frame.
+// A free list has to hold as many buffers as the owner keeps alive at once
+// (see SetMaxFreeBufferCount()), or buffers spill to the heap and come back
+// as fresh allocations.
+class BufferPool final : public BufferOwner
+{
+public:
+    explicit BufferPool(size_t baseSize);
+    ~BufferPool();
+    BufferPool(const BufferPool &) = delete;
+    BufferPool & operator=(const BufferPool &) = delete;
+
+    PooledBuffer Acquire(size_t size);
+    size_t GetBaseSize() const { return sizeClasses_.front().size; }
+
+    // Per size class. Lowering it frees the buffers above the new count.
+    void SetMaxFreeBufferCount(size_t count);
+
+private:
+    void ReleaseBuffer(uint8_t *buffer, int sizeClass) override;
+
+    struct SizeClass
+    {
+        size_t size = 0;
+        std::vector<uint8_t *> freeList;
+    };
+    std::vector<SizeClass> sizeClasses_;
+    size_t maxFreeBufferCount_;
+    std::mutex mutex_;
+};
+
+
+// Free list of fixed-size blocks for the small objects made per packet, i.e.
+// the shared state behind an EncodedPacketRef. The block size is taken from
+// the first allocation and other sizes go to the heap. Blocks are freed from
+// whichever thread drops the last reference.
+class BlockPool final
+{
+public:
+    explicit BlockPool(size_t maxFreeBlockCount);
+    ~BlockPool();
+    BlockPool(const BlockPool &) = delete;
+    BlockPool & operator=(const BlockPool &) = delete;
+
+    void * Allocate(size_t size);
+    void Free(void *block, size_t size);
+    void SetMaxFreeBlockCount(size_t count);
+
+private:
+    size_t blockSize_ = 0;
+    size_t maxFreeBlockCount_;
+    std::vector<void *> freeList_;
+    std::mutex mutex_;
+};
+
+
+// Allocator for std::allocate_shared() that draws from a BlockPool. Every
+// control block holds a copy, so the pool lives as long as its last packet.
+template <class T>
+class PooledAllocator
+{
+public:
+    using value_type = T;
+
+    explicit PooledAllocator(const std::shared_ptr<BlockPool> &pool) : pool_(pool) {}
+
+    template <class U>
+    PooledAllocator(const PooledAllocator<U> &other) : pool_(other.GetPool()) {}
+
+    T * allocate(size_t n) { return static_cast<T *>(pool_->Allocate(n * sizeof(T))); }
+    void deallocate(T *p, size_t n) { pool_->Free(p, n * sizeof(T)); }
+    const std::shared_ptr<BlockPool> & GetPool() const { return pool_; }
+
+private:
+    std::shared_ptr<BlockPool> pool_;
+};
+
+
+template <class T, class U>
+bool operator==(const PooledAllocator<T> &a, const PooledAllocator<U> &b)
+{
+    return a.GetPool() == b.GetPool();
+}
+
+
+template <class T, class U>
+bool operator!=(const PooledAllocator<T> &a, const PooledAllocator<U> &b)
+{
+    return !(a == b);
+}
+
+
+}
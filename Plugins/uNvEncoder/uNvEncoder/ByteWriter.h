@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace uNvEncoder
+{
+
+
+// Appends big-endian values to a byte vector whose capacity is kept between
+// uses, so that container headers can be built without allocating.
+class ByteWriter final
+{
+public:
+    explicit ByteWriter(std::vector<uint8_t> &buffer) : buffer_(buffer) {}
+
+    size_t GetSize() const { return buffer_.size(); }
+
+    void U8(uint8_t value) { buffer_.push_back(value); }
+    void U16(uint16_t value) { U8(static_cast<uint8_t>(value >> 8)); U8(static_cast<uint8_t>(value)); }
+    void U24(uint32_t value) { U8(static_cast<uint8_t>(value >> 16)); U16(static_cast<uint16_t>(value)); }
+    void U32(uint32_t value) { U16(static_cast<uint16_t>(value >> 16)); U16(static_cast<uint16_t>(value)); }
+    void U64(uint64_t value) { U32(static_cast<uint32_t>(value >> 32)); U32(static_cast<uint32_t>(value)); }
+    void FourCC(const char *code) { Bytes(code, 4); }
+    void Zeros(size_t size) { buffer_.resize(buffer_.size() + size, 0); }
+
+    void Bytes(const void *data, size_t size)
+    {
+        const auto bytes = static_cast<const uint8_t *>(data);
+        buffer_.insert(buffer_.end(), bytes, bytes + size);
+    }
+
+    void PatchU32(size_t offset, uint32_t value)
+    {
+        buffer_[offset + 0] = static_cast<uint8_t>(value >> 24);
+        buffer_[offset + 1] = static_cast<uint8_t>(value >> 16);
+        buffer_[offset + 2] = static_cast<uint8_t>(value >> 8);
+        buffer_[offset + 3] = static_cast<uint8_t>(value);
+    }
+
+private:
+    std::vector<uint8_t> &buffer_;
+};
+
+
+}
@@ -30,6 +30,14 @@ void ThrowError(const std::string &error)
 }
 
 
+uint64_t GetClockMicroseconds()
+{
+    using namespace std::chrono;
+    const auto now = steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(duration_cast<microseconds>(now).count());
+}
+
+
 ScopedTimer::ScopedTimer(const StartFunc &startFunc, const EndFunc &endFunc)
     : func_(endFunc)
     , start_(std::chrono::high_resolution_clock::now())
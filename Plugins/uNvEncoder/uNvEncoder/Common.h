@@ -19,6 +19,7 @@ using ComPtr = Microsoft::WRL::ComPtr<T>;
 struct IUnityInterfaces * GetUnity();
 struct ID3D11Device * GetUnityDevice();
 void ThrowError(const std::string &error);
+uint64_t GetClockMicroseconds();
 
 
 #define UNVENC_DEBUG_ON
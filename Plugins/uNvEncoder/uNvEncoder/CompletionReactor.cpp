@@ -0,0 +1,208 @@
+#include <algorithm>
+#include "CompletionReactor.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    // One of the events passed to Event::WaitAny() is the wake event.
+    constexpr size_t maxEncoderCountPerReactor = Event::MaxWaitCount - 1;
+}
+
+
+decltype(CompletionReactor::s_reactors) CompletionReactor::s_reactors;
+decltype(CompletionReactor::s_reactorCount) CompletionReactor::s_reactorCount = 0;
+decltype(CompletionReactor::s_mutex) CompletionReactor::s_mutex;
+
+
+void CompletionReactor::SetReactorCount(int count)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+
+    s_reactorCount = (std::max)(count, 0);
+    if (static_cast<int>(s_reactors.size()) > s_reactorCount)
+    {
+        // Encoders that are already registered keep their reactor alive.
+        s_reactors.resize(s_reactorCount);
+    }
+}
+
+
+std::shared_ptr<CompletionReactor> CompletionReactor::Acquire()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+
+    if (s_reactorCount == 0) return nullptr;
+
+    if (static_cast<int>(s_reactors.size()) < s_reactorCount)
+    {
+        s_reactors.push_back(std::make_shared<CompletionReactor>());
+        return s_reactors.back();
+    }
+
+    const auto it = std::min_element(s_reactors.begin(), s_reactors.end(), 
+        [](const std::shared_ptr<CompletionReactor> &a, const std::shared_ptr<CompletionReactor> &b)
+        {
+            return a->GetEncoderCount() < b->GetEncoderCount();
+        });
+    return *it;
+}
+
+
+CompletionReactor::CompletionReactor()
+{
+    thread_ = std::thread([this] { Run(); });
+}
+
+
+CompletionReactor::~CompletionReactor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shouldStop_ = true;
+    }
+    Wake();
+
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+
+bool CompletionReactor::Register(CompletionSource *encoder)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (encoders_.size() >= maxEncoderCountPerReactor) return false;
+        encoders_.push_back(encoder);
+    }
+
+    Wake();
+    return true;
+}
+
+
+void CompletionReactor::Unregister(CompletionSource *encoder)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    const auto it = std::find(encoders_.begin(), encoders_.end(), encoder);
+    if (it == encoders_.end()) return;
+    encoders_.erase(it);
+
+    // The reactor may still be waiting on the completion event of the encoder
+    // or draining it, so wait for it to go around once before the caller
+    // destroys the encoder.
+    const auto cycle = cycle_;
+    Wake();
+    cycleCond_.wait(lock, [&] { return cycle_ != cycle || shouldStop_; });
+}
+
+
+void CompletionReactor::Wake()
+{
+    wakeEvent_.Signal();
+}
+
+
+size_t CompletionReactor::GetEncoderCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return encoders_.size();
+}
+
+
+void CompletionReactor::Run()
+{
+    std::vector<Event *> events;
+    std::vector<CompletionSource *> owners;
+    std::vector<CompletionSource *> wokenEncoders;
+    events.reserve(Event::MaxWaitCount);
+    owners.reserve(Event::MaxWaitCount);
+    wokenEncoders.reserve(Event::MaxWaitCount);
+    size_t start = 0;
+
+    for (;;)
+    {
+        events.clear();
+        owners.clear();
+        events.push_back(&wakeEvent_);
+        owners.push_back(nullptr);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (shouldStop_) break;
+
+            // Event::WaitAny() reports the lowest signaled index first, so
+            // rotate the order every cycle to keep encoders on an equal footing.
+            const auto n = encoders_.size();
+            for (size_t i = 0; i < n; ++i)
+            {
+                const auto encoder = encoders_[(start + i) % n];
+                if (const auto event = encoder->GetPendingCompletionEvent())
+                {
+                    events.push_back(event);
+                    owners.push_back(encoder);
+                }
+            }
+            start = n > 0 ? (start + 1) % n : 0;
+        }
+
+        size_t index = 0;
+        const auto result = Event::WaitAny(events.data(), events.size(), Event::Infinite, index);
+        if (result == Event::WaitResult::Failed)
+        {
+#ifdef _WIN32
+            ::OutputDebugStringA("Failed to wait for encode completion in reactor.\n");
+#endif
+        }
+
+        // The encoder is drained outside the lock so that Register(), Acquire()
+        // and unregistering other encoders are not held up by it. cycle_ only advances
+        // once the drain has returned, which keeps Unregister() waiting until
+        // the reactor no longer touches the encoder.
+        CompletionSource *encoder = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (result == Event::WaitResult::Signaled && index > 0 && index < owners.size() &&
+                std::find(encoders_.begin(), encoders_.end(), owners[index]) != encoders_.end())
+            {
+                encoder = owners[index];
+            }
+            else if (result == Event::WaitResult::Signaled && index == 0)
+            {
+                wokenEncoders = encoders_;
+            }
+        }
+
+        if (encoder)
+        {
+            encoder->OnEncodeCompleted();
+        }
+        for (const auto woken : wokenEncoders)
+        {
+            woken->OnWake();
+        }
+        wokenEncoders.clear();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++cycle_;
+        cycleCond_.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++cycle_;
+    cycleCond_.notify_all();
+}
+
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "Event.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Anything with encodes in flight that a reactor drains, i.e. an Encoder.
+class CompletionSource
+{
+public:
+    virtual ~CompletionSource() = default;
+
+    // Event of the oldest encode in flight, or nullptr when there is none.
+    virtual Event * GetPendingCompletionEvent() const = 0;
+
+    // Called on the reactor thread after that event has been consumed.
+    virtual void OnEncodeCompleted() = 0;
+
+    // Called on the reactor thread whenever Wake() is called, for work that
+    // has no event to wait on, e.g. packets held back by a full queue.
+    virtual void OnWake() {}
+};
+
+
+// Waits on the completion events of many encoders from a single thread and
+// drains whichever encoder has finished, instead of one thread per encoder.
+class CompletionReactor final
+{
+public:
+    CompletionReactor();
+    ~CompletionReactor();
+    bool Register(CompletionSource *encoder);
+    void Unregister(CompletionSource *encoder);
+    void Wake();
+    size_t GetEncoderCount() const;
+
+    static void SetReactorCount(int count);
+    static std::shared_ptr<CompletionReactor> Acquire();
+
+private:
+    void Run();
+
+    std::thread thread_;
+    Event wakeEvent_;
+    std::vector<CompletionSource *> encoders_;
+    mutable std::mutex mutex_;
+    std::condition_variable cycleCond_;
+    uint64_t cycle_ = 0;
+    bool shouldStop_ = false;
+
+    static std::vector<std::shared_ptr<CompletionReactor>> s_reactors;
+    static int s_reactorCount;
+    static std::mutex s_mutex;
+};
+
+
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "Encoder.h"
 
 
@@ -5,19 +6,86 @@ namespace uNvEncoder
 {
 
 
+namespace
+{
+    constexpr size_t encodedDataQueueCapacity = 64;
+    // Packets the drain thread holds back while the consumer queue is full.
+    constexpr size_t maxPendingEncodedDataCount = 64;
+    constexpr uint64_t minIdrRequestInterval = 1000000; // [us]
+
+
+    // Packets alive at once: a GOP in the cache, a full consumer queue and
+    // the packets held back behind it. The pools keep that many free so that
+    // packets cycling through the cache never go back to the heap.
+    size_t GetMaxPacketCount(const EncoderDesc &desc)
+    {
+        const auto frameCount = GetIntraRefreshPeriod(static_cast<uint32_t>((std::max)(desc.frameRate, 0)));
+        const auto sliceCount = desc.sliceCount > 0 ? static_cast<uint32_t>(desc.sliceCount) : NvencDesc().sliceCount;
+        const auto packetCount = frameCount * (desc.subFrameOutput ? sliceCount : 1);
+        return packetCount + encodedDataQueueCapacity + maxPendingEncodedDataCount;
+    }
+
+
+    void FillEncodedPacket(const NvencEncodedData &ed, int encoderId, EncodedPacket &packet)
+    {
+        packet.data = ed.buffer.get();
+        packet.size = static_cast<int>(ed.size);
+        packet.flags = 
+            (ed.isIdrFrame ? EncodedPacketFlagIdrFrame : 0) |
+            (ed.isLastSlice ? EncodedPacketFlagLastSlice : 0) |
+            (ed.isLtrFrame ? EncodedPacketFlagLtrFrame : 0) |
+            (ed.isRecoveryPoint ? EncodedPacketFlagRecoveryPoint : 0);
+        packet.timeStamp = ed.timeStamp;
+        packet.userData = ed.userData;
+        packet.encoderId = encoderId;
+        packet.pictureType = static_cast<int>(ed.pictureType);
+    }
+}
+
+
 Encoder::Encoder(const EncoderDesc &desc)
     : desc_(desc)
+    , outputBackpressure_ { desc.outputBackpressure }
+    , backpressureTimeout_ { desc.backpressureTimeout }
+    , bufferPool_(std::make_shared<BufferPool>(desc.bitRate / 8 / (std::max)(desc.frameRate, 1)))
+    , packetPool_(std::make_shared<BlockPool>(GetMaxPacketCount(desc)))
+    , encodedDataQueue_(encodedDataQueueCapacity)
+    , gopCache_(GetIntraRefreshPeriod(static_cast<uint32_t>((std::max)(desc.frameRate, 0))))
 {
+    desc_.maxWidth = (std::max)(desc_.maxWidth, desc_.width);
+    desc_.maxHeight = (std::max)(desc_.maxHeight, desc_.height);
+    // Sub-frame output copies every slice out of the bitstream (see Nvenc).
+    desc_.zeroCopy = IsZeroCopy(desc_);
+    bufferPool_->SetMaxFreeBufferCount(GetMaxPacketCount(desc_));
+
+    encodedDataListTemp_.reserve(encodedDataQueue_.GetCapacity());
+    pendingEncodedDataList_.reserve(maxPendingEncodedDataCount);
+    encodedDataListCopied_.reserve(encodedDataQueue_.GetCapacity());
+}
+
+
+void Encoder::Initialize(int warmUpFrameCount)
+{
+    if (state_ != EncoderState::Initializing) return;
+
     try
     {
         CreateDevice();
         CreateNvenc();
+        if (warmUpFrameCount > 0)
+        {
+            nvenc_->WarmUp(warmUpFrameCount);
+        }
         StartThread();
     }
     catch (const std::exception& e)
     {
         error_ = e.what();
     }
+
+    auto state = EncoderState::Initializing;
+    const auto result = error_.empty() ? EncoderState::Ready : EncoderState::Failed;
+    state_.compare_exchange_strong(state, result);
 }
 
 
@@ -36,32 +104,181 @@ Encoder::~Encoder()
 }
 
 
+bool Encoder::Recycle()
+{
+    // Brings a used encoder back to the state right after Initialize() so that
+    // it can be handed to another user without reopening the NVENC session.
+    if (!device_ || !nvenc_ || !nvenc_->IsValid()) return false;
+
+    try
+    {
+        constexpr DWORD duration = 10000;
+        nvenc_->WaitForPendingEncodes(duration);
+        StopThread();
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        return false;
+    }
+
+    ReleasePackets();
+
+    // Sinks may finalize files when destroyed, so do it outside the locks.
+    std::vector<SinkEntry> sinks;
+    {
+        std::lock_guard<std::mutex> lock(sinkMutex_);
+        std::swap(sinks, sinks_);
+    }
+    sinks.clear();
+
+    std::vector<FilterEntry> filters;
+    {
+        std::lock_guard<std::mutex> lock(filterMutex_);
+        std::swap(filters, filters_);
+    }
+    filters.clear();
+
+    shouldStopEncodeThread_ = false;
+    isEncodeRequested = false;
+    droppedFrameCount_ = 0;
+    droppedEncodedDataCount_ = 0;
+    lastIdrRequestTime_ = 0;
+    error_.clear();
+
+    // The next user starts a new stream that cannot reference earlier frames.
+    isIdrFrameRequested_ = true;
+
+    StartThread();
+    state_ = EncoderState::Ready;
+
+    return true;
+}
+
+
 bool Encoder::IsValid() const
 {
+    // Checking the state first keeps this cheap and race-free while an
+    // asynchronous Initialize() is still filling in the members below.
+    if (state_ != EncoderState::Ready) return false;
+
     return device_ && nvenc_ && nvenc_->IsValid();
 }
 
 
-NvencDesc Encoder::CreateNvencDesc() const
+NvencDesc Encoder::CreateNvencDesc(const EncoderDesc &encDesc) const
 {
     NvencDesc desc = { 0 };
     desc.d3d11Device = device_;
-    desc.width = desc_.width;
-    desc.height = desc_.height;
-    desc.format = desc_.format;
-    desc.frameRate = desc_.frameRate;
-    desc.bitRate = desc_.bitRate;
-    desc.maxFrameSize = desc_.maxFrameSize;
+    desc.width = encDesc.width;
+    desc.height = encDesc.height;
+    desc.maxWidth = encDesc.maxWidth;
+    desc.maxHeight = encDesc.maxHeight;
+    desc.format = encDesc.format;
+    desc.frameRate = encDesc.frameRate;
+    desc.bitRate = encDesc.bitRate;
+    desc.maxFrameSize = encDesc.maxFrameSize;
+    desc.zeroCopy = encDesc.zeroCopy;
+    desc.subFrameOutput = encDesc.subFrameOutput;
+    if (encDesc.sliceCount > 0)
+    {
+        desc.sliceCount = encDesc.sliceCount;
+    }
+    desc.bufferPool = bufferPool_;
+    if (encDesc.pipelineDepth > 0)
+    {
+        desc.pipelineDepth = encDesc.pipelineDepth;
+    }
     return desc;
 }
 
 
-void Encoder::Reconfigure(const EncoderDesc &encDesc)
+bool Encoder::IsZeroCopy(const EncoderDesc &desc)
 {
-    if (!IsValid()) return;
+    return desc.zeroCopy && !desc.subFrameOutput;
+}
 
-    desc_ = encDesc;
-    nvenc_->Reconfigure(CreateNvencDesc());
+
+bool Encoder::CanReconfigure(const EncoderDesc &encDesc) const
+{
+    // These are fixed when the session and its resources are created.
+    // EncoderPool keys its encoders by the same fields.
+    return
+        encDesc.format == desc_.format &&
+        encDesc.pipelineDepth == desc_.pipelineDepth &&
+        IsZeroCopy(encDesc) == desc_.zeroCopy &&
+        encDesc.subFrameOutput == desc_.subFrameOutput &&
+        encDesc.outputFormat == desc_.outputFormat &&
+        (!encDesc.subFrameOutput || encDesc.sliceCount == desc_.sliceCount) &&
+        (std::max)(encDesc.maxWidth, encDesc.width) <= desc_.maxWidth &&
+        (std::max)(encDesc.maxHeight, encDesc.height) <= desc_.maxHeight;
+}
+
+
+bool Encoder::Reconfigure(const EncoderDesc &encDesc)
+{
+    if (!IsValid() || !CanReconfigure(encDesc)) return false;
+
+    auto desc = desc_;
+    desc.width = encDesc.width;
+    desc.height = encDesc.height;
+    desc.frameRate = encDesc.frameRate;
+    desc.bitRate = encDesc.bitRate;
+    desc.maxFrameSize = encDesc.maxFrameSize;
+
+    try
+    {
+        nvenc_->Reconfigure(CreateNvencDesc(desc));
+    }
+    catch (const std::exception& e)
+    {
+        // The session keeps its old settings, and so does desc_.
+        error_ = e.what();
+        return false;
+    }
+
+    // Only what can change on a live session is copied; the drain thread
+    // keeps reading the fixed members of desc_ meanwhile.
+    desc_.width = encDesc.width;
+    desc_.height = encDesc.height;
+    desc_.frameRate = encDesc.frameRate;
+    desc_.bitRate = encDesc.bitRate;
+    desc_.maxFrameSize = encDesc.maxFrameSize;
+    desc_.inputBackpressure = encDesc.inputBackpressure;
+    desc_.outputBackpressure = encDesc.outputBackpressure;
+    desc_.backpressureTimeout = encDesc.backpressureTimeout;
+    outputBackpressure_ = encDesc.outputBackpressure;
+    backpressureTimeout_ = encDesc.backpressureTimeout;
+
+    try
+    {
+        UpdateSequenceParams();
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        return false;
+    }
+
+    // The refresh period follows the frame rate, and the cache has to keep
+    // up with it to hold a whole GOP, and so do the pools behind it.
+    {
+        std::lock_guard<std::mutex> lock(subscriberMutex_);
+        gopCache_.SetMaxFrameCount(GetIntraRefreshPeriod(static_cast<uint32_t>((std::max)(desc_.frameRate, 0))));
+    }
+    bufferPool_->SetMaxFreeBufferCount(GetMaxPacketCount(desc_));
+    packetPool_->SetMaxFreeBlockCount(GetMaxPacketCount(desc_));
+
+    return true;
+}
+
+
+bool Encoder::SetResolution(int width, int height)
+{
+    auto desc = desc_;
+    desc.width = width;
+    desc.height = height;
+    return Reconfigure(desc);
 }
 
 
@@ -117,20 +334,70 @@ void Encoder::DestroyDevice()
 
 void Encoder::CreateNvenc()
 {
-    nvenc_ = std::make_unique<Nvenc>(CreateNvencDesc());
+    nvenc_ = std::make_unique<Nvenc>(CreateNvencDesc(desc_));
     nvenc_->Initialize();
+    UpdateSequenceParams();
 }
 
 
 void Encoder::DestroyNvenc()
 {
+    if (!nvenc_) return;
+
+    ReleasePackets();
     nvenc_->Finalize();
     nvenc_.reset();
 }
 
 
+// Drops every packet reference the encoder holds. In zero-copy mode their
+// payloads are locked NVENC bitstreams that unlock themselves through Nvenc
+// when released, so this must happen before the session goes away. Must be
+// called with the drain thread stopped.
+void Encoder::ReleasePackets()
+{
+    ReleaseEncodedDataList();
+    for (EncodedPacketRef packet; encodedDataQueue_.Pop(packet);) {}
+    pendingEncodedDataList_.clear();
+    encodedDataListTemp_.clear();
+
+    std::vector<SubscriberEntry> subscribers;
+    {
+        std::lock_guard<std::mutex> lock(subscriberMutex_);
+        std::swap(subscribers, subscribers_);
+        gopCache_.Clear();
+    }
+    subscribers.clear();
+}
+
+
+// Caches the SPS/PPS of the current configuration so that sinks can write
+// their headers before the first IDR frame comes out.
+void Encoder::UpdateSequenceParams()
+{
+    std::vector<uint8_t> params;
+    nvenc_->GetSequenceParams(params);
+
+    ParameterSetInfo info;
+    const bool isParsed = ParseParameterSets(params.data(), params.size(), info);
+
+    std::lock_guard<std::mutex> lock(sequenceParamsMutex_);
+    sequenceParams_ = std::move(params);
+    parameterSetInfo_ = info;
+    hasParameterSetInfo_ = isParsed;
+}
+
+
 void Encoder::StartThread()
 {
+    // Sub-frame output polls the bitstream continuously and needs its own thread.
+    if (!desc_.subFrameOutput)
+    {
+        reactor_ = CompletionReactor::Acquire();
+        if (reactor_ && reactor_->Register(this)) return;
+        reactor_.reset();
+    }
+
     encodeThread_ = std::thread([&]
     {
         while (!shouldStopEncodeThread_)
@@ -144,35 +411,82 @@ void Encoder::StartThread()
 
 void Encoder::StopThread()
 {
+    if (reactor_)
+    {
+        reactor_->Unregister(this);
+        reactor_.reset();
+        FlushPendingEncodedData();
+        return;
+    }
+
     shouldStopEncodeThread_ = true;
     encodeCond_.notify_one();
+    encodedDataPoppedEvent_.Signal();
 
     if (encodeThread_.joinable())
     {
         encodeThread_.join();
     }
+
+    // Whatever still fits goes to the consumer instead of waiting for a next
+    // packet that will not come.
+    FlushPendingEncodedData();
 }
 
 
-bool Encoder::Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame)
+bool Encoder::Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame, uint64_t timeStamp, uint64_t userData)
 {
+    if (state_ != EncoderState::Ready) return false;
+
+    if (!nvenc_->CanEncode() && !ApplyInputBackpressure())
+    {
+        ++droppedFrameCount_;
+        return false;
+    }
+
+    const bool isIdrFrameRequested = isIdrFrameRequested_.exchange(false);
+    if (isIdrFrameRequested)
+    {
+        forceIdrFrame = true;
+    }
+
     try
     {
-        nvenc_->Encode(source, forceIdrFrame);
+        nvenc_->Encode(source, forceIdrFrame, timeStamp, userData);
     }
     catch (const std::exception& e)
     {
+        // The request stays pending for the next frame. Setting it back
+        // rather than clearing it after success keeps a request made by
+        // another thread during Encode() from being swallowed.
+        if (isIdrFrameRequested)
+        {
+            isIdrFrameRequested_ = true;
+        }
         error_ = e.what();
         return false;
     }
 
-    RequestGetEncodedData();
+    // Always wake the reactor. Whether the encoder looked busy before the
+    // submit says nothing about the wait set the reactor is sleeping on: it
+    // may have drained the last frame and rebuilt it without this one.
+    if (reactor_)
+    {
+        reactor_->Wake();
+    }
+    else
+    {
+        RequestGetEncodedData();
+    }
+
     return true;
 }
 
 
-bool Encoder::Encode(HANDLE sharedHandle, bool forceIdrFrame)
+bool Encoder::Encode(HANDLE sharedHandle, bool forceIdrFrame, uint64_t timeStamp, uint64_t userData)
 {
+    if (state_ != EncoderState::Ready) return false;
+
     ComPtr<ID3D11Texture2D> source;
     if (FAILED(GetUnityDevice()->OpenSharedResource(
         sharedHandle,
@@ -182,7 +496,30 @@ bool Encoder::Encode(HANDLE sharedHandle, bool forceIdrFrame)
         return false;
     }
 
-    return Encode(source, forceIdrFrame);
+    return Encode(source, forceIdrFrame, timeStamp, userData);
+}
+
+
+bool Encoder::ApplyInputBackpressure()
+{
+    // Frames that have already been submitted cannot be recalled from the GPU,
+    // so DropOldest and Coalesce drop the incoming frame just like DropNewest.
+    switch (desc_.inputBackpressure)
+    {
+        case BackpressurePolicy::Error:
+            return true;
+        case BackpressurePolicy::Block:
+            return WaitForEncodeSlot();
+        default:
+            return false;
+    }
+}
+
+
+bool Encoder::WaitForEncodeSlot()
+{
+    const auto timeout = (std::max)(desc_.backpressureTimeout, 0);
+    return nvenc_->WaitForEncodeSlot(static_cast<DWORD>(timeout));
 }
 
 
@@ -207,11 +544,11 @@ void Encoder::RequestGetEncodedData()
 
 void Encoder::UpdateGetEncodedData()
 {
-    std::vector<NvencEncodedData> data;
+    encodedDataListTemp_.clear();
 
     try
     {
-        nvenc_->GetEncodedData(data);
+        nvenc_->GetEncodedData(encodedDataListTemp_);
     }
     catch (const std::exception& e)
     {
@@ -219,27 +556,713 @@ void Encoder::UpdateGetEncodedData()
         return;
     }
 
-    std::lock_guard<std::mutex> dataLock(encodeDataListMutex_);
-    for (auto &ed : data)
+    PushEncodedDataList();
+}
+
+
+Event * Encoder::GetPendingCompletionEvent() const
+{
+    return nvenc_ ? nvenc_->GetPendingCompletionEvent() : nullptr;
+}
+
+
+void Encoder::OnEncodeCompleted()
+{
+    encodedDataListTemp_.clear();
+
+    try
     {
-        encodedDataList_.push_back(std::move(ed));
+        nvenc_->GetCompletedEncodedData(encodedDataListTemp_, true);
     }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        return;
+    }
+
+    PushEncodedDataList();
 }
 
 
-void Encoder::CopyEncodedDataList()
+void Encoder::PushEncodedDataList()
 {
-    std::lock_guard<std::mutex> lock(encodeDataListMutex_);
+    ApplyFilters();
+    WriteToSinks();
+    FlushPendingEncodedData();
+
+    for (auto &ed : encodedDataListTemp_)
+    {
+        if (desc_.outputFormat != BitstreamFormat::AnnexB)
+        {
+            ConvertEncodedData(ed, desc_.outputFormat);
+        }
+
+        // From here on the packet is immutable and its payload is shared.
+        EncodedPacketRef packet = std::allocate_shared<NvencEncodedData>(PooledAllocator<NvencEncodedData>(packetPool_), std::move(ed));
+        PushToSubscribers(packet);
+        PushEncodedData(std::move(packet));
+    }
+
+    isOutputBackedUp_ = !pendingEncodedDataList_.empty();
+}
 
+
+void Encoder::OnWake()
+{
+    // The consumer made room; packets held back would otherwise wait for the
+    // next encode to complete, which never comes once encoding stops.
+    if (!isOutputBackedUp_) return;
+
+    FlushPendingEncodedData();
+    isOutputBackedUp_ = !pendingEncodedDataList_.empty();
+}
+
+
+void Encoder::ApplyFilters()
+{
+    using namespace std::chrono;
+
+    std::lock_guard<std::mutex> lock(filterMutex_);
+
+    if (filters_.empty()) return;
+
+    const bool isWritable = !desc_.zeroCopy;
+    auto &list = encodedDataListTemp_;
+
+    for (auto &entry : filters_)
+    {
+        for (auto it = list.begin(); it != list.end();)
+        {
+            const auto startTime = steady_clock::now();
+            bool isKept = true;
+            try
+            {
+                isKept = entry.filter->Filter(*it, isWritable, *bufferPool_);
+            }
+            catch (const std::exception& e)
+            {
+                error_ = e.what();
+            }
+            const auto time = static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now() - startTime).count());
+
+            auto &stats = entry.stats;
+            ++stats.packetCount;
+            stats.totalTime += time;
+            stats.maxTime = (std::max)(stats.maxTime, time);
+
+            if (isKept)
+            {
+                ++it;
+            }
+            else
+            {
+                ++stats.droppedCount;
+                it = list.erase(it);
+            }
+        }
+    }
+}
+
+
+void Encoder::WriteToSinks()
+{
+    std::lock_guard<std::mutex> lock(sinkMutex_);
+
+    constexpr BitstreamFormat formats[] = 
+    {
+        BitstreamFormat::AnnexB,
+        BitstreamFormat::LengthPrefixed,
+        BitstreamFormat::LengthPrefixedWithoutParameterSets,
+    };
+
+    for (const auto format : formats)
+    {
+        const bool hasSink = std::any_of(sinks_.begin(), sinks_.end(), [format](const SinkEntry &entry)
+        {
+            return entry.sink->GetFormat() == format;
+        });
+        if (!hasSink) continue;
+
+        for (auto &ed : encodedDataListTemp_)
+        {
+            if (format == BitstreamFormat::AnnexB)
+            {
+                WriteToSinks(ed, format);
+                continue;
+            }
+
+            const bool stripParameterSets = format == BitstreamFormat::LengthPrefixedWithoutParameterSets;
+            nalUnits_.clear();
+            AppendNalUnits(ed.buffer.get(), ed.size, &ed.nalIndex, 0, nalUnits_);
+            const auto nalIndex = ed.nalIndex;
+
+            // The packet still goes to the consumer as Annex-B afterwards, so
+            // it is only rewritten in place when the start codes can be put
+            // back. Locked NVENC bitstreams in zero-copy mode are never written.
+            if (!stripParameterSets && !desc_.zeroCopy && CanOverwriteStartCodes(nalUnits_))
+            {
+                ConvertToLengthPrefixed(ed.buffer.get(), nalUnits_, false, ed.buffer.get());
+                BuildNalIndex(nalUnits_, ed.nalIndex);
+                ed.format = format;
+                WriteToSinks(ed, format);
+                RestoreStartCodes(ed.buffer.get(), nalUnits_);
+            }
+            else
+            {
+                auto buffer = bufferPool_->Acquire(GetLengthPrefixedSize(nalUnits_, stripParameterSets));
+                auto size = static_cast<uint32_t>(
+                    ConvertToLengthPrefixed(ed.buffer.get(), nalUnits_, stripParameterSets, buffer.get()));
+                std::swap(ed.buffer, buffer);
+                std::swap(ed.size, size);
+                BuildNalIndex(nalUnits_, ed.nalIndex);
+                ed.format = format;
+                WriteToSinks(ed, format);
+                std::swap(ed.buffer, buffer);
+                ed.size = size;
+            }
+
+            ed.format = BitstreamFormat::AnnexB;
+            ed.nalIndex = nalIndex;
+        }
+    }
+}
+
+
+// Converts a packet for the consumer queue. Nothing reads its Annex-B form
+// afterwards, so 4-byte start codes are rewritten in place even when units
+// are stripped. Otherwise the packet moves to a pooled copy, which in
+// zero-copy mode also hands the locked bitstream back to NVENC early.
+void Encoder::ConvertEncodedData(NvencEncodedData &ed, BitstreamFormat format)
+{
+    const bool stripParameterSets = format == BitstreamFormat::LengthPrefixedWithoutParameterSets;
+    nalUnits_.clear();
+    AppendNalUnits(ed.buffer.get(), ed.size, &ed.nalIndex, 0, nalUnits_);
+
+    if (!desc_.zeroCopy && CanConvertInPlace(nalUnits_, stripParameterSets))
+    {
+        const auto size = ConvertToLengthPrefixed(ed.buffer.get(), nalUnits_, stripParameterSets, ed.buffer.get());
+        ed.size = static_cast<uint32_t>(size);
+    }
+    else
+    {
+        auto buffer = bufferPool_->Acquire(GetLengthPrefixedSize(nalUnits_, stripParameterSets));
+        const auto size = ConvertToLengthPrefixed(ed.buffer.get(), nalUnits_, stripParameterSets, buffer.get());
+        ed.buffer = std::move(buffer);
+        ed.size = static_cast<uint32_t>(size);
+    }
+
+    BuildNalIndex(nalUnits_, ed.nalIndex);
+    ed.format = format;
+}
+
+
+void Encoder::WriteToSinks(const NvencEncodedData &ed, BitstreamFormat format)
+{
+    for (auto it = sinks_.begin(); it != sinks_.end();)
+    {
+        if (it->sink->GetFormat() != format)
+        {
+            ++it;
+            continue;
+        }
+
+        try
+        {
+            it->sink->Write(ed);
+            ++it;
+        }
+        catch (const std::exception& e)
+        {
+            // A failing sink is detached so that it does not fail every packet.
+            error_ = e.what();
+            it = sinks_.erase(it);
+        }
+    }
+}
+
+
+int Encoder::AddSink(const std::shared_ptr<PacketSink> &sink)
+{
+    if (!sink) return -1;
+
+    std::lock_guard<std::mutex> lock(sinkMutex_);
+    const auto id = nextSinkId_++;
+    sinks_.push_back({ id, sink });
+
+    // Sinks start at an IDR frame, so do not make them wait for one.
+    isIdrFrameRequested_ = true;
+
+    return id;
+}
+
+
+int Encoder::AddFilter(const std::shared_ptr<BitstreamFilter> &filter)
+{
+    if (!filter) return -1;
+
+    std::lock_guard<std::mutex> lock(filterMutex_);
+    const auto id = nextFilterId_++;
+    filters_.push_back({ id, filter, FilterStats {} });
+    return id;
+}
+
+
+std::shared_ptr<BitstreamFilter> Encoder::RemoveFilter(int filterId)
+{
+    std::lock_guard<std::mutex> lock(filterMutex_);
+
+    const auto it = std::find_if(filters_.begin(), filters_.end(), [&](const FilterEntry &entry)
+    {
+        return entry.id == filterId;
+    });
+    if (it == filters_.end()) return nullptr;
+
+    auto filter = std::move(it->filter);
+    filters_.erase(it);
+    return filter;
+}
+
+
+bool Encoder::GetFilterStats(int filterId, FilterStats &stats) const
+{
+    std::lock_guard<std::mutex> lock(filterMutex_);
+
+    const auto it = std::find_if(filters_.begin(), filters_.end(), [&](const FilterEntry &entry)
+    {
+        return entry.id == filterId;
+    });
+    if (it == filters_.end()) return false;
+
+    stats = it->stats;
+    return true;
+}
+
+
+std::shared_ptr<PacketSink> Encoder::RemoveSink(int sinkId)
+{
+    std::lock_guard<std::mutex> lock(sinkMutex_);
+
+    const auto it = std::find_if(sinks_.begin(), sinks_.end(), [&](const SinkEntry &entry)
+    {
+        return entry.id == sinkId;
+    });
+    if (it == sinks_.end()) return nullptr;
+
+    auto sink = std::move(it->sink);
+    sinks_.erase(it);
+    return sink;
+}
+
+
+int Encoder::Subscribe(size_t capacity, BackpressurePolicy policy)
+{
+    auto subscriber = std::make_shared<PacketSubscriber>(capacity, policy);
+
+    std::lock_guard<std::mutex> lock(subscriberMutex_);
+
+    // Replaying the current GOP lets the subscriber start decoding at once.
+    // Without one that fits in its queue, it waits for a new IDR frame.
+    const auto &packets = gopCache_.GetPackets();
+    if (gopCache_.IsValid() && !packets.empty() && packets.size() < subscriber->GetCapacity())
+    {
+        for (const auto &packet : packets)
+        {
+            subscriber->Push(packet);
+        }
+    }
+    else
+    {
+        RequestIdrFrame();
+    }
+
+    const auto id = nextSubscriberId_++;
+    subscribers_.push_back({ id, std::move(subscriber) });
+    return id;
+}
+
+
+bool Encoder::Unsubscribe(int subscriberId)
+{
+    std::shared_ptr<PacketSubscriber> subscriber;
+    {
+        std::lock_guard<std::mutex> lock(subscriberMutex_);
+
+        const auto it = std::find_if(subscribers_.begin(), subscribers_.end(), [&](const SubscriberEntry &entry)
+        {
+            return entry.id == subscriberId;
+        });
+        if (it == subscribers_.end()) return false;
+
+        subscriber = std::move(it->subscriber);
+        subscribers_.erase(it);
+    }
+
+    // The queued packets are released outside the lock when subscriber goes
+    // out of scope.
+    return true;
+}
+
+
+std::shared_ptr<PacketSubscriber> Encoder::GetSubscriber(int subscriberId) const
+{
+    std::lock_guard<std::mutex> lock(subscriberMutex_);
+
+    const auto it = std::find_if(subscribers_.begin(), subscribers_.end(), [&](const SubscriberEntry &entry)
+    {
+        return entry.id == subscriberId;
+    });
+    return it != subscribers_.end() ? it->subscriber : nullptr;
+}
+
+
+int Encoder::PopSubscribedPackets(int subscriberId, int encoderId, EncodedPacket *packets, int count) const
+{
+    const auto subscriber = GetSubscriber(subscriberId);
+    if (!subscriber) return 0;
+
+    const auto &list = subscriber->Pop(static_cast<size_t>(count));
+    const auto n = static_cast<int>(list.size());
+    for (int i = 0; i < n; ++i)
+    {
+        FillEncodedPacket(*list[i], encoderId, packets[i]);
+    }
+    return n;
+}
+
+
+void Encoder::PushToSubscribers(const EncodedPacketRef &packet)
+{
+    std::lock_guard<std::mutex> lock(subscriberMutex_);
+
+    // Nobody needs a replay until someone subscribes, and the first
+    // subscriber gets an IDR frame anyway, so the cache stays empty until
+    // then instead of holding a GOP of buffers for nothing.
+    if (subscribers_.empty())
+    {
+        gopCache_.Clear();
+        return;
+    }
+
+    // Locked bitstreams held by the cache would stall NVENC, so there is no
+    // cache in zero-copy mode.
+    if (!desc_.zeroCopy && gopCache_.Push(packet) && !packet->isIdrFrame)
+    {
+        gopCache_.InsertParameterSets(CreateParameterSetPacket(*packet));
+    }
+
+    for (const auto &entry : subscribers_)
+    {
+        // A subscriber that lost a packet skips to the next random access point.
+        if (!entry.subscriber->Push(packet))
+        {
+            RequestIdrFrame();
+        }
+    }
+}
+
+
+// Builds a packet with the current SPS/PPS that goes in front of frame, in the
+// output format of the encoder.
+EncodedPacketRef Encoder::CreateParameterSetPacket(const NvencEncodedData &frame)
+{
+    NvencEncodedData ed;
+    {
+        std::lock_guard<std::mutex> lock(sequenceParamsMutex_);
+        if (sequenceParams_.empty()) return nullptr;
+
+        ed.size = static_cast<uint32_t>(sequenceParams_.size());
+        ed.buffer = bufferPool_->Acquire(ed.size);
+        std::copy(sequenceParams_.begin(), sequenceParams_.end(), ed.buffer.get());
+    }
+
+    ed.index = frame.index;
+    ed.isLastSlice = false;
+    ed.isRecoveryPoint = true;
+    ed.timeStamp = frame.timeStamp;
+    ed.userData = frame.userData;
+    ed.submitTime = frame.submitTime;
+    ed.completeTime = frame.completeTime;
+    ed.frameIndex = frame.frameIndex;
+    ed.pictureType = frame.pictureType;
+    BuildNalIndex(ed.buffer.get(), ed.size, ed.nalIndex);
+
+    if (desc_.outputFormat != BitstreamFormat::AnnexB)
+    {
+        ConvertEncodedData(ed, desc_.outputFormat);
+    }
+    if (ed.size == 0) return nullptr;
+
+    return std::allocate_shared<NvencEncodedData>(PooledAllocator<NvencEncodedData>(packetPool_), std::move(ed));
+}
+
+
+void Encoder::RequestIdrFrame()
+{
+    // Subscribers that join or fall behind together share one IDR frame
+    // instead of turning the stream into all-intra.
+    const auto now = GetClockMicroseconds();
+    auto last = lastIdrRequestTime_.load();
+    if (last != 0 && now - last < minIdrRequestInterval) return;
+
+    if (lastIdrRequestTime_.compare_exchange_strong(last, now))
+    {
+        isIdrFrameRequested_ = true;
+    }
+}
+
+
+void Encoder::PushEncodedData(EncodedPacketRef &&packet)
+{
+    // Packets held back earlier go first so that the order is kept.
+    FlushPendingEncodedData();
+    if (pendingEncodedDataList_.empty() && encodedDataQueue_.Push(std::move(packet))) return;
+
+    isOutputBackedUp_ = true;
+
+    // Packets that are already in the queue belong to the consumer, so the
+    // DropOldest and Coalesce policies only trim the encode thread's own backlog.
+    auto &pending = pendingEncodedDataList_;
+
+    // A reactor thread drains many encoders, and waiting here would stall all
+    // of them. Block then holds packets back in the pending list instead and
+    // drops new ones once that is full.
+    const auto policy = outputBackpressure_.load();
+    if (policy == BackpressurePolicy::Block && reactor_)
+    {
+        if (pending.size() < maxPendingEncodedDataCount)
+        {
+            pending.push_back(std::move(packet));
+        }
+        else
+        {
+            DropEncodedData();
+        }
+        return;
+    }
+
+    switch (policy)
+    {
+        case BackpressurePolicy::Block:
+        {
+            // CopyEncodedDataList() signals the event after taking packets
+            // out, and the queue is checked again before every wait, so a
+            // pop in between is not missed.
+            const auto timeout = GetClockMicroseconds() + static_cast<uint64_t>((std::max)(backpressureTimeout_.load(), 0)) * 1000;
+            while (!shouldStopEncodeThread_)
+            {
+                FlushPendingEncodedData();
+                if (pending.empty() && encodedDataQueue_.Push(std::move(packet))) return;
+
+                const auto now = GetClockMicroseconds();
+                if (now >= timeout) break;
+                encodedDataPoppedEvent_.Wait(static_cast<uint32_t>((timeout - now + 999) / 1000));
+            }
+            DropEncodedData();
+            return;
+        }
+        case BackpressurePolicy::DropOldest:
+        {
+            if (pending.size() >= maxPendingEncodedDataCount)
+            {
+                auto it = std::find_if(pending.begin(), pending.end(), [](const EncodedPacketRef &data) 
+                { 
+                    return !data->isIdrFrame; 
+                });
+                if (it == pending.end()) it = pending.begin();
+                pending.erase(it);
+                DropEncodedData();
+            }
+            pending.push_back(std::move(packet));
+            return;
+        }
+        case BackpressurePolicy::Coalesce:
+        {
+            if (packet->isIdrFrame || pending.size() >= maxPendingEncodedDataCount)
+            {
+                for (size_t i = 0; i < pending.size(); ++i) DropEncodedData();
+                pending.clear();
+            }
+            pending.push_back(std::move(packet));
+            return;
+        }
+        case BackpressurePolicy::Error:
+        {
+            error_ = "The encoded data queue is full.";
+            DropEncodedData();
+            return;
+        }
+        default:
+        {
+            DropEncodedData();
+            return;
+        }
+    }
+}
+
+
+void Encoder::FlushPendingEncodedData()
+{
+    auto &pending = pendingEncodedDataList_;
+    size_t n = 0;
+    while (n < pending.size() && encodedDataQueue_.Push(std::move(pending[n])))
+    {
+        ++n;
+    }
+    pending.erase(pending.begin(), pending.begin() + n);
+}
+
+
+void Encoder::DropEncodedData()
+{
+    // The following P-frames reference what was dropped, so ask for a new IDR frame.
+    ++droppedEncodedDataCount_;
+    isIdrFrameRequested_ = true;
+}
+
+
+void Encoder::CopyEncodedDataList(size_t maxCount)
+{
+    encodedDataListCopied_.clear();
+
+    const auto count = (std::min)(maxCount, encodedDataQueue_.GetCapacity());
+    drainTime_ = GetClockMicroseconds();
+    EncodedPacketRef packet;
+    while (encodedDataListCopied_.size() < count &&
+           encodedDataQueue_.Pop(packet))
+    {
+        encodedDataListCopied_.push_back(std::move(packet));
+    }
+
+    // Packets held back by backpressure only move when the drain thread
+    // runs, so tell it that there is room now.
+    if (isOutputBackedUp_)
+    {
+        encodedDataPoppedEvent_.Signal();
+        if (reactor_)
+        {
+            reactor_->Wake();
+        }
+        else
+        {
+            RequestGetEncodedData();
+        }
+    }
+}
+
+
+void Encoder::ReleaseEncodedDataList()
+{
     encodedDataListCopied_.clear();
-    std::swap(encodedDataListCopied_, encodedDataList_);
 }
 
 
-const std::vector<NvencEncodedData> & Encoder::GetEncodedDataList() const
+const std::vector<EncodedPacketRef> & Encoder::GetEncodedDataList() const
 {
     return encodedDataListCopied_;
 }
 
 
+int Encoder::GetEncodedPackets(int encoderId, EncodedPacket *packets, int count) const
+{
+    const auto &list = encodedDataListCopied_;
+    const auto n = (std::min)(count, static_cast<int>(list.size()));
+    for (int i = 0; i < n; ++i)
+    {
+        FillEncodedPacket(*list[i], encoderId, packets[i]);
+    }
+    return n;
+}
+
+
+bool Encoder::GetEncodedDataInfo(int index, EncodedDataInfo &info) const
+{
+    const auto &list = encodedDataListCopied_;
+    if (index < 0 || index >= static_cast<int>(list.size())) return false;
+
+    const auto &ed = *list[index];
+    info.index = ed.index;
+    info.timeStamp = ed.timeStamp;
+    info.userData = ed.userData;
+    info.submitTime = ed.submitTime;
+    info.completeTime = ed.completeTime;
+    info.drainTime = drainTime_;
+    info.size = static_cast<int>(ed.size);
+    info.frameIndex = static_cast<int>(ed.frameIndex);
+    info.pictureType = static_cast<int>(ed.pictureType);
+    info.averageQp = static_cast<int>(ed.averageQp);
+    info.satd = static_cast<int>(ed.satd);
+    info.ltrFrameIndex = static_cast<int>(ed.ltrFrameIndex);
+    info.intraMbCount = static_cast<int>(ed.intraMbCount);
+    info.interMbCount = static_cast<int>(ed.interMbCount);
+    info.averageMvX = ed.averageMvX;
+    info.averageMvY = ed.averageMvY;
+    info.isIdrFrame = ed.isIdrFrame;
+    info.isLastSlice = ed.isLastSlice;
+    info.isLtrFrame = ed.isLtrFrame;
+    return true;
+}
+
+
+// Returns the total number of NAL units in the packet, which may be larger
+// than maxCount, or -1 for an invalid index.
+int Encoder::GetEncodedDataNalUnits(int index, NalUnit *units, int maxCount) const
+{
+    const auto &list = encodedDataListCopied_;
+    if (index < 0 || index >= static_cast<int>(list.size())) return -1;
+
+    const auto &ed = *list[index];
+    if (ed.nalIndex.isComplete)
+    {
+        const auto count = static_cast<int>(ed.nalIndex.count);
+        for (int i = 0; i < (std::min)(count, maxCount); ++i)
+        {
+            units[i] = ed.nalIndex.units[i];
+        }
+        return count;
+    }
+
+    std::vector<NalUnit> parsedUnits;
+    if (ed.format == BitstreamFormat::AnnexB)
+    {
+        ParseNalUnits(ed.buffer.get(), ed.size, parsedUnits);
+    }
+    else
+    {
+        ParseLengthPrefixedNalUnits(ed.buffer.get(), ed.size, parsedUnits);
+    }
+    const auto count = static_cast<int>(parsedUnits.size());
+    for (int i = 0; i < (std::min)(count, maxCount); ++i)
+    {
+        units[i] = parsedUnits[i];
+    }
+    return count;
+}
+
+
+// Copies the Annex-B SPS/PPS when buffer is large enough and returns their
+// size either way.
+int Encoder::GetSequenceParams(uint8_t *buffer, int bufferSize) const
+{
+    std::lock_guard<std::mutex> lock(sequenceParamsMutex_);
+
+    const auto size = static_cast<int>(sequenceParams_.size());
+    if (buffer && bufferSize >= size)
+    {
+        std::copy(sequenceParams_.begin(), sequenceParams_.end(), buffer);
+    }
+    return size;
+}
+
+
+bool Encoder::GetParameterSetInfo(ParameterSetInfo &info) const
+{
+    std::lock_guard<std::mutex> lock(sequenceParamsMutex_);
+
+    if (!hasParameterSetInfo_) return false;
+
+    info = parameterSetInfo_;
+    return true;
+}
+
+
 }
@@ -1,14 +1,23 @@
 #pragma once
 
 #include <cstdio>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
+#include <atomic>
 #include <d3d11.h>
 #include "Common.h"
 #include "Nvenc.h"
+#include "SpscQueue.h"
+#include "CompletionReactor.h"
+#include "PacketSink.h"
+#include "PacketSubscriber.h"
+#include "GopCache.h"
+#include "BitstreamFilter.h"
+#include "ParameterSets.h"
 
 
 namespace uNvEncoder
@@ -18,6 +27,15 @@ namespace uNvEncoder
 struct NvencEncodedData;
 
 
+enum class EncoderState : int
+{
+    Initializing = 0,
+    Ready = 1,
+    Failed = 2,
+    Destroying = 3,
+};
+
+
 struct EncoderDesc
 {
     int width; 
@@ -26,48 +44,210 @@ struct EncoderDesc
     int bitRate;
     int maxFrameSize;
     DXGI_FORMAT format;
+    int pipelineDepth;
+    bool zeroCopy;
+    bool subFrameOutput;
+    int sliceCount;
+    BackpressurePolicy inputBackpressure;
+    BackpressurePolicy outputBackpressure;
+    int backpressureTimeout;
+    int maxWidth;
+    int maxHeight;
+    BitstreamFormat outputFormat;
 };
 
 
-class Encoder final
+// Cost of one bitstream filter on the drain thread. Times are in nanoseconds.
+struct FilterStats
+{
+    uint64_t packetCount;
+    uint64_t droppedCount;
+    uint64_t totalTime;
+    uint64_t maxTime;
+};
+
+
+// Plain copy of NvencEncodedData without the payload, laid out for C#.
+struct EncodedDataInfo
+{
+    uint64_t index;
+    uint64_t timeStamp;
+    uint64_t userData;
+    uint64_t submitTime;
+    uint64_t completeTime;
+    uint64_t drainTime;
+    int size;
+    int frameIndex;
+    int pictureType;
+    int averageQp;
+    int satd;
+    int ltrFrameIndex;
+    int intraMbCount;
+    int interMbCount;
+    int averageMvX;
+    int averageMvY;
+    bool isIdrFrame;
+    bool isLastSlice;
+    bool isLtrFrame;
+};
+
+
+enum EncodedPacketFlags : int
+{
+    EncodedPacketFlagIdrFrame = 1 << 0,
+    EncodedPacketFlagLastSlice = 1 << 1,
+    EncodedPacketFlagLtrFrame = 1 << 2,
+    EncodedPacketFlagRecoveryPoint = 1 << 3,
+};
+
+
+// Compact descriptor filled in bulk for the consumer. data stays valid until
+// the next copy or release of the same encoder, or of the same subscriber.
+struct EncodedPacket
+{
+    const void *data;
+    int size;
+    int flags;
+    uint64_t timeStamp;
+    uint64_t userData;
+    int encoderId;
+    int pictureType;
+};
+
+
+class Encoder final : public CompletionSource
 {
 public:
     explicit Encoder(const EncoderDesc &desc);
     ~Encoder();
+    void Initialize(int warmUpFrameCount = 0);
+    bool Recycle();
     bool IsValid() const;
-    void Reconfigure(const EncoderDesc &desc);
-    bool Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame);
-    bool Encode(HANDLE sharedHandle, bool forceIdrFrame);
-    void CopyEncodedDataList();
-    const std::vector<NvencEncodedData> & GetEncodedDataList() const;
+    EncoderState GetState() const { return state_; }
+    void SetDestroying() { state_ = EncoderState::Destroying; }
+    bool CanReconfigure(const EncoderDesc &desc) const;
+    bool Reconfigure(const EncoderDesc &desc);
+    bool SetResolution(int width, int height);
+    bool Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame, uint64_t timeStamp = 0, uint64_t userData = 0);
+    bool Encode(HANDLE sharedHandle, bool forceIdrFrame, uint64_t timeStamp = 0, uint64_t userData = 0);
+    void CopyEncodedDataList(size_t maxCount = SIZE_MAX);
+    int GetEncodedPackets(int encoderId, EncodedPacket *packets, int count) const;
+    void ReleaseEncodedDataList();
+    const std::vector<EncodedPacketRef> & GetEncodedDataList() const;
+    uint64_t GetEncodedDataDrainTime() const { return drainTime_; }
+    bool GetEncodedDataInfo(int index, EncodedDataInfo &info) const;
+    int GetEncodedDataNalUnits(int index, NalUnit *units, int maxCount) const;
+    int GetSequenceParams(uint8_t *buffer, int bufferSize) const;
+    bool GetParameterSetInfo(ParameterSetInfo &info) const;
     const EncoderDesc & GetDesc() const { return desc_; }
+
+    // Sub-frame output always copies, whatever zeroCopy says.
+    static bool IsZeroCopy(const EncoderDesc &desc);
+    int AddSink(const std::shared_ptr<PacketSink> &sink);
+    std::shared_ptr<PacketSink> RemoveSink(int sinkId);
+    int AddFilter(const std::shared_ptr<BitstreamFilter> &filter);
+    std::shared_ptr<BitstreamFilter> RemoveFilter(int filterId);
+    bool GetFilterStats(int filterId, FilterStats &stats) const;
+    int Subscribe(size_t capacity, BackpressurePolicy policy);
+    bool Unsubscribe(int subscriberId);
+    std::shared_ptr<PacketSubscriber> GetSubscriber(int subscriberId) const;
+    int PopSubscribedPackets(int subscriberId, int encoderId, EncodedPacket *packets, int count) const;
+    Event * GetPendingCompletionEvent() const override;
+    void OnEncodeCompleted() override;
+    void OnWake() override;
+    uint64_t GetDroppedFrameCount() const { return droppedFrameCount_; }
+    uint64_t GetDroppedEncodedDataCount() const { return droppedEncodedDataCount_; }
     bool HasError() const { return !error_.empty(); }
     const std::string & GetError() const { return error_; }
     void ClearError() { error_.clear(); }
 
 private:
-    NvencDesc CreateNvencDesc() const;
+    NvencDesc CreateNvencDesc(const EncoderDesc &encDesc) const;
     void CreateDevice();
     void DestroyDevice();
     void CreateNvenc();
     void DestroyNvenc();
+    void ReleasePackets();
+    void UpdateSequenceParams();
     void StartThread();
     void StopThread();
     void WaitForEncodeRequest();
     void RequestGetEncodedData();
     void UpdateGetEncodedData();
+    void PushEncodedDataList();
+    void ApplyFilters();
+    void WriteToSinks();
+    void WriteToSinks(const NvencEncodedData &ed, BitstreamFormat format);
+    void PushToSubscribers(const EncodedPacketRef &packet);
+    EncodedPacketRef CreateParameterSetPacket(const NvencEncodedData &frame);
+    void RequestIdrFrame();
+    void ConvertEncodedData(NvencEncodedData &ed, BitstreamFormat format);
+    bool ApplyInputBackpressure();
+    bool WaitForEncodeSlot();
+    void PushEncodedData(EncodedPacketRef &&packet);
+    void FlushPendingEncodedData();
+    void DropEncodedData();
 
     EncoderDesc desc_;
+    // Reconfigure() updates desc_ on the Unity thread, so the drain thread
+    // reads the output policy from these. Its other reads of desc_ are of
+    // members that stay fixed for the session (outputFormat, zeroCopy).
+    std::atomic<BackpressurePolicy> outputBackpressure_;
+    std::atomic<int> backpressureTimeout_;
+    std::atomic<EncoderState> state_ { EncoderState::Initializing };
     ComPtr<ID3D11Device> device_;
+    std::shared_ptr<BufferPool> bufferPool_;
+    std::shared_ptr<BlockPool> packetPool_;
     std::unique_ptr<class Nvenc> nvenc_;
-    std::vector<NvencEncodedData> encodedDataList_;
-    std::vector<NvencEncodedData> encodedDataListCopied_;
+    std::vector<NvencEncodedData> encodedDataListTemp_;
+    std::vector<EncodedPacketRef> pendingEncodedDataList_;
+    SpscQueue<EncodedPacketRef> encodedDataQueue_;
+    // Set by the drain thread while packets wait for room in the queue.
+    std::atomic<bool> isOutputBackedUp_ { false };
+    Event encodedDataPoppedEvent_;
+    std::vector<EncodedPacketRef> encodedDataListCopied_;
+    uint64_t drainTime_ = 0;
     std::thread encodeThread_;
+    std::shared_ptr<CompletionReactor> reactor_;
     std::condition_variable encodeCond_;
     std::mutex encodeMutex_;
-    std::mutex encodeDataListMutex_;
     bool shouldStopEncodeThread_ = false;
     bool isEncodeRequested = false;
+    struct SinkEntry
+    {
+        int id;
+        std::shared_ptr<PacketSink> sink;
+    };
+    std::vector<SinkEntry> sinks_;
+    std::vector<NalUnit> nalUnits_;
+    struct FilterEntry
+    {
+        int id;
+        std::shared_ptr<BitstreamFilter> filter;
+        FilterStats stats;
+    };
+    std::vector<FilterEntry> filters_;
+    mutable std::mutex filterMutex_;
+    int nextFilterId_ = 0;
+    std::mutex sinkMutex_;
+    int nextSinkId_ = 0;
+    struct SubscriberEntry
+    {
+        int id;
+        std::shared_ptr<PacketSubscriber> subscriber;
+    };
+    std::vector<SubscriberEntry> subscribers_;
+    GopCache gopCache_;
+    mutable std::mutex subscriberMutex_;
+    int nextSubscriberId_ = 0;
+    std::vector<uint8_t> sequenceParams_;
+    ParameterSetInfo parameterSetInfo_;
+    bool hasParameterSetInfo_ = false;
+    mutable std::mutex sequenceParamsMutex_;
+    std::atomic<bool> isIdrFrameRequested_ { false };
+    std::atomic<uint64_t> lastIdrRequestTime_ { 0 };
+    std::atomic<uint64_t> droppedFrameCount_ { 0 };
+    std::atomic<uint64_t> droppedEncodedDataCount_ { 0 };
     std::string error_;
 };
 
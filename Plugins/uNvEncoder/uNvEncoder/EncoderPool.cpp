@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <tuple>
+#include "EncoderPool.h"
+
+
+namespace uNvEncoder
+{
+
+
+bool EncoderPool::Key::operator<(const Key &other) const
+{
+    return 
+        std::tie(maxWidth, maxHeight, format, pipelineDepth, zeroCopy, subFrameOutput, sliceCount, outputFormat) <
+        std::tie(other.maxWidth, other.maxHeight, other.format, other.pipelineDepth, other.zeroCopy, other.subFrameOutput, other.sliceCount, other.outputFormat);
+}
+
+
+EncoderPool::~EncoderPool()
+{
+    Clear();
+}
+
+
+EncoderPool::Key EncoderPool::CreateKey(const EncoderDesc &desc)
+{
+    // Only the sub-frame mode uses slices, so the slice count does not split
+    // the pool otherwise.
+    Key key;
+    key.maxWidth = (std::max)(desc.maxWidth, desc.width);
+    key.maxHeight = (std::max)(desc.maxHeight, desc.height);
+    key.format = desc.format;
+    key.pipelineDepth = desc.pipelineDepth;
+    key.zeroCopy = Encoder::IsZeroCopy(desc);
+    key.subFrameOutput = desc.subFrameOutput;
+    key.sliceCount = desc.subFrameOutput ? desc.sliceCount : 0;
+    key.outputFormat = desc.outputFormat;
+    return key;
+}
+
+
+void EncoderPool::Fill(const EncoderDesc &desc, int count, int warmUpFrameCount)
+{
+    const auto key = CreateKey(desc);
+    const auto capacity = static_cast<size_t>((std::max)(count, 0));
+
+    // Encoders are created and destroyed outside the lock since both take a
+    // while and Acquire() may be called from the rendering thread meanwhile.
+    std::vector<std::unique_ptr<Encoder>> encoders;
+    size_t missingCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &entry = entries_[key];
+        entry.capacity = capacity;
+        while (entry.encoders.size() > capacity)
+        {
+            encoders.push_back(std::move(entry.encoders.back()));
+            entry.encoders.pop_back();
+        }
+        missingCount = capacity - entry.encoders.size();
+    }
+    encoders.clear();
+
+    for (size_t i = 0; i < missingCount; ++i)
+    {
+        auto encoder = std::make_unique<Encoder>(desc);
+        encoder->Initialize(warmUpFrameCount);
+        if (!encoder->IsValid()) break;
+        encoders.push_back(std::move(encoder));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &entry = entries_[key];
+    for (auto &encoder : encoders)
+    {
+        if (entry.encoders.size() >= entry.capacity) break;
+        entry.encoders.push_back(std::move(encoder));
+    }
+}
+
+
+std::unique_ptr<Encoder> EncoderPool::Acquire(const EncoderDesc &desc)
+{
+    std::unique_ptr<Encoder> encoder;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto it = entries_.find(CreateKey(desc));
+        if (it == entries_.end() || it->second.encoders.empty()) return nullptr;
+
+        // The key is made of the fields that Reconfigure() requires to match,
+        // so this holds; if it ever did not, the encoder would be destroyed
+        // below, on the thread the pool is meant to keep that off.
+        auto &encoders = it->second.encoders;
+        if (!encoders.back()->CanReconfigure(desc)) return nullptr;
+
+        encoder = std::move(encoders.back());
+        encoders.pop_back();
+    }
+
+    if (!encoder->Reconfigure(desc)) return nullptr;
+
+    return encoder;
+}
+
+
+void EncoderPool::Return(std::unique_ptr<Encoder> &&encoder)
+{
+    // Encoders that do not fit in the pool are destroyed when this returns.
+    auto returned = std::move(encoder);
+    if (!returned || !returned->Recycle()) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(CreateKey(returned->GetDesc()));
+    if (it == entries_.end()) return;
+
+    auto &entry = it->second;
+    if (entry.encoders.size() < entry.capacity)
+    {
+        entry.encoders.push_back(std::move(returned));
+    }
+}
+
+
+void EncoderPool::Clear()
+{
+    std::map<Key, Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries.swap(entries_);
+    }
+}
+
+
+int EncoderPool::GetCount(const EncoderDesc &desc) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(CreateKey(desc));
+    return it != entries_.end() ? static_cast<int>(it->second.encoders.size()) : 0;
+}
+
+
+}
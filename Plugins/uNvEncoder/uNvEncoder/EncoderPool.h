@@ -0,0 +1,61 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Encoder.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Keeps initialized encoders around so that creating one for a known
+// configuration skips opening the NVENC session, allocating the input
+// textures and registering them. Encoders are keyed by everything that is
+// fixed at session creation; the resolution (within the maximum one) and
+// rate control settings are applied on checkout.
+class EncoderPool final
+{
+public:
+    EncoderPool() = default;
+    ~EncoderPool();
+    EncoderPool(const EncoderPool &) = delete;
+    EncoderPool & operator=(const EncoderPool &) = delete;
+
+    void Fill(const EncoderDesc &desc, int count, int warmUpFrameCount);
+    std::unique_ptr<Encoder> Acquire(const EncoderDesc &desc);
+    void Return(std::unique_ptr<Encoder> &&encoder);
+    void Clear();
+    int GetCount(const EncoderDesc &desc) const;
+
+private:
+    struct Key
+    {
+        int maxWidth;
+        int maxHeight;
+        DXGI_FORMAT format;
+        int pipelineDepth;
+        bool zeroCopy;
+        bool subFrameOutput;
+        int sliceCount;
+        BitstreamFormat outputFormat;
+
+        bool operator<(const Key &other) const;
+    };
+
+    struct Entry
+    {
+        size_t capacity = 0;
+        std::vector<std::unique_ptr<Encoder>> encoders;
+    };
+
+    static Key CreateKey(const EncoderDesc &desc);
+
+    std::map<Key, Entry> entries_;
+    mutable std::mutex mutex_;
+};
+
+
+}
@@ -0,0 +1,171 @@
+#include "Event.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+constexpr uint32_t Event::Infinite;
+constexpr size_t Event::MaxWaitCount;
+
+
+#ifdef _WIN32
+
+
+static_assert(Event::Infinite == INFINITE, "Event::Infinite must match INFINITE.");
+static_assert(Event::MaxWaitCount == MAXIMUM_WAIT_OBJECTS, "Event::MaxWaitCount must match MAXIMUM_WAIT_OBJECTS.");
+
+
+namespace
+{
+    Event::WaitResult ToWaitResult(DWORD result, DWORD count)
+    {
+        if (result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + count) return Event::WaitResult::Signaled;
+        if (result == WAIT_TIMEOUT) return Event::WaitResult::Timeout;
+        return Event::WaitResult::Failed;
+    }
+}
+
+
+Event::Event()
+    : handle_(::CreateEventA(NULL, FALSE, FALSE, NULL))
+{
+}
+
+
+Event::~Event()
+{
+    if (handle_)
+    {
+        ::CloseHandle(handle_);
+    }
+}
+
+
+void Event::Signal()
+{
+    ::SetEvent(handle_);
+}
+
+
+Event::WaitResult Event::Wait(uint32_t timeout)
+{
+    return ToWaitResult(::WaitForSingleObject(handle_, timeout), 1);
+}
+
+
+void * Event::GetHandle() const
+{
+    return handle_;
+}
+
+
+Event::WaitResult Event::WaitAny(Event * const *events, size_t count, uint32_t timeout, size_t &index)
+{
+    if (count == 0 || count > MaxWaitCount) return WaitResult::Failed;
+
+    HANDLE handles[MaxWaitCount];
+    for (size_t i = 0; i < count; ++i)
+    {
+        handles[i] = events[i]->handle_;
+    }
+
+    const auto result = ::WaitForMultipleObjects(static_cast<DWORD>(count), handles, FALSE, timeout);
+    const auto waitResult = ToWaitResult(result, static_cast<DWORD>(count));
+    if (waitResult == WaitResult::Signaled)
+    {
+        index = static_cast<size_t>(result - WAIT_OBJECT_0);
+    }
+    return waitResult;
+}
+
+
+#else
+
+
+namespace
+{
+    // All events share one lock and condition variable so that WaitAny() can
+    // sleep on several of them at once.
+    std::mutex s_mutex;
+    std::condition_variable s_cond;
+}
+
+
+Event::Event()
+{
+}
+
+
+Event::~Event()
+{
+}
+
+
+void Event::Signal()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    isSignaled_ = true;
+    s_cond.notify_all();
+}
+
+
+Event::WaitResult Event::Wait(uint32_t timeout)
+{
+    Event *events[] = { this };
+    size_t index = 0;
+    return WaitAny(events, 1, timeout, index);
+}
+
+
+void * Event::GetHandle() const
+{
+    return const_cast<Event *>(this);
+}
+
+
+Event::WaitResult Event::WaitAny(Event * const *events, size_t count, uint32_t timeout, size_t &index)
+{
+    if (count == 0 || count > MaxWaitCount) return WaitResult::Failed;
+
+    std::unique_lock<std::mutex> lock(s_mutex);
+
+    const auto findSignaled = [&]
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (events[i]->isSignaled_)
+            {
+                index = i;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    if (timeout == Infinite)
+    {
+        s_cond.wait(lock, findSignaled);
+    }
+    else if (!s_cond.wait_for(lock, std::chrono::milliseconds(timeout), findSignaled))
+    {
+        return WaitResult::Timeout;
+    }
+
+    events[index]->isSignaled_ = false;
+    return WaitResult::Signaled;
+}
+
+
+#endif
+
+
+}
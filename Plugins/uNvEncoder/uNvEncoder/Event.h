@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace uNvEncoder
+{
+
+
+// Auto-reset event. On Windows it wraps a Win32 event whose handle can be
+// registered with NVENC; elsewhere it is built on a condition variable so
+// that the code waiting on completions can run in tests.
+class Event final
+{
+public:
+    enum class WaitResult
+    {
+        Signaled,
+        Timeout,
+        Failed,
+    };
+
+    static constexpr uint32_t Infinite = 0xFFFFFFFF;
+
+    // WaitAny() takes at most this many events, as WaitForMultipleObjects() does.
+    static constexpr size_t MaxWaitCount = 64;
+
+    Event();
+    ~Event();
+    Event(const Event &) = delete;
+    Event & operator=(const Event &) = delete;
+
+    void Signal();
+    WaitResult Wait(uint32_t timeout); // [ms]
+
+    // The Win32 HANDLE on Windows, or this object elsewhere.
+    void * GetHandle() const;
+
+    // Waits until one of events is signaled, resets it and sets index to its
+    // position. Earlier events win when several are signaled.
+    static WaitResult WaitAny(Event * const *events, size_t count, uint32_t timeout, size_t &index);
+
+private:
+#ifdef _WIN32
+    void *handle_ = nullptr;
+#else
+    bool isSignaled_ = false;
+#endif
+};
+
+
+}
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include "FileWriter.h"
+#include "Common.h"
+
+
+namespace uNvEncoder
+{
+
+
+FileWriter::FileWriter(
+    const std::string &path, 
+    size_t bufferSize, 
+    size_t bufferCount, 
+    std::chrono::milliseconds flushInterval)
+    : bufferSize_((std::max<size_t>)(bufferSize, 4096))
+    , flushInterval_(flushInterval)
+{
+    file_ = ::CreateFileA(
+        path.c_str(), 
+        GENERIC_WRITE, 
+        0, 
+        NULL, 
+        CREATE_ALWAYS, 
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 
+        NULL);
+    if (file_ == INVALID_HANDLE_VALUE)
+    {
+        ThrowError("Failed to open " + path + ".");
+        return;
+    }
+
+    for (size_t i = 0; i < (std::max<size_t>)(bufferCount, 2); ++i)
+    {
+        Buffer buffer;
+        buffer.data = std::make_unique<uint8_t[]>(bufferSize_);
+        freeBuffers_.push_back(std::move(buffer));
+    }
+
+    thread_ = std::thread([this] { Run(); });
+}
+
+
+FileWriter::~FileWriter()
+{
+    Close();
+}
+
+
+void FileWriter::Write(const void *data, size_t size)
+{
+    if (hasError_) 
+    {
+        ThrowError("Failed to write to the file.");
+        return;
+    }
+
+    auto src = static_cast<const uint8_t *>(data);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (size > 0)
+    {
+        if (!current_.data) AcquireBuffer(lock);
+
+        const auto n = (std::min)(size, bufferSize_ - current_.size);
+        ::memcpy(current_.data.get() + current_.size, src, n);
+        current_.size += n;
+        size_ += n;
+        src += n;
+        size -= n;
+
+        if (current_.size == bufferSize_) SubmitBuffer();
+    }
+}
+
+
+void FileWriter::WriteAt(uint64_t offset, const void *data, size_t size)
+{
+    auto src = static_cast<const uint8_t *>(data);
+    Patch patch;
+    patch.offset = offset;
+    patch.data.assign(src, src + size);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    patches_.push_back(std::move(patch));
+}
+
+
+void FileWriter::Flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (current_.data && current_.size > 0)
+    {
+        SubmitBuffer();
+    }
+}
+
+
+void FileWriter::Close()
+{
+    if (file_ == INVALID_HANDLE_VALUE) return;
+
+    Flush();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shouldStop_ = true;
+    }
+    cond_.notify_all();
+
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+
+    for (const auto &patch : patches_)
+    {
+        OVERLAPPED overlapped = { 0 };
+        overlapped.Offset = static_cast<DWORD>(patch.offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(patch.offset >> 32);
+        DWORD written = 0;
+        if (!::WriteFile(file_, patch.data.data(), static_cast<DWORD>(patch.data.size()), &written, &overlapped) ||
+            written != patch.data.size())
+        {
+            hasError_ = true;
+        }
+    }
+    patches_.clear();
+
+    ::CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+}
+
+
+// Called with mutex_ held. Wakes the background thread so that it starts
+// timing the new buffer.
+void FileWriter::AcquireBuffer(std::unique_lock<std::mutex> &lock)
+{
+    cond_.wait(lock, [&] { return !freeBuffers_.empty(); });
+    current_ = std::move(freeBuffers_.back());
+    freeBuffers_.pop_back();
+    current_.size = 0;
+    currentStartTime_ = std::chrono::steady_clock::now();
+    cond_.notify_all();
+}
+
+
+// Called with mutex_ held.
+void FileWriter::SubmitBuffer()
+{
+    fullBuffers_.push_back(std::move(current_));
+    current_ = Buffer();
+    cond_.notify_all();
+}
+
+
+void FileWriter::Run()
+{
+    for (;;)
+    {
+        Buffer buffer;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (fullBuffers_.empty() && !shouldStop_)
+            {
+                if (current_.size == 0)
+                {
+                    cond_.wait(lock);
+                    continue;
+                }
+
+                const auto flushTime = currentStartTime_ + flushInterval_;
+                if (std::chrono::steady_clock::now() >= flushTime)
+                {
+                    SubmitBuffer();
+                }
+                else
+                {
+                    cond_.wait_until(lock, flushTime);
+                }
+            }
+
+            // Everything submitted before Close() still reaches the file.
+            if (fullBuffers_.empty()) break;
+
+            buffer = std::move(fullBuffers_.front());
+            fullBuffers_.pop_front();
+        }
+
+        DWORD written = 0;
+        if (!::WriteFile(file_, buffer.data.get(), static_cast<DWORD>(buffer.size), &written, NULL) ||
+            written != buffer.size)
+        {
+            hasError_ = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            freeBuffers_.push_back(std::move(buffer));
+        }
+        cond_.notify_all();
+    }
+}
+
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <windows.h>
+
+
+namespace uNvEncoder
+{
+
+
+// Appends to a file through a few large buffers that are written out by a
+// background thread. Small writes are coalesced into the current buffer and
+// the caller only waits for the disk when every buffer is still queued.
+// The background thread also takes over a partially filled buffer once
+// flushInterval has passed since its first byte, so data reaches the file
+// even when writes stop.
+// WriteAt() overwrites earlier bytes, e.g. an index whose position is only
+// known at the end; it is applied by Close() once everything is on disk.
+class FileWriter final
+{
+public:
+    FileWriter(
+        const std::string &path, 
+        size_t bufferSize = 1 << 20, 
+        size_t bufferCount = 4, 
+        std::chrono::milliseconds flushInterval = std::chrono::milliseconds(500));
+    ~FileWriter();
+    FileWriter(const FileWriter &) = delete;
+    FileWriter & operator=(const FileWriter &) = delete;
+
+    void Write(const void *data, size_t size);
+    void WriteAt(uint64_t offset, const void *data, size_t size);
+    void Flush();
+    void Close();
+    uint64_t GetSize() const { return size_; }
+
+private:
+    struct Buffer
+    {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size = 0;
+    };
+
+    struct Patch
+    {
+        uint64_t offset;
+        std::vector<uint8_t> data;
+    };
+
+    void Run();
+    void AcquireBuffer(std::unique_lock<std::mutex> &lock);
+    void SubmitBuffer();
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    const size_t bufferSize_;
+    const std::chrono::milliseconds flushInterval_;
+    uint64_t size_ = 0;
+    // current_ and the buffer lists are guarded by mutex_.
+    Buffer current_;
+    std::chrono::steady_clock::time_point currentStartTime_;
+    std::vector<Buffer> freeBuffers_;
+    std::deque<Buffer> fullBuffers_;
+    std::vector<Patch> patches_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool shouldStop_ = false;
+    std::atomic<bool> hasError_ { false };
+};
+
+
+}
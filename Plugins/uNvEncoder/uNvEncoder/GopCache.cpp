@@ -0,0 +1,57 @@
+#include "GopCache.h"
+
+
+namespace uNvEncoder
+{
+
+
+GopCache::GopCache(size_t maxFrameCount)
+    : maxFrameCount_(maxFrameCount)
+{
+}
+
+
+bool GopCache::Push(const EncodedPacketRef &packet)
+{
+    const bool isGopStart = IsRandomAccessPoint(*packet) && packet->index != lastIndex_;
+    lastIndex_ = packet->index;
+
+    if (isGopStart)
+    {
+        packets_.clear();
+        frameCount_ = 0;
+        isValid_ = true;
+    }
+
+    if (!isValid_) return false;
+
+    if (frameCount_ >= maxFrameCount_)
+    {
+        Clear();
+        return false;
+    }
+
+    packets_.push_back(packet);
+    if (packet->isLastSlice) ++frameCount_;
+
+    return isGopStart;
+}
+
+
+void GopCache::InsertParameterSets(const EncodedPacketRef &packet)
+{
+    if (!isValid_ || !packet) return;
+
+    packets_.insert(packets_.begin(), packet);
+}
+
+
+void GopCache::Clear()
+{
+    packets_.clear();
+    frameCount_ = 0;
+    isValid_ = false;
+}
+
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Nvenc.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Packets since the last IDR frame or recovery point, replayed to subscribers
+// that join mid-stream so that they can start decoding right away. A GOP
+// longer than maxFrameCount is not kept; the cache stays empty until the next
+// random access point.
+class GopCache final
+{
+public:
+    explicit GopCache(size_t maxFrameCount);
+    GopCache(const GopCache &) = delete;
+    GopCache & operator=(const GopCache &) = delete;
+
+    // Returns true when packet starts a new GOP.
+    bool Push(const EncodedPacketRef &packet);
+
+    // Puts SPS/PPS in front of a GOP that starts at a recovery point, since
+    // only IDR frames carry them in-band.
+    void InsertParameterSets(const EncodedPacketRef &packet);
+
+    // Takes effect from the next packet; a longer GOP is dropped then.
+    void SetMaxFrameCount(size_t maxFrameCount) { maxFrameCount_ = maxFrameCount; }
+    void Clear();
+    bool IsValid() const { return isValid_; }
+    const std::vector<EncodedPacketRef> & GetPackets() const { return packets_; }
+
+private:
+    size_t maxFrameCount_;
+    std::vector<EncodedPacketRef> packets_;
+    size_t frameCount_ = 0;
+    uint64_t lastIndex_ = UINT64_MAX;
+    bool isValid_ = false;
+};
+
+
+}
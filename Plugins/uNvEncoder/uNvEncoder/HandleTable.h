@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "SpscQueue.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Slot array of objects addressed by int handles that encode a slot index and
+// a generation. Lookups are lock-free and pin the slot while the returned Ref
+// is alive; Remove() bumps the generation so stale handles are rejected and
+// waits for pinned readers before handing the object back.
+template <class T>
+class HandleTable final
+{
+public:
+    using Handle = int;
+    static constexpr int SlotBits = 10;
+    static constexpr uint32_t SlotCount = 1U << SlotBits;
+    static constexpr uint32_t MaxGeneration = (1U << (31 - SlotBits)) - 1;
+
+private:
+    struct alignas(CacheLineSize) Slot
+    {
+        std::atomic<T *> object { nullptr };
+        std::atomic<uint32_t> generation { 1 };
+        std::atomic<int> readerCount { 0 };
+    };
+
+public:
+    class Ref final
+    {
+    public:
+        Ref() = default;
+        Ref(Slot *slot, T *object) : slot_(slot), object_(object) {}
+        Ref(Ref &&other) : slot_(other.slot_), object_(other.object_) { other.slot_ = nullptr; other.object_ = nullptr; }
+        Ref(const Ref &) = delete;
+        Ref & operator=(const Ref &) = delete;
+        ~Ref() { if (slot_) --slot_->readerCount; }
+
+        explicit operator bool() const { return object_ != nullptr; }
+        T * operator->() const { return object_; }
+        T & operator*() const { return *object_; }
+        T * get() const { return object_; }
+
+    private:
+        Slot *slot_ = nullptr;
+        T *object_ = nullptr;
+    };
+
+    HandleTable()
+        : slots_(std::make_unique<Slot[]>(SlotCount))
+    {
+        freeSlots_.reserve(SlotCount);
+        for (uint32_t i = SlotCount; i > 0; --i)
+        {
+            freeSlots_.push_back(i - 1);
+        }
+    }
+
+    ~HandleTable()
+    {
+        for (uint32_t i = 0; i < SlotCount; ++i)
+        {
+            delete slots_[i].object.exchange(nullptr);
+        }
+    }
+
+    HandleTable(const HandleTable &) = delete;
+    HandleTable & operator=(const HandleTable &) = delete;
+
+    // Returns -1 when every slot is in use.
+    Handle Add(std::unique_ptr<T> &&object)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (freeSlots_.empty()) return -1;
+
+        const auto index = freeSlots_.back();
+        freeSlots_.pop_back();
+
+        auto &slot = slots_[index];
+        slot.object = object.release();
+        return static_cast<Handle>((slot.generation.load() << SlotBits) | index);
+    }
+
+    std::unique_ptr<T> Remove(Handle handle)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto slot = FindSlot(handle);
+        if (!slot || !slot->object) return nullptr;
+
+        const auto generation = slot->generation.load();
+        slot->generation = generation < MaxGeneration ? generation + 1 : 1;
+        std::unique_ptr<T> object(slot->object.exchange(nullptr));
+
+        while (slot->readerCount > 0)
+        {
+            std::this_thread::yield();
+        }
+
+        freeSlots_.push_back(static_cast<uint32_t>(slot - slots_.get()));
+        return object;
+    }
+
+    Ref Get(Handle handle) const
+    {
+        auto slot = FindSlot(handle);
+        if (!slot) return Ref();
+
+        ++slot->readerCount;
+        if (slot->generation != GetGeneration(handle))
+        {
+            --slot->readerCount;
+            return Ref();
+        }
+
+        const auto object = slot->object.load();
+        if (!object)
+        {
+            --slot->readerCount;
+            return Ref();
+        }
+
+        return Ref(slot, object);
+    }
+
+    // Calls func(handle, object) for every live object, pinning each one only
+    // while func runs.
+    template <class Func>
+    void ForEach(Func &&func) const
+    {
+        for (uint32_t i = 0; i < SlotCount; ++i)
+        {
+            const auto &slot = slots_[i];
+            if (!slot.object.load()) continue;
+
+            const auto handle = static_cast<Handle>((slot.generation.load() << SlotBits) | i);
+            if (const auto &ref = Get(handle))
+            {
+                func(handle, *ref);
+            }
+        }
+    }
+
+private:
+    static uint32_t GetIndex(Handle handle) { return static_cast<uint32_t>(handle) & (SlotCount - 1); }
+    static uint32_t GetGeneration(Handle handle) { return static_cast<uint32_t>(handle) >> SlotBits; }
+
+    Slot * FindSlot(Handle handle) const
+    {
+        if (handle < 0) return nullptr;
+
+        auto &slot = slots_[GetIndex(handle)];
+        if (slot.generation != GetGeneration(handle)) return nullptr;
+
+        return &slot;
+    }
+
+    const std::unique_ptr<Slot[]> slots_;
+    std::vector<uint32_t> freeSlots_;
+    std::mutex mutex_;
+};
+
+
+}
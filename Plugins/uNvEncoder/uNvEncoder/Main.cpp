@@ -1,16 +1,26 @@
 #include <memory>
-#include <map>
 #include <d3d11.h>
 #include <IUnityInterface.h>
 #include "Encoder.h"
 #include "Nvenc.h"
+#include "CompletionReactor.h"
+#include "HandleTable.h"
+#include "BackgroundWorker.h"
+#include "EncoderPool.h"
+#include "AnnexBFileSink.h"
+#include "MuxerSink.h"
+#include "Mp4Muxer.h"
+#include "MpegTsMuxer.h"
+#include "MatroskaMuxer.h"
+#include "NalUnitStripFilter.h"
+#include "SeiTimeStampFilter.h"
 
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "dxgi.lib")
 
 
 using namespace uNvEncoder;
-using EncoderId = int;
+using EncoderId = HandleTable<Encoder>::Handle;
 
 
 namespace uNvEncoder
@@ -21,8 +31,21 @@ namespace uNvEncoder
 
 namespace
 {
-    std::map<EncoderId, std::unique_ptr<Encoder>> g_encoders;
-    EncoderId g_encoderId = 0;
+    HandleTable<Encoder> g_encoders;
+    EncoderPool g_encoderPool;
+    std::unique_ptr<BackgroundWorker> g_worker;
+
+    void PostTask(BackgroundWorker::Task &&task)
+    {
+        if (g_worker)
+        {
+            g_worker->Post(std::move(task));
+        }
+        else
+        {
+            task();
+        }
+    }
 }
 
 
@@ -33,44 +56,146 @@ extern "C"
 UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API UnityPluginLoad(IUnityInterfaces* unityInterfaces)
 {
     g_unity = unityInterfaces;
+    g_worker = std::make_unique<BackgroundWorker>();
 }
 
 
 UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API UnityPluginUnload()
 {
+    // Reactor threads must not be joined from static destructors under the loader lock.
+    g_worker.reset();
+    g_encoderPool.Clear();
+    CompletionReactor::SetReactorCount(0);
     g_unity = nullptr;
 }
 
 
-const std::unique_ptr<Encoder> & GetEncoder(EncoderId id)
+HandleTable<Encoder>::Ref GetEncoder(EncoderId id)
 {
-    static std::unique_ptr<Encoder> invalid;
-    const auto it = g_encoders.find(id);
-    return (it != g_encoders.end()) ? it->second : invalid;
+    return g_encoders.Get(id);
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderSetCompletionReactorCount(int count)
+{
+    CompletionReactor::SetReactorCount(count);
 }
 
 
 UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderCreate(const EncoderDesc &desc)
 {
-    const auto id = g_encoderId++;
+    if (auto encoder = g_encoderPool.Acquire(desc))
+    {
+        return g_encoders.Add(std::move(encoder));
+    }
+
     auto encoder = std::make_unique<Encoder>(desc);
-    g_encoders.emplace(id, std::move(encoder));
+    encoder->Initialize();
+    return g_encoders.Add(std::move(encoder));
+}
+
+
+UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderCreateAsync(const EncoderDesc &desc)
+{
+    if (auto encoder = g_encoderPool.Acquire(desc))
+    {
+        return g_encoders.Add(std::move(encoder));
+    }
+
+    const auto id = g_encoders.Add(std::make_unique<Encoder>(desc));
+    if (id < 0) return id;
+
+    PostTask([id]
+    {
+        if (const auto &encoder = GetEncoder(id))
+        {
+            encoder->Initialize();
+        }
+    });
+
     return id;
 }
 
 
 UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderDestroy(EncoderId id)
 {
-    g_encoders.erase(id);
+    // The encoder is destroyed here, after other threads have let go of it.
+    auto encoder = g_encoders.Remove(id);
 }
 
 
-UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderReconfigure(int id, const EncoderDesc &desc)
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderDestroyAsync(EncoderId id)
 {
+    // Reject further calls right away; the teardown itself runs after any
+    // pending asynchronous initialization of the same encoder.
     if (const auto &encoder = GetEncoder(id))
     {
-        encoder->Reconfigure(desc);
+        encoder->SetDestroying();
     }
+
+    PostTask([id]
+    {
+        auto encoder = g_encoders.Remove(id);
+    });
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderReturnToPool(EncoderId id)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        encoder->SetDestroying();
+    }
+
+    PostTask([id]
+    {
+        g_encoderPool.Return(g_encoders.Remove(id));
+    });
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderFillPool(const EncoderDesc &desc, int count, int warmUpFrameCount)
+{
+    PostTask([desc, count, warmUpFrameCount]
+    {
+        g_encoderPool.Fill(desc, count, warmUpFrameCount);
+    });
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetPooledCount(const EncoderDesc &desc)
+{
+    return g_encoderPool.GetCount(desc);
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderClearPool()
+{
+    PostTask([]
+    {
+        g_encoderPool.Clear();
+    });
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetState(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? static_cast<int>(encoder->GetState()) : -1;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderReconfigure(EncoderId id, const EncoderDesc &desc)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->Reconfigure(desc) : false;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderSetResolution(EncoderId id, int width, int height)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->SetResolution(width, height) : false;
 }
 
 
@@ -109,26 +234,222 @@ UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetFrameRate(EncoderId
 }
 
 
-UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncode(EncoderId id, ID3D11Texture2D *texture, bool forceIdrFrame)
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetBitRate(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? static_cast<int>(encoder->GetDesc().bitRate) : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncode(EncoderId id, ID3D11Texture2D *texture, bool forceIdrFrame, uint64_t timeStamp, uint64_t userData)
 {
     if (const auto &encoder = GetEncoder(id))
     {
-        return encoder->Encode(ComPtr<ID3D11Texture2D>(texture), forceIdrFrame);
+        return encoder->Encode(ComPtr<ID3D11Texture2D>(texture), forceIdrFrame, timeStamp, userData);
     }
     return false;
 }
 
 
-UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncodeSharedHandle(EncoderId id, HANDLE handle, bool forceIdrFrame)
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncodeSharedHandle(EncoderId id, HANDLE handle, bool forceIdrFrame, uint64_t timeStamp, uint64_t userData)
 {
     if (const auto &encoder = GetEncoder(id))
     {
-        return encoder->Encode(handle, forceIdrFrame);
+        return encoder->Encode(handle, forceIdrFrame, timeStamp, userData);
     }
     return false;
 }
 
 
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderStartAnnexBFileSink(EncoderId id, const char *path)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !path) return -1;
+
+    try
+    {
+        return encoder->AddSink(std::make_shared<AnnexBFileSink>(path));
+    }
+    catch (const std::exception&)
+    {
+        return -1;
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderStartMp4FileSink(EncoderId id, const char *path, int fragmentDuration)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !path) return -1;
+
+    Mp4MuxerDesc desc;
+    desc.width = encoder->GetDesc().width;
+    desc.height = encoder->GetDesc().height;
+    desc.frameRate = encoder->GetDesc().frameRate;
+    desc.fragmentDuration = fragmentDuration;
+
+    try
+    {
+        return encoder->AddSink(std::make_shared<MuxerSink>(path, [&](const MuxerOutput &output, const MuxerPatch &)
+        {
+            return std::make_unique<Mp4Muxer>(output, desc);
+        }));
+    }
+    catch (const std::exception&)
+    {
+        return -1;
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderStartMpegTsFileSink(EncoderId id, const char *path)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !path) return -1;
+
+    MpegTsMuxerDesc desc;
+    desc.frameRate = encoder->GetDesc().frameRate;
+
+    try
+    {
+        return encoder->AddSink(std::make_shared<MuxerSink>(path, [&](const MuxerOutput &output, const MuxerPatch &)
+        {
+            return std::make_unique<MpegTsMuxer>(output, desc);
+        }));
+    }
+    catch (const std::exception&)
+    {
+        return -1;
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderStartMatroskaFileSink(EncoderId id, const char *path, int clusterDuration)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !path) return -1;
+
+    MatroskaMuxerDesc desc;
+    desc.width = encoder->GetDesc().width;
+    desc.height = encoder->GetDesc().height;
+    desc.frameRate = encoder->GetDesc().frameRate;
+    desc.clusterDuration = clusterDuration;
+
+    try
+    {
+        return encoder->AddSink(std::make_shared<MuxerSink>(path, [&](const MuxerOutput &output, const MuxerPatch &patch)
+        {
+            return std::make_unique<MatroskaMuxer>(output, desc, patch);
+        }));
+    }
+    catch (const std::exception&)
+    {
+        return -1;
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderStopSink(EncoderId id, int sinkId)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return;
+
+    // Closing a sink waits for its last writes, so leave that to the worker.
+    if (auto sink = encoder->RemoveSink(sinkId))
+    {
+        PostTask([sink]() mutable { sink.reset(); });
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderAddNalUnitStripFilter(EncoderId id, uint32_t typeMask)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return -1;
+
+    return encoder->AddFilter(std::make_shared<NalUnitStripFilter>(typeMask));
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderAddSeiTimeStampFilter(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return -1;
+
+    return encoder->AddFilter(std::make_shared<SeiTimeStampFilter>());
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderRemoveFilter(EncoderId id, int filterId)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return;
+
+    encoder->RemoveFilter(filterId);
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderGetFilterStats(EncoderId id, int filterId, FilterStats *stats)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !stats) return false;
+
+    return encoder->GetFilterStats(filterId, *stats);
+}
+
+
+// Subscribers get the same packets as the queue read by CopyEncodedPackets(),
+// each through its own bounded queue, without copying the payload.
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderSubscribe(EncoderId id, int capacity, BackpressurePolicy policy)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || capacity <= 0) return -1;
+
+    return encoder->Subscribe(static_cast<size_t>(capacity), policy);
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderUnsubscribe(EncoderId id, int subscriberId)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return;
+
+    encoder->Unsubscribe(subscriberId);
+}
+
+
+// The packets stay valid until the next pop or release of the same subscriber.
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderPopSubscribedPackets(EncoderId id, int subscriberId, EncodedPacket *packets, int count)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !packets || count <= 0) return 0;
+
+    return encoder->PopSubscribedPackets(subscriberId, id, packets, count);
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderReleaseSubscribedPackets(EncoderId id, int subscriberId)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return;
+
+    if (const auto subscriber = encoder->GetSubscriber(subscriberId))
+    {
+        subscriber->Release();
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetSubscriberDroppedCount(EncoderId id, int subscriberId)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return 0;
+
+    const auto subscriber = encoder->GetSubscriber(subscriberId);
+    return subscriber ? subscriber->GetDroppedCount() : 0;
+}
+
+
 UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderCopyEncodedData(EncoderId id)
 {
     if (const auto &encoder = GetEncoder(id))
@@ -138,6 +459,43 @@ UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderCopyEncodedData(Encode
 }
 
 
+// Copies out at most count packets and describes them in one call.
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderCopyEncodedPackets(EncoderId id, EncodedPacket *packets, int count)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !packets || count <= 0) return 0;
+
+    encoder->CopyEncodedDataList(static_cast<size_t>(count));
+    return encoder->GetEncodedPackets(id, packets, count);
+}
+
+
+// Same as above for every encoder at once. The packets of all encoders copied
+// by the previous call are released, including those of encoders that get
+// no room this time; their queued packets wait for the next call.
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderCopyAllEncodedPackets(EncodedPacket *packets, int count)
+{
+    if (!packets || count <= 0) return 0;
+
+    int n = 0;
+    g_encoders.ForEach([&](EncoderId id, Encoder &encoder)
+    {
+        encoder.CopyEncodedDataList(static_cast<size_t>(count - n));
+        n += encoder.GetEncodedPackets(id, packets + n, count - n);
+    });
+    return n;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderReleaseEncodedData(EncoderId id)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        encoder->ReleaseEncodedDataList();
+    }
+}
+
+
 UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetEncodedDataCount(EncoderId id)
 {
     const auto &encoder = GetEncoder(id);
@@ -153,7 +511,7 @@ UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetEncodedDataSize(Enco
     const auto &list = encoder->GetEncodedDataList();
     if (index < 0 || index >= static_cast<int>(list.size())) return 0;
 
-    return static_cast<int>(list.at(index).size);
+    return static_cast<int>(list.at(index)->size);
 }
 
 
@@ -165,7 +523,115 @@ UNITY_INTERFACE_EXPORT const void * UNITY_INTERFACE_API uNvEncoderGetEncodedData
     const auto &list = encoder->GetEncodedDataList();
     if (index < 0 || index >= static_cast<int>(list.size())) return nullptr;
 
-    return list.at(index).buffer.get();
+    return list.at(index)->buffer.get();
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderIsEncodedDataLastSlice(EncoderId id, int index)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return false;
+
+    const auto &list = encoder->GetEncodedDataList();
+    if (index < 0 || index >= static_cast<int>(list.size())) return false;
+
+    return list.at(index)->isLastSlice;
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetEncodedDataTimeStamp(EncoderId id, int index)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return 0;
+
+    const auto &list = encoder->GetEncodedDataList();
+    if (index < 0 || index >= static_cast<int>(list.size())) return 0;
+
+    return list.at(index)->timeStamp;
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetEncodedDataUserData(EncoderId id, int index)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return 0;
+
+    const auto &list = encoder->GetEncodedDataList();
+    if (index < 0 || index >= static_cast<int>(list.size())) return 0;
+
+    return list.at(index)->userData;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderGetEncodedDataTimes(EncoderId id, int index, uint64_t *submitTime, uint64_t *completeTime, uint64_t *drainTime)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return false;
+
+    const auto &list = encoder->GetEncodedDataList();
+    if (index < 0 || index >= static_cast<int>(list.size())) return false;
+
+    const auto &ed = *list.at(index);
+    if (submitTime) *submitTime = ed.submitTime;
+    if (completeTime) *completeTime = ed.completeTime;
+    if (drainTime) *drainTime = encoder->GetEncodedDataDrainTime();
+    return true;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderGetEncodedDataInfo(EncoderId id, int index, EncodedDataInfo *info)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !info) return false;
+
+    return encoder->GetEncodedDataInfo(index, *info);
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetEncodedDataNalUnits(EncoderId id, int index, NalUnit *units, int maxCount)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return -1;
+
+    return encoder->GetEncodedDataNalUnits(index, units, units ? maxCount : 0);
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetSequenceParams(EncoderId id, uint8_t *buffer, int bufferSize)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return 0;
+
+    return encoder->GetSequenceParams(buffer, bufferSize);
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderGetParameterSetInfo(EncoderId id, ParameterSetInfo *info)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !info) return false;
+
+    return encoder->GetParameterSetInfo(*info);
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetClockMicroseconds()
+{
+    return GetClockMicroseconds();
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetDroppedFrameCount(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetDroppedFrameCount() : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetDroppedEncodedDataCount(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetDroppedEncodedDataCount() : 0;
 }
 
 
@@ -0,0 +1,375 @@
+#include <cstring>
+#include <algorithm>
+#include "MatroskaMuxer.h"
+#include "ByteWriter.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    // Block timestamps are in milliseconds (TimestampScale = 1000000 ns).
+    constexpr uint32_t timeScale = 1000;
+    constexpr uint64_t trackNumber = 1;
+    constexpr int64_t maxBlockOffset = 32767;
+
+    constexpr uint32_t ebmlId = 0x1A45DFA3;
+    constexpr uint32_t ebmlVersionId = 0x4286;
+    constexpr uint32_t ebmlReadVersionId = 0x42F7;
+    constexpr uint32_t ebmlMaxIdLengthId = 0x42F2;
+    constexpr uint32_t ebmlMaxSizeLengthId = 0x42F3;
+    constexpr uint32_t docTypeId = 0x4282;
+    constexpr uint32_t docTypeVersionId = 0x4287;
+    constexpr uint32_t docTypeReadVersionId = 0x4285;
+    constexpr uint32_t segmentId = 0x18538067;
+    constexpr uint32_t seekHeadId = 0x114D9B74;
+    constexpr uint32_t seekId = 0x4DBB;
+    constexpr uint32_t seekIdId = 0x53AB;
+    constexpr uint32_t seekPositionId = 0x53AC;
+    constexpr uint32_t voidId = 0xEC;
+    constexpr uint32_t infoId = 0x1549A966;
+    constexpr uint32_t timestampScaleId = 0x2AD7B1;
+    constexpr uint32_t muxingAppId = 0x4D80;
+    constexpr uint32_t writingAppId = 0x5741;
+    constexpr uint32_t tracksId = 0x1654AE6B;
+    constexpr uint32_t trackEntryId = 0xAE;
+    constexpr uint32_t trackNumberId = 0xD7;
+    constexpr uint32_t trackUidId = 0x73C5;
+    constexpr uint32_t trackTypeId = 0x83;
+    constexpr uint32_t flagLacingId = 0x9C;
+    constexpr uint32_t defaultDurationId = 0x23E383;
+    constexpr uint32_t codecId = 0x86;
+    constexpr uint32_t codecPrivateId = 0x63A2;
+    constexpr uint32_t videoId = 0xE0;
+    constexpr uint32_t pixelWidthId = 0xB0;
+    constexpr uint32_t pixelHeightId = 0xBA;
+    constexpr uint32_t clusterId = 0x1F43B675;
+    constexpr uint32_t timestampId = 0xE7;
+    constexpr uint32_t simpleBlockId = 0xA3;
+    constexpr uint32_t cuesId = 0x1C53BB6B;
+    constexpr uint32_t cuePointId = 0xBB;
+    constexpr uint32_t cueTimeId = 0xB3;
+    constexpr uint32_t cueTrackPositionsId = 0xB7;
+    constexpr uint32_t cueTrackId = 0xF7;
+    constexpr uint32_t cueClusterPositionId = 0xF1;
+
+    constexpr uint64_t unknownSize = 0x00FFFFFFFFFFFFFF;
+    constexpr size_t masterSizeLength = 8;
+
+    // Room for a SeekHead with three entries (96 bytes at most) and the Void
+    // element that pads it.
+    constexpr size_t seekHeadSize = 128; // [byte]
+    constexpr size_t voidHeaderSize = 1 + 8; // [byte]
+
+    size_t GetIdLength(uint32_t id)
+    {
+        return id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+    }
+
+    // Element IDs keep their length marker, so they are written as is.
+    void WriteId(ByteWriter &writer, uint32_t id)
+    {
+        if (id > 0xFFFFFF) writer.U8(static_cast<uint8_t>(id >> 24));
+        if (id > 0xFFFF) writer.U8(static_cast<uint8_t>(id >> 16));
+        if (id > 0xFF) writer.U8(static_cast<uint8_t>(id >> 8));
+        writer.U8(static_cast<uint8_t>(id));
+    }
+
+    void WriteSize(ByteWriter &writer, uint64_t size, size_t length)
+    {
+        for (size_t i = length; i > 0; --i)
+        {
+            auto byte = static_cast<uint8_t>(size >> ((i - 1) * 8));
+            if (i == length) byte |= static_cast<uint8_t>(0x80 >> (length - 1));
+            writer.U8(byte);
+        }
+    }
+
+    void WriteSize(ByteWriter &writer, uint64_t size)
+    {
+        // All ones is reserved for "unknown", hence the - 1.
+        size_t length = 1;
+        while (length < 8 && size >= (1ULL << (7 * length)) - 1) ++length;
+        WriteSize(writer, size, length);
+    }
+
+    void WriteUInt(ByteWriter &writer, uint32_t id, uint64_t value)
+    {
+        size_t length = 1;
+        while (length < 8 && (value >> (8 * length)) != 0) ++length;
+
+        WriteId(writer, id);
+        WriteSize(writer, length);
+        for (size_t i = length; i > 0; --i)
+        {
+            writer.U8(static_cast<uint8_t>(value >> ((i - 1) * 8)));
+        }
+    }
+
+    void WriteBinary(ByteWriter &writer, uint32_t id, const void *data, size_t size)
+    {
+        WriteId(writer, id);
+        WriteSize(writer, size);
+        writer.Bytes(data, size);
+    }
+
+    void WriteString(ByteWriter &writer, uint32_t id, const char *value)
+    {
+        WriteBinary(writer, id, value, ::strlen(value));
+    }
+
+    size_t BeginMaster(ByteWriter &writer, uint32_t id)
+    {
+        WriteId(writer, id);
+        const auto offset = writer.GetSize();
+        writer.Zeros(masterSizeLength);
+        return offset;
+    }
+
+    void EndMaster(std::vector<uint8_t> &buffer, size_t offset)
+    {
+        const auto size = buffer.size() - offset - masterSizeLength;
+        buffer[offset] = 0x01;
+        for (size_t i = 1; i < masterSizeLength; ++i)
+        {
+            buffer[offset + i] = static_cast<uint8_t>(size >> ((masterSizeLength - 1 - i) * 8));
+        }
+    }
+
+    void WriteSeek(ByteWriter &writer, std::vector<uint8_t> &buffer, uint32_t id, uint64_t position)
+    {
+        const auto seek = BeginMaster(writer, seekId);
+        WriteId(writer, seekIdId);
+        WriteSize(writer, GetIdLength(id));
+        WriteId(writer, id);
+        WriteUInt(writer, seekPositionId, position);
+        EndMaster(buffer, seek);
+    }
+}
+
+
+MatroskaMuxer::MatroskaMuxer(const MuxerOutput &output, const MatroskaMuxerDesc &desc, const MuxerPatch &patch)
+    : output_(output)
+    , patch_(patch)
+    , desc_(desc)
+    , clock_(timeScale, desc.frameRate)
+{
+}
+
+
+void MatroskaMuxer::Write(const MuxerPacket &packet)
+{
+    // Slices of one frame are gathered into a single block.
+    if (!packet.isLastSlice || !frame_.empty())
+    {
+        if (frame_.empty()) nalUnits_.clear();
+        const auto offset = static_cast<uint32_t>(frame_.size());
+        AppendNalUnits(packet.data, packet.size, packet.nalIndex, offset, nalUnits_);
+        frame_.insert(frame_.end(), packet.data, packet.data + packet.size);
+        if (!packet.isLastSlice) return;
+
+        AddFrame(frame_.data(), packet.timeStamp, packet.isIdrFrame, packet.isRecoveryPoint);
+        frame_.clear();
+        return;
+    }
+
+    nalUnits_.clear();
+    AppendNalUnits(packet.data, packet.size, packet.nalIndex, 0, nalUnits_);
+    AddFrame(packet.data, packet.timeStamp, packet.isIdrFrame, packet.isRecoveryPoint);
+}
+
+
+void MatroskaMuxer::Close()
+{
+    if (cuePoints_.empty()) return;
+
+    // Cues is a top-level element, so it also ends the last unknown-size
+    // cluster for readers.
+    const auto cuesPosition = segmentPosition_;
+    buffer_.clear();
+    ByteWriter writer(buffer_);
+    const auto cues = BeginMaster(writer, cuesId);
+    for (const auto &cuePoint : cuePoints_)
+    {
+        const auto point = BeginMaster(writer, cuePointId);
+        WriteUInt(writer, cueTimeId, cuePoint.time);
+        const auto positions = BeginMaster(writer, cueTrackPositionsId);
+        WriteUInt(writer, cueTrackId, trackNumber);
+        WriteUInt(writer, cueClusterPositionId, cuePoint.position);
+        EndMaster(buffer_, positions);
+        EndMaster(buffer_, point);
+    }
+    EndMaster(buffer_, cues);
+    Output();
+
+    if (patch_)
+    {
+        BuildSeekHead(cuesPosition);
+        patch_(segmentDataOffset_, seekHead_.data(), seekHead_.size());
+    }
+
+    cuePoints_.clear();
+}
+
+
+void MatroskaMuxer::AddFrame(const uint8_t *data, uint64_t timeStamp, bool isIdrFrame, bool isRecoveryPoint)
+{
+    if (!isInitialized_)
+    {
+        if (!isIdrFrame || !WriteHeader(data)) return;
+        isInitialized_ = true;
+    }
+
+    const auto time = clock_.ToTime(timeStamp);
+
+    buffer_.clear();
+    ByteWriter writer(buffer_);
+
+    const auto clusterDuration = static_cast<uint64_t>(desc_.clusterDuration);
+    const auto offset = time - clusterTime_;
+    const bool isClusterFull = 
+        offset > static_cast<uint64_t>(maxBlockOffset) || 
+        (clusterDuration > 0 && offset >= clusterDuration);
+    // A recovery point is where a decoder joins an intra refresh stream, so
+    // it is marked and indexed like an IDR frame.
+    const bool isKeyFrame = isIdrFrame || isRecoveryPoint;
+    if (!hasCluster_ || isKeyFrame || isClusterFull)
+    {
+        if (isKeyFrame)
+        {
+            CuePoint cuePoint;
+            cuePoint.time = time;
+            cuePoint.position = segmentPosition_;
+            cuePoints_.push_back(cuePoint);
+        }
+
+        WriteId(writer, clusterId);
+        WriteSize(writer, unknownSize, 8);
+        WriteUInt(writer, timestampId, time);
+        clusterTime_ = time;
+        hasCluster_ = true;
+    }
+
+    // Parameter sets live in CodecPrivate, so the block only carries the
+    // slices and SEI, each prefixed by its 4-byte length.
+    uint64_t payloadSize = 0;
+    for (const auto &unit : nalUnits_)
+    {
+        if (IsParameterSetOrDelimiter(unit.type)) continue;
+        payloadSize += 4 + unit.size;
+    }
+
+    const auto blockOffset = static_cast<int16_t>(time - clusterTime_);
+    WriteId(writer, simpleBlockId);
+    WriteSize(writer, 4 + payloadSize);
+    WriteSize(writer, trackNumber, 1);
+    writer.U16(static_cast<uint16_t>(blockOffset));
+    writer.U8(isKeyFrame ? 0x80 : 0x00);
+    for (const auto &unit : nalUnits_)
+    {
+        if (IsParameterSetOrDelimiter(unit.type)) continue;
+        writer.U32(unit.size);
+        writer.Bytes(data + unit.offset, unit.size);
+    }
+
+    Output();
+}
+
+
+bool MatroskaMuxer::WriteHeader(const uint8_t *data)
+{
+    if (!BuildAvcDecoderConfigurationRecord(data, nalUnits_, avcConfig_)) return false;
+
+    buffer_.clear();
+    ByteWriter writer(buffer_);
+
+    const auto ebml = BeginMaster(writer, ebmlId);
+    WriteUInt(writer, ebmlVersionId, 1);
+    WriteUInt(writer, ebmlReadVersionId, 1);
+    WriteUInt(writer, ebmlMaxIdLengthId, 4);
+    WriteUInt(writer, ebmlMaxSizeLengthId, 8);
+    WriteString(writer, docTypeId, "matroska");
+    WriteUInt(writer, docTypeVersionId, 4);
+    WriteUInt(writer, docTypeReadVersionId, 2);
+    EndMaster(buffer_, ebml);
+
+    WriteId(writer, segmentId);
+    WriteSize(writer, unknownSize, 8);
+    const auto segmentDataOffset = writer.GetSize();
+    writer.Zeros(seekHeadSize);
+
+    infoPosition_ = writer.GetSize() - segmentDataOffset;
+    const auto info = BeginMaster(writer, infoId);
+    WriteUInt(writer, timestampScaleId, 1000000000 / timeScale);
+    WriteString(writer, muxingAppId, "uNvEncoder");
+    WriteString(writer, writingAppId, "uNvEncoder");
+    EndMaster(buffer_, info);
+
+    tracksPosition_ = writer.GetSize() - segmentDataOffset;
+    const auto tracks = BeginMaster(writer, tracksId);
+    {
+        const auto entry = BeginMaster(writer, trackEntryId);
+        WriteUInt(writer, trackNumberId, trackNumber);
+        WriteUInt(writer, trackUidId, trackNumber);
+        WriteUInt(writer, trackTypeId, 1);
+        WriteUInt(writer, flagLacingId, 0);
+        if (desc_.frameRate > 0)
+        {
+            WriteUInt(writer, defaultDurationId, 1000000000ULL / static_cast<uint64_t>(desc_.frameRate));
+        }
+        WriteString(writer, codecId, "V_MPEG4/ISO/AVC");
+        WriteBinary(writer, codecPrivateId, avcConfig_.data(), avcConfig_.size());
+
+        const auto video = BeginMaster(writer, videoId);
+        WriteUInt(writer, pixelWidthId, static_cast<uint64_t>(desc_.width));
+        WriteUInt(writer, pixelHeightId, static_cast<uint64_t>(desc_.height));
+        EndMaster(buffer_, video);
+
+        EndMaster(buffer_, entry);
+    }
+    EndMaster(buffer_, tracks);
+
+    // The position of Cues is not known until Close().
+    BuildSeekHead(0);
+    std::copy(seekHead_.begin(), seekHead_.end(), buffer_.begin() + segmentDataOffset);
+
+    output_(buffer_.data(), buffer_.size());
+    segmentDataOffset_ = segmentDataOffset;
+    segmentPosition_ = buffer_.size() - segmentDataOffset;
+    return true;
+}
+
+
+// Always seekHeadSize bytes, so that Close() can rewrite it in place.
+// cuesPosition is 0 while there are no cues yet.
+void MatroskaMuxer::BuildSeekHead(uint64_t cuesPosition)
+{
+    seekHead_.clear();
+    ByteWriter writer(seekHead_);
+
+    const auto seekHead = BeginMaster(writer, seekHeadId);
+    WriteSeek(writer, seekHead_, infoId, infoPosition_);
+    WriteSeek(writer, seekHead_, tracksId, tracksPosition_);
+    if (cuesPosition > 0)
+    {
+        WriteSeek(writer, seekHead_, cuesId, cuesPosition);
+    }
+    EndMaster(seekHead_, seekHead);
+
+    const auto voidSize = seekHeadSize - writer.GetSize() - voidHeaderSize;
+    WriteId(writer, voidId);
+    WriteSize(writer, voidSize, 8);
+    writer.Zeros(voidSize);
+}
+
+
+void MatroskaMuxer::Output()
+{
+    output_(buffer_.data(), buffer_.size());
+    segmentPosition_ += buffer_.size();
+}
+
+
+}
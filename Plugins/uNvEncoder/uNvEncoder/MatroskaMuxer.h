@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include "Muxer.h"
+#include "AnnexB.h"
+
+
+namespace uNvEncoder
+{
+
+
+struct MatroskaMuxerDesc
+{
+    int width = 1920;
+    int height = 1080;
+    int frameRate = 60;
+    int clusterDuration = 5000; // [ms], clusters are also started at IDR frames and recovery points
+};
+
+
+// Live Matroska writer for a single H.264 track. The segment and its
+// clusters are written with unknown sizes so that the file stays playable up
+// to the last complete block if the process dies, and a cues index for the
+// clusters started at IDR frames and recovery points is appended when the
+// muxer is closed. Each frame is handed to the output as one buffer,
+// together with the cluster header when it opens a new cluster.
+// The segment opens with a SeekHead padded by a Void element. It points at
+// Info and Tracks from the start, and at Cues too once Close() has rewritten
+// it through patch; without patch, readers find Cues by scanning.
+class MatroskaMuxer final : public Muxer
+{
+public:
+    MatroskaMuxer(const MuxerOutput &output, const MatroskaMuxerDesc &desc, const MuxerPatch &patch = nullptr);
+    void Write(const MuxerPacket &packet) override;
+    void Close() override;
+
+private:
+    struct CuePoint
+    {
+        uint64_t time;
+        uint64_t position;
+    };
+
+    void AddFrame(const uint8_t *data, uint64_t timeStamp, bool isIdrFrame, bool isRecoveryPoint);
+    bool WriteHeader(const uint8_t *data);
+    void BuildSeekHead(uint64_t cuesPosition);
+    void Output();
+
+    const MuxerOutput output_;
+    const MuxerPatch patch_;
+    const MatroskaMuxerDesc desc_;
+    MuxerClock clock_;
+    bool isInitialized_ = false;
+    bool hasCluster_ = false;
+    uint64_t clusterTime_ = 0;
+    uint64_t segmentPosition_ = 0;
+    // Offset of the segment data in the output; *Position values are
+    // relative to it.
+    uint64_t segmentDataOffset_ = 0;
+    uint64_t infoPosition_ = 0;
+    uint64_t tracksPosition_ = 0;
+    std::vector<uint8_t> seekHead_;
+    std::vector<NalUnit> nalUnits_;
+    std::vector<uint8_t> frame_;
+    std::vector<uint8_t> buffer_;
+    std::vector<uint8_t> avcConfig_;
+    std::vector<CuePoint> cuePoints_;
+};
+
+
+}
@@ -0,0 +1,328 @@
+#include "Mp4Muxer.h"
+#include "ByteWriter.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    constexpr uint32_t timeScale = 90000;
+    constexpr uint32_t trackId = 1;
+    constexpr uint32_t syncSampleFlags = 0x02000000;
+    constexpr uint32_t nonSyncSampleFlags = 0x01010000;
+
+    size_t BeginBox(ByteWriter &writer, const char *type)
+    {
+        const auto offset = writer.GetSize();
+        writer.U32(0);
+        writer.FourCC(type);
+        return offset;
+    }
+
+    size_t BeginFullBox(ByteWriter &writer, const char *type, uint8_t version, uint32_t flags)
+    {
+        const auto offset = BeginBox(writer, type);
+        writer.U8(version);
+        writer.U24(flags);
+        return offset;
+    }
+
+    void EndBox(ByteWriter &writer, size_t offset)
+    {
+        writer.PatchU32(offset, static_cast<uint32_t>(writer.GetSize() - offset));
+    }
+
+    void WriteMatrix(ByteWriter &writer)
+    {
+        constexpr uint32_t matrix[] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+        for (const auto value : matrix) writer.U32(value);
+    }
+}
+
+
+Mp4Muxer::Mp4Muxer(const MuxerOutput &output, const Mp4MuxerDesc &desc)
+    : output_(output)
+    , desc_(desc)
+    , clock_(timeScale, desc.frameRate)
+{
+}
+
+
+void Mp4Muxer::Write(const MuxerPacket &packet)
+{
+    // Slices of one frame are gathered into a single sample.
+    if (!packet.isLastSlice || !frame_.empty())
+    {
+        if (frame_.empty()) nalUnits_.clear();
+        const auto offset = static_cast<uint32_t>(frame_.size());
+        AppendNalUnits(packet.data, packet.size, packet.nalIndex, offset, nalUnits_);
+        frame_.insert(frame_.end(), packet.data, packet.data + packet.size);
+        if (!packet.isLastSlice) return;
+
+        AddFrame(frame_.data(), packet.timeStamp, packet.isIdrFrame, packet.isRecoveryPoint);
+        frame_.clear();
+        return;
+    }
+
+    nalUnits_.clear();
+    AppendNalUnits(packet.data, packet.size, packet.nalIndex, 0, nalUnits_);
+    AddFrame(packet.data, packet.timeStamp, packet.isIdrFrame, packet.isRecoveryPoint);
+}
+
+
+void Mp4Muxer::Close()
+{
+    if (!samples_.empty())
+    {
+        WriteFragment(clock_.GetLastTime() + clock_.GetFrameDuration());
+    }
+}
+
+
+void Mp4Muxer::AddFrame(const uint8_t *data, uint64_t timeStamp, bool isIdrFrame, bool isRecoveryPoint)
+{
+    if (!isInitialized_)
+    {
+        if (!isIdrFrame || !WriteInitSegment(data)) return;
+        isInitialized_ = true;
+    }
+
+    const auto time = clock_.ToTime(timeStamp);
+
+    // Players seek to sync samples, and with intra refresh the recovery
+    // points are the only ones after the first frame.
+    const bool isSync = isIdrFrame || isRecoveryPoint;
+    if (!samples_.empty())
+    {
+        const auto fragmentDuration = static_cast<uint64_t>(desc_.fragmentDuration) * timeScale / 1000;
+        const auto isFragmentFull = fragmentDuration > 0 && time - samples_.front().time >= fragmentDuration;
+        if (isSync || isFragmentFull)
+        {
+            WriteFragment(time);
+        }
+    }
+
+    // Parameter sets live in avcC, so only the slices and SEI go into mdat,
+    // each prefixed by its 4-byte length.
+    ByteWriter writer(mdat_);
+    const auto offset = writer.GetSize();
+    for (const auto &unit : nalUnits_)
+    {
+        if (IsParameterSetOrDelimiter(unit.type)) continue;
+        writer.U32(unit.size);
+        writer.Bytes(data + unit.offset, unit.size);
+    }
+
+    Sample sample;
+    sample.time = time;
+    sample.size = static_cast<uint32_t>(writer.GetSize() - offset);
+    sample.isSync = isSync;
+    samples_.push_back(sample);
+}
+
+
+bool Mp4Muxer::WriteInitSegment(const uint8_t *data)
+{
+    if (!BuildAvcDecoderConfigurationRecord(data, nalUnits_, avcConfig_)) return false;
+
+    const auto width = static_cast<uint32_t>(desc_.width);
+    const auto height = static_cast<uint32_t>(desc_.height);
+
+    header_.clear();
+    ByteWriter writer(header_);
+
+    const auto ftyp = BeginBox(writer, "ftyp");
+    writer.FourCC("iso6");
+    writer.U32(0);
+    writer.FourCC("iso6");
+    writer.FourCC("cmfc");
+    writer.FourCC("avc1");
+    writer.FourCC("mp41");
+    EndBox(writer, ftyp);
+
+    const auto moov = BeginBox(writer, "moov");
+    {
+        const auto mvhd = BeginFullBox(writer, "mvhd", 0, 0);
+        writer.U32(0);
+        writer.U32(0);
+        writer.U32(1000);
+        writer.U32(0);
+        writer.U32(0x00010000);
+        writer.U16(0x0100);
+        writer.Zeros(10);
+        WriteMatrix(writer);
+        writer.Zeros(24);
+        writer.U32(trackId + 1);
+        EndBox(writer, mvhd);
+
+        const auto trak = BeginBox(writer, "trak");
+        {
+            const auto tkhd = BeginFullBox(writer, "tkhd", 0, 3);
+            writer.U32(0);
+            writer.U32(0);
+            writer.U32(trackId);
+            writer.U32(0);
+            writer.U32(0);
+            writer.Zeros(8);
+            writer.U16(0);
+            writer.U16(0);
+            writer.U16(0);
+            writer.U16(0);
+            WriteMatrix(writer);
+            writer.U32(width << 16);
+            writer.U32(height << 16);
+            EndBox(writer, tkhd);
+
+            const auto mdia = BeginBox(writer, "mdia");
+            {
+                const auto mdhd = BeginFullBox(writer, "mdhd", 0, 0);
+                writer.U32(0);
+                writer.U32(0);
+                writer.U32(timeScale);
+                writer.U32(0);
+                writer.U16(0x55C4); // "und"
+                writer.U16(0);
+                EndBox(writer, mdhd);
+
+                const auto hdlr = BeginFullBox(writer, "hdlr", 0, 0);
+                writer.U32(0);
+                writer.FourCC("vide");
+                writer.Zeros(12);
+                writer.Bytes("VideoHandler", 13);
+                EndBox(writer, hdlr);
+
+                const auto minf = BeginBox(writer, "minf");
+                {
+                    const auto vmhd = BeginFullBox(writer, "vmhd", 0, 1);
+                    writer.Zeros(8);
+                    EndBox(writer, vmhd);
+
+                    const auto dinf = BeginBox(writer, "dinf");
+                    const auto dref = BeginFullBox(writer, "dref", 0, 0);
+                    writer.U32(1);
+                    const auto url = BeginFullBox(writer, "url ", 0, 1);
+                    EndBox(writer, url);
+                    EndBox(writer, dref);
+                    EndBox(writer, dinf);
+
+                    const auto stbl = BeginBox(writer, "stbl");
+                    {
+                        const auto stsd = BeginFullBox(writer, "stsd", 0, 0);
+                        writer.U32(1);
+                        const auto avc1 = BeginBox(writer, "avc1");
+                        writer.Zeros(6);
+                        writer.U16(1);
+                        writer.Zeros(16);
+                        writer.U16(static_cast<uint16_t>(width));
+                        writer.U16(static_cast<uint16_t>(height));
+                        writer.U32(0x00480000);
+                        writer.U32(0x00480000);
+                        writer.U32(0);
+                        writer.U16(1);
+                        writer.Zeros(32);
+                        writer.U16(0x0018);
+                        writer.U16(0xFFFF);
+
+                        const auto avcC = BeginBox(writer, "avcC");
+                        writer.Bytes(avcConfig_.data(), avcConfig_.size());
+                        EndBox(writer, avcC);
+
+                        EndBox(writer, avc1);
+                        EndBox(writer, stsd);
+
+                        for (const auto type : { "stts", "stsc", "stco" })
+                        {
+                            const auto box = BeginFullBox(writer, type, 0, 0);
+                            writer.U32(0);
+                            EndBox(writer, box);
+                        }
+
+                        const auto stsz = BeginFullBox(writer, "stsz", 0, 0);
+                        writer.U32(0);
+                        writer.U32(0);
+                        EndBox(writer, stsz);
+                    }
+                    EndBox(writer, stbl);
+                }
+                EndBox(writer, minf);
+            }
+            EndBox(writer, mdia);
+        }
+        EndBox(writer, trak);
+
+        const auto mvex = BeginBox(writer, "mvex");
+        const auto trex = BeginFullBox(writer, "trex", 0, 0);
+        writer.U32(trackId);
+        writer.U32(1);
+        writer.U32(0);
+        writer.U32(0);
+        writer.U32(0);
+        EndBox(writer, trex);
+        EndBox(writer, mvex);
+    }
+    EndBox(writer, moov);
+
+    output_(header_.data(), header_.size());
+    return true;
+}
+
+
+void Mp4Muxer::WriteFragment(uint64_t endTime)
+{
+    header_.clear();
+    ByteWriter writer(header_);
+    size_t dataOffset = 0;
+
+    const auto moof = BeginBox(writer, "moof");
+    {
+        const auto mfhd = BeginFullBox(writer, "mfhd", 0, 0);
+        writer.U32(++sequenceNumber_);
+        EndBox(writer, mfhd);
+
+        const auto traf = BeginBox(writer, "traf");
+        {
+            // default-base-is-moof
+            const auto tfhd = BeginFullBox(writer, "tfhd", 0, 0x020000);
+            writer.U32(trackId);
+            EndBox(writer, tfhd);
+
+            const auto tfdt = BeginFullBox(writer, "tfdt", 1, 0);
+            writer.U64(samples_.front().time);
+            EndBox(writer, tfdt);
+
+            // data-offset, sample-duration, sample-size and sample-flags present
+            const auto trun = BeginFullBox(writer, "trun", 0, 0x000701);
+            writer.U32(static_cast<uint32_t>(samples_.size()));
+            dataOffset = writer.GetSize();
+            writer.U32(0);
+            for (size_t i = 0; i < samples_.size(); ++i)
+            {
+                const auto &sample = samples_[i];
+                const auto nextTime = i + 1 < samples_.size() ? samples_[i + 1].time : endTime;
+                writer.U32(static_cast<uint32_t>(nextTime - sample.time));
+                writer.U32(sample.size);
+                writer.U32(sample.isSync ? syncSampleFlags : nonSyncSampleFlags);
+            }
+            EndBox(writer, trun);
+        }
+        EndBox(writer, traf);
+    }
+    EndBox(writer, moof);
+
+    // The samples start right after the mdat header that follows moof.
+    writer.PatchU32(dataOffset, static_cast<uint32_t>(writer.GetSize() - moof + 8));
+
+    writer.U32(static_cast<uint32_t>(mdat_.size() + 8));
+    writer.FourCC("mdat");
+
+    output_(header_.data(), header_.size());
+    output_(mdat_.data(), mdat_.size());
+
+    samples_.clear();
+    mdat_.clear();
+}
+
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include "Muxer.h"
+#include "AnnexB.h"
+
+
+namespace uNvEncoder
+{
+
+
+struct Mp4MuxerDesc
+{
+    int width = 1920;
+    int height = 1080;
+    int frameRate = 60;
+    int fragmentDuration = 1000; // [ms], 0 cuts fragments at IDR frames and recovery points only
+};
+
+
+// Fragmented MP4 (CMAF style) writer for a single H.264 track. The init
+// segment is built from the SPS/PPS of the first IDR frame, and a fragment
+// is written at every IDR frame and recovery point, which are the sync
+// samples, or once fragmentDuration has passed.
+class Mp4Muxer final : public Muxer
+{
+public:
+    Mp4Muxer(const MuxerOutput &output, const Mp4MuxerDesc &desc);
+    void Write(const MuxerPacket &packet) override;
+    void Close() override;
+
+private:
+    struct Sample
+    {
+        uint64_t time;
+        uint32_t size;
+        bool isSync;
+    };
+
+    void AddFrame(const uint8_t *data, uint64_t timeStamp, bool isIdrFrame, bool isRecoveryPoint);
+    bool WriteInitSegment(const uint8_t *data);
+    void WriteFragment(uint64_t endTime);
+
+    const MuxerOutput output_;
+    const Mp4MuxerDesc desc_;
+    MuxerClock clock_;
+    bool isInitialized_ = false;
+    uint32_t sequenceNumber_ = 0;
+    std::vector<NalUnit> nalUnits_;
+    std::vector<uint8_t> frame_;
+    std::vector<Sample> samples_;
+    std::vector<uint8_t> mdat_;
+    std::vector<uint8_t> header_;
+    std::vector<uint8_t> avcConfig_;
+};
+
+
+}
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <cstring>
+#include "MpegTsMuxer.h"
+#include "AnnexB.h"
+#include "ByteWriter.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    constexpr size_t tsPacketSize = 188;
+    constexpr uint32_t timeScale = 90000;
+    constexpr uint16_t patPid = 0x0000;
+    constexpr uint16_t pmtPid = 0x1000;
+    constexpr uint16_t videoPid = 0x0100;
+    constexpr uint8_t h264StreamType = 0x1B;
+    constexpr uint8_t videoStreamId = 0xE0;
+    constexpr uint64_t psiInterval = timeScale / 10;
+
+    // ISO/IEC 13818-1 allows at most 100 ms between PCRs.
+    constexpr uint64_t pcrInterval = timeScale / 10;
+
+    // PTS runs ahead of PCR so that decoders have some room to buffer.
+    constexpr uint64_t ptsDelay = timeScale * 7 / 10;
+
+    const uint8_t accessUnitDelimiter[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+
+    uint32_t CalcCrc32(const uint8_t *data, size_t size)
+    {
+        static const auto table = []
+        {
+            std::vector<uint32_t> t(256);
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                auto crc = i << 24;
+                for (int j = 0; j < 8; ++j)
+                {
+                    crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+                }
+                t[i] = crc;
+            }
+            return t;
+        }();
+
+        uint32_t crc = 0xFFFFFFFF;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xFF];
+        }
+        return crc;
+    }
+
+    void WriteTimeStamp(uint8_t *dst, uint8_t prefix, uint64_t ts)
+    {
+        dst[0] = static_cast<uint8_t>((prefix << 4) | ((ts >> 29) & 0x0E) | 0x01);
+        dst[1] = static_cast<uint8_t>(ts >> 22);
+        dst[2] = static_cast<uint8_t>(((ts >> 14) & 0xFE) | 0x01);
+        dst[3] = static_cast<uint8_t>(ts >> 7);
+        dst[4] = static_cast<uint8_t>(((ts << 1) & 0xFE) | 0x01);
+    }
+
+    // Writes the flags byte and program_clock_reference of an adaptation field.
+    void WritePcrField(uint8_t *dst, uint64_t base, bool isRandomAccess)
+    {
+        dst[0] = static_cast<uint8_t>(0x10 | (isRandomAccess ? 0x40 : 0x00));
+        dst[1] = static_cast<uint8_t>(base >> 25);
+        dst[2] = static_cast<uint8_t>(base >> 17);
+        dst[3] = static_cast<uint8_t>(base >> 9);
+        dst[4] = static_cast<uint8_t>(base >> 1);
+        dst[5] = static_cast<uint8_t>(((base & 1) << 7) | 0x7E);
+        dst[6] = 0x00;
+    }
+
+    bool StartsWithAccessUnitDelimiter(const MuxerPacket &packet)
+    {
+        const auto index = packet.nalIndex;
+        if (index && index->isComplete)
+        {
+            return index->count > 0 && index->units[0].type == NalUnitTypeAud;
+        }
+
+        const auto data = packet.data;
+        const auto end = data + packet.size;
+        const auto startCode = FindStartCode(data, end);
+        return startCode + 3 < end && (startCode[3] & 0x1F) == NalUnitTypeAud;
+    }
+}
+
+
+MpegTsMuxer::MpegTsMuxer(const MuxerOutput &output, const MpegTsMuxerDesc &desc)
+    : output_(output)
+    , clock_(timeScale, desc.frameRate)
+{
+    packets_.reserve(tsPacketSize * 64);
+}
+
+
+void MpegTsMuxer::Write(const MuxerPacket &packet)
+{
+    if (!hasIdrFrame_)
+    {
+        if (!packet.isIdrFrame) return;
+        hasIdrFrame_ = true;
+    }
+
+    if (isInFrame_)
+    {
+        // Following slices of the same frame continue the open PES packet.
+        WritePayload(videoPid, videoContinuityCounter_, nullptr, 0, packet.data, packet.size, nullptr);
+    }
+    else
+    {
+        const auto time = clock_.ToTime(packet.timeStamp);
+        if (packet.isIdrFrame || !hasPsi_ || time - lastPsiTime_ >= psiInterval)
+        {
+            WritePsi();
+            lastPsiTime_ = time;
+            hasPsi_ = true;
+        }
+
+        // PES packet length 0 means unbounded, which is allowed for video and
+        // lets sub-frame slices be sent before the frame size is known.
+        uint8_t header[14 + sizeof(accessUnitDelimiter)] = 
+        { 
+            0x00, 0x00, 0x01, videoStreamId, 0x00, 0x00, 0x80, 0x80, 0x05, 
+        };
+        WriteTimeStamp(header + 9, 0x2, time + ptsDelay);
+        size_t headerSize = 14;
+        if (!StartsWithAccessUnitDelimiter(packet))
+        {
+            ::memcpy(header + headerSize, accessUnitDelimiter, sizeof(accessUnitDelimiter));
+            headerSize += sizeof(accessUnitDelimiter);
+        }
+
+        // Frames further apart than the PCR interval (low frame rates,
+        // paused capture) get PCR-only packets in between.
+        while (hasPcr_ && time > lastPcrBase_ + pcrInterval)
+        {
+            lastPcrBase_ += pcrInterval;
+            WritePcr(videoPid, static_cast<uint8_t>(videoContinuityCounter_ - 1), lastPcrBase_);
+        }
+        lastPcrBase_ = time;
+        hasPcr_ = true;
+
+        const Pcr pcr = { time, packet.isIdrFrame };
+        WritePayload(videoPid, videoContinuityCounter_, header, headerSize, packet.data, packet.size, &pcr);
+    }
+
+    isInFrame_ = !packet.isLastSlice;
+
+    output_(packets_.data(), packets_.size());
+    packets_.clear();
+}
+
+
+void MpegTsMuxer::Close()
+{
+    if (packets_.empty()) return;
+
+    output_(packets_.data(), packets_.size());
+    packets_.clear();
+}
+
+
+void MpegTsMuxer::WritePsi()
+{
+    {
+        section_.clear();
+        ByteWriter writer(section_);
+        writer.U8(0x00);
+        writer.U16(0xB000 | 13);
+        writer.U16(0x0001);
+        writer.U8(0xC1);
+        writer.U8(0x00);
+        writer.U8(0x00);
+        writer.U16(0x0001);
+        writer.U16(0xE000 | pmtPid);
+        writer.U32(CalcCrc32(section_.data(), section_.size()));
+        WriteSection(patPid, patContinuityCounter_);
+    }
+
+    {
+        section_.clear();
+        ByteWriter writer(section_);
+        writer.U8(0x02);
+        writer.U16(0xB000 | 18);
+        writer.U16(0x0001);
+        writer.U8(0xC1);
+        writer.U8(0x00);
+        writer.U8(0x00);
+        writer.U16(0xE000 | videoPid);
+        writer.U16(0xF000);
+        writer.U8(h264StreamType);
+        writer.U16(0xE000 | videoPid);
+        writer.U16(0xF000);
+        writer.U32(CalcCrc32(section_.data(), section_.size()));
+        WriteSection(pmtPid, pmtContinuityCounter_);
+    }
+}
+
+
+void MpegTsMuxer::WriteSection(uint16_t pid, uint8_t &continuityCounter)
+{
+    const auto packet = AddPacket();
+    packet[0] = 0x47;
+    packet[1] = static_cast<uint8_t>(0x40 | (pid >> 8));
+    packet[2] = static_cast<uint8_t>(pid);
+    packet[3] = static_cast<uint8_t>(0x10 | (continuityCounter++ & 0x0F));
+    packet[4] = 0x00;
+    ::memcpy(packet + 5, section_.data(), section_.size());
+    ::memset(packet + 5 + section_.size(), 0xFF, tsPacketSize - 5 - section_.size());
+}
+
+
+void MpegTsMuxer::WritePcr(uint16_t pid, uint8_t continuityCounter, uint64_t base)
+{
+    // Adaptation field only. Packets without payload repeat the continuity
+    // counter of the previous packet.
+    const auto packet = AddPacket();
+    packet[0] = 0x47;
+    packet[1] = static_cast<uint8_t>(pid >> 8);
+    packet[2] = static_cast<uint8_t>(pid);
+    packet[3] = static_cast<uint8_t>(0x20 | (continuityCounter & 0x0F));
+    packet[4] = static_cast<uint8_t>(tsPacketSize - 5);
+    WritePcrField(packet + 5, base, false);
+    ::memset(packet + 12, 0xFF, tsPacketSize - 12);
+}
+
+
+void MpegTsMuxer::WritePayload(
+    uint16_t pid, 
+    uint8_t &continuityCounter, 
+    const uint8_t *prefix, 
+    size_t prefixSize, 
+    const uint8_t *data, 
+    size_t size, 
+    const Pcr *pcr)
+{
+    bool isFirst = prefix != nullptr;
+
+    while (prefixSize + size > 0)
+    {
+        const auto packet = AddPacket();
+        packet[0] = 0x47;
+        packet[1] = static_cast<uint8_t>((isFirst ? 0x40 : 0x00) | (pid >> 8));
+        packet[2] = static_cast<uint8_t>(pid);
+
+        // The adaptation field carries the PCR in the first packet and pads
+        // the last one, since payload bytes cannot be used for stuffing here.
+        const bool hasPcr = isFirst && pcr;
+        size_t adaptationSize = hasPcr ? 8 : 0;
+        const auto remaining = prefixSize + size;
+        if (remaining < tsPacketSize - 4 - adaptationSize)
+        {
+            adaptationSize = tsPacketSize - 4 - remaining;
+        }
+
+        packet[3] = static_cast<uint8_t>((adaptationSize > 0 ? 0x30 : 0x10) | (continuityCounter++ & 0x0F));
+
+        auto dst = packet + 4;
+        if (adaptationSize > 0)
+        {
+            dst[0] = static_cast<uint8_t>(adaptationSize - 1);
+            if (adaptationSize > 1)
+            {
+                dst[1] = 0x00;
+                size_t n = 2;
+                if (hasPcr)
+                {
+                    WritePcrField(dst + 1, pcr->base, pcr->isRandomAccess);
+                    n = 8;
+                }
+                ::memset(dst + n, 0xFF, adaptationSize - n);
+            }
+            dst += adaptationSize;
+        }
+
+        auto space = static_cast<size_t>(packet + tsPacketSize - dst);
+        // Continuation packets have no prefix and pass a null pointer for it,
+        // which memcpy() must not see even with a zero size.
+        const auto prefixCount = (std::min)(space, prefixSize);
+        if (prefixCount > 0)
+        {
+            ::memcpy(dst, prefix, prefixCount);
+            dst += prefixCount;
+            prefix += prefixCount;
+            prefixSize -= prefixCount;
+            space -= prefixCount;
+        }
+
+        const auto dataCount = (std::min)(space, size);
+        if (dataCount > 0)
+        {
+            ::memcpy(dst, data, dataCount);
+            data += dataCount;
+            size -= dataCount;
+        }
+
+        isFirst = false;
+    }
+}
+
+
+uint8_t * MpegTsMuxer::AddPacket()
+{
+    const auto offset = packets_.size();
+    packets_.resize(offset + tsPacketSize);
+    return packets_.data() + offset;
+}
+
+
+}
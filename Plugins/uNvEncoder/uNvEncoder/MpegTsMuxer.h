@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include "Muxer.h"
+
+
+namespace uNvEncoder
+{
+
+
+struct MpegTsMuxerDesc
+{
+    int frameRate = 60;
+};
+
+
+// MPEG-2 transport stream writer for a single H.264 program. PAT/PMT are
+// repeated at every IDR frame and at least every 100 ms, every PES carries
+// a PCR, PCR-only packets keep PCRs within 100 ms of each other when frames
+// are further apart, and slices in sub-frame mode are packetized as soon as
+// they arrive.
+// The 188-byte packets of each call are assembled in one reused buffer and
+// handed to the output at once.
+class MpegTsMuxer final : public Muxer
+{
+public:
+    MpegTsMuxer(const MuxerOutput &output, const MpegTsMuxerDesc &desc);
+    void Write(const MuxerPacket &packet) override;
+    void Close() override;
+
+private:
+    struct Pcr
+    {
+        uint64_t base;
+        bool isRandomAccess;
+    };
+
+    void WritePsi();
+    void WriteSection(uint16_t pid, uint8_t &continuityCounter);
+    void WritePcr(uint16_t pid, uint8_t continuityCounter, uint64_t base);
+    void WritePayload(
+        uint16_t pid, 
+        uint8_t &continuityCounter, 
+        const uint8_t *prefix, 
+        size_t prefixSize, 
+        const uint8_t *data, 
+        size_t size, 
+        const Pcr *pcr);
+    uint8_t * AddPacket();
+
+    const MuxerOutput output_;
+    MuxerClock clock_;
+    bool hasIdrFrame_ = false;
+    bool isInFrame_ = false;
+    bool hasPsi_ = false;
+    uint64_t lastPsiTime_ = 0;
+    bool hasPcr_ = false;
+    uint64_t lastPcrBase_ = 0;
+    uint8_t patContinuityCounter_ = 0;
+    uint8_t pmtContinuityCounter_ = 0;
+    uint8_t videoContinuityCounter_ = 0;
+    std::vector<uint8_t> packets_;
+    std::vector<uint8_t> section_;
+};
+
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "AnnexB.h"
+
+
+namespace uNvEncoder
+{
+
+
+// One encoded H.264 packet in Annex-B format. timeStamp is in microseconds.
+// In sub-frame mode a frame arrives as several packets and only the final
+// one has isLastSlice set. nalIndex is optional and saves the muxer a scan.
+// isRecoveryPoint marks the start of an intra refresh wave, which muxers
+// treat as a random access point like an IDR frame.
+struct MuxerPacket
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    const NalIndex *nalIndex = nullptr;
+    uint64_t timeStamp = 0;
+    bool isIdrFrame = false;
+    bool isRecoveryPoint = false;
+    bool isLastSlice = true;
+};
+
+
+using MuxerOutput = std::function<void(const uint8_t *data, size_t size)>;
+
+// Overwrites bytes already handed to the MuxerOutput, at an offset from the
+// first of them. Outputs that cannot seek pass nullptr.
+using MuxerPatch = std::function<void(uint64_t offset, const uint8_t *data, size_t size)>;
+
+
+// Converts packet timestamps to a container time scale starting at zero.
+// Timestamps that do not increase (e.g. when the caller passes none) are
+// replaced by the previous time plus one frame duration.
+class MuxerClock final
+{
+public:
+    MuxerClock(uint32_t timeScale, int frameRate)
+        : timeScale_(timeScale)
+        , frameDuration_(timeScale / static_cast<uint32_t>(frameRate > 0 ? frameRate : 1))
+    {
+    }
+
+    uint32_t GetFrameDuration() const { return frameDuration_; }
+    uint64_t GetLastTime() const { return lastTime_; }
+
+    uint64_t ToTime(uint64_t timeStamp)
+    {
+        if (!hasLastTime_)
+        {
+            firstTimeStamp_ = timeStamp;
+            hasLastTime_ = true;
+            lastTime_ = 0;
+            return lastTime_;
+        }
+
+        const auto time = timeStamp > firstTimeStamp_ ? 
+            (timeStamp - firstTimeStamp_) * timeScale_ / 1000000 : 
+            0;
+        lastTime_ = time > lastTime_ ? time : lastTime_ + frameDuration_;
+        return lastTime_;
+    }
+
+private:
+    const uint32_t timeScale_;
+    const uint32_t frameDuration_;
+    uint64_t firstTimeStamp_ = 0;
+    uint64_t lastTime_ = 0;
+    bool hasLastTime_ = false;
+};
+
+
+// Container writers only produce bytes through a MuxerOutput and know nothing
+// about NVENC or files, so they can be fed with recorded bitstreams.
+class Muxer
+{
+public:
+    virtual ~Muxer() = default;
+    virtual void Write(const MuxerPacket &packet) = 0;
+    virtual void Close() = 0;
+};
+
+
+}
@@ -0,0 +1,49 @@
+#include "MuxerSink.h"
+
+
+namespace uNvEncoder
+{
+
+
+MuxerSink::MuxerSink(const std::string &path, const MuxerFactory &factory)
+    : writer_(path)
+{
+    muxer_ = factory(
+        [this](const uint8_t *data, size_t size)
+        {
+            writer_.Write(data, size);
+        },
+        [this](uint64_t offset, const uint8_t *data, size_t size)
+        {
+            writer_.WriteAt(offset, data, size);
+        });
+}
+
+
+MuxerSink::~MuxerSink()
+{
+    try
+    {
+        if (muxer_) muxer_->Close();
+    }
+    catch (const std::exception&)
+    {
+    }
+}
+
+
+void MuxerSink::Write(const NvencEncodedData &data)
+{
+    MuxerPacket packet;
+    packet.data = data.buffer.get();
+    packet.size = data.size;
+    packet.nalIndex = &data.nalIndex;
+    packet.timeStamp = data.timeStamp;
+    packet.isIdrFrame = data.isIdrFrame;
+    packet.isRecoveryPoint = data.isRecoveryPoint;
+    packet.isLastSlice = data.isLastSlice;
+    muxer_->Write(packet);
+}
+
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "PacketSink.h"
+#include "FileWriter.h"
+#include "Muxer.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Feeds the encoder's packets to a muxer that writes into a file.
+class MuxerSink final : public PacketSink
+{
+public:
+    using MuxerFactory = std::function<std::unique_ptr<Muxer>(const MuxerOutput &output, const MuxerPatch &patch)>;
+
+    MuxerSink(const std::string &path, const MuxerFactory &factory);
+    ~MuxerSink();
+    void Write(const NvencEncodedData &data) override;
+
+private:
+    FileWriter writer_;
+    std::unique_ptr<Muxer> muxer_;
+};
+
+
+}
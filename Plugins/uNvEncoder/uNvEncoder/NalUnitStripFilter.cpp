@@ -0,0 +1,44 @@
+#include <algorithm>
+#include "NalUnitStripFilter.h"
+
+
+namespace uNvEncoder
+{
+
+
+NalUnitStripFilter::NalUnitStripFilter(uint32_t typeMask)
+    : typeMask_(typeMask)
+{
+}
+
+
+bool NalUnitStripFilter::Filter(NvencEncodedData &data, bool isWritable, BufferPool &pool)
+{
+    nalUnits_.clear();
+    AppendNalUnits(data.buffer.get(), data.size, &data.nalIndex, 0, nalUnits_);
+
+    const bool hasStrippedUnit = std::any_of(nalUnits_.begin(), nalUnits_.end(), [this](const NalUnit &unit)
+    {
+        return (typeMask_ & (1U << unit.type)) != 0;
+    });
+    if (!hasStrippedUnit) return true;
+
+    // Dropping units only ever moves the rest towards the front, so the
+    // packet is compacted in place unless it is a locked bitstream.
+    if (isWritable)
+    {
+        data.size = static_cast<uint32_t>(StripNalUnits(data.buffer.get(), nalUnits_, typeMask_, data.buffer.get()));
+    }
+    else
+    {
+        auto buffer = pool.Acquire(data.size);
+        data.size = static_cast<uint32_t>(StripNalUnits(data.buffer.get(), nalUnits_, typeMask_, buffer.get()));
+        data.buffer = std::move(buffer);
+    }
+
+    BuildNalIndex(nalUnits_, data.nalIndex);
+    return true;
+}
+
+
+}
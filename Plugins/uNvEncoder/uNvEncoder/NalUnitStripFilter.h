@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include "BitstreamFilter.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Removes the NAL unit types whose bit is set in typeMask, e.g. AUD and
+// in-band SPS/PPS for consumers that take them from GetSequenceParams().
+class NalUnitStripFilter final : public BitstreamFilter
+{
+public:
+    explicit NalUnitStripFilter(uint32_t typeMask);
+    bool Filter(NvencEncodedData &data, bool isWritable, BufferPool &pool) override;
+
+private:
+    const uint32_t typeMask_;
+    std::vector<NalUnit> nalUnits_;
+};
+
+
+}
@@ -1,5 +1,6 @@
 #include <string>
 #include <map>
+#include <algorithm>
 #include "Nvenc.h"
 
 
@@ -62,17 +63,99 @@ NVENCSTATUS CallNvencApi(const std::string &apiName, const Api &api, const Args
 #define CALL_NVENC_API(Api, ...) CallNvencApi(#Api, Api, __VA_ARGS__)
 
 
+namespace
+{
+    // nvEncodeAPI.h leaves the values of NV_ENC_LOCK_BITSTREAM::hwEncodeStatus
+    // undefined; the driver reports 2 once the whole picture has been written.
+    // The completion event stays the authoritative signal, this only lets the
+    // last slice go out without waiting for it.
+    constexpr uint32_t hwEncodeStatusCompleted = 2;
+
+    // How long GetEncodedSlices() waits on the completion event between
+    // looks at the slices written so far. [ms]
+    constexpr DWORD slicePollInterval = 1;
+
+    void SetFrameInfo(NvencEncodedData &ed, const NV_ENC_LOCK_BITSTREAM &lockBitstream)
+    {
+        ed.isIdrFrame = lockBitstream.pictureType == NV_ENC_PIC_TYPE_IDR;
+        ed.timeStamp = lockBitstream.outputTimeStamp;
+        ed.frameIndex = lockBitstream.frameIdx;
+        ed.pictureType = lockBitstream.pictureType;
+        ed.averageQp = lockBitstream.frameAvgQP;
+        ed.satd = lockBitstream.frameSatd;
+        ed.isLtrFrame = lockBitstream.ltrFrame != 0;
+        ed.ltrFrameIndex = lockBitstream.ltrFrameIdx;
+        ed.intraMbCount = lockBitstream.intraMBCount;
+        ed.interMbCount = lockBitstream.interMBCount;
+        ed.averageMvX = lockBitstream.averageMVX;
+        ed.averageMvY = lockBitstream.averageMVY;
+    }
+
+    NvencDesc NormalizeDesc(const NvencDesc &desc)
+    {
+        auto result = desc;
+
+        // Slices are copied out while the rest of the picture is still being
+        // written, so they can never be handed out as locked views.
+        if (result.subFrameOutput)
+        {
+            result.zeroCopy = false;
+        }
+
+        // Input textures and the session are sized for the maximum resolution so
+        // that the encoded size can change at runtime within it.
+        result.maxWidth = (std::max)(result.maxWidth, result.width);
+        result.maxHeight = (std::max)(result.maxHeight, result.height);
+
+        if (!result.bufferPool)
+        {
+            const auto averageFrameSize = result.bitRate / 8 / (std::max)(result.frameRate, 1U);
+            result.bufferPool = std::make_shared<BufferPool>(averageFrameSize);
+        }
+
+        return result;
+    }
+
+    NvencDynamicParams GetDynamicParamsOf(const NvencDesc &desc)
+    {
+        NvencDynamicParams params;
+        params.width = desc.width;
+        params.height = desc.height;
+        params.frameRate = desc.frameRate;
+        params.bitRate = desc.bitRate;
+        params.maxFrameSize = desc.maxFrameSize;
+        return params;
+    }
+}
+
+
 
 decltype(Nvenc::s_module) Nvenc::s_module = NULL;
 decltype(Nvenc::s_nvenc) Nvenc::s_nvenc = { 0 };
 decltype(Nvenc::s_referenceCount) Nvenc::s_referenceCount = 0;
+decltype(Nvenc::s_hasExternalFunctionList) Nvenc::s_hasExternalFunctionList = false;
+decltype(Nvenc::s_moduleMutex) Nvenc::s_moduleMutex;
+
+
+void Nvenc::SetFunctionList(const NV_ENCODE_API_FUNCTION_LIST *functionList)
+{
+    std::lock_guard<std::mutex> lock(s_moduleMutex);
+
+    s_hasExternalFunctionList = functionList != nullptr;
+    s_nvenc = functionList ? *functionList : NV_ENCODE_API_FUNCTION_LIST { 0 };
+}
 
 
 void Nvenc::LoadModule()
 {
+    // Encoders are initialized on the background worker while the Unity
+    // thread creates or destroys others, so the count and the module must
+    // change together.
+    std::lock_guard<std::mutex> lock(s_moduleMutex);
+
     ++s_referenceCount;
 
-    if (s_module != NULL) return;
+    if (s_module != NULL || s_hasExternalFunctionList) return;
 
 #if defined(_WIN64)
     s_module = ::LoadLibraryA("nvEncodeAPI64.dll");
@@ -108,6 +191,8 @@ void Nvenc::LoadModule()
 
 void Nvenc::UnloadModule()
 {
+    std::lock_guard<std::mutex> lock(s_moduleMutex);
+
     if (--s_referenceCount > 0) return;
 
     if (s_module != NULL)
@@ -119,8 +204,10 @@ void Nvenc::UnloadModule()
 
 
 Nvenc::Nvenc(const NvencDesc &desc)
-    : desc_(desc)
-    , resources_(1)
+    : desc_(NormalizeDesc(desc))
+    , params_(GetDynamicParamsOf(desc_))
+    , inputTextures_((std::min)((std::max)(desc_.pipelineDepth, 1U), 8U))
+    , resources_(inputTextures_.size() * (desc_.zeroCopy ? 2 : 1))
 {
 }
 
@@ -164,18 +251,70 @@ void Nvenc::Finalize()
 
 void Nvenc::Reconfigure(const NvencDesc &desc)
 {
-    std::vector<NvencEncodedData> data;
-    GetEncodedData(data);
+    ThrowErrorIfNotInitialized();
+
+    // Only the size and rate control of desc are applied; everything else
+    // stays as given at construction.
+    const auto params = GetDynamicParamsOf(desc);
+    const auto prevParams = GetDynamicParams();
+
+    if (params.width == 0 || params.width > desc_.maxWidth ||
+        params.height == 0 || params.height > desc_.maxHeight)
+    {
+        ThrowError("The resolution is out of the range given at initialization.");
+        return;
+    }
+
+    // Rate control changes apply from the next picture on a live session, so
+    // neither the frames in flight nor the reference chain are thrown away.
+    // A new resolution starts with an IDR frame but keeps the session too.
+    // GPUs that cannot do either dynamically need a reset.
+    const bool isBitRateChanged = 
+        params.bitRate != prevParams.bitRate ||
+        params.maxFrameSize != prevParams.maxFrameSize;
+    const bool isResolutionChanged = 
+        params.width != prevParams.width ||
+        params.height != prevParams.height;
+    const bool isResetRequired = 
+        (isBitRateChanged && !isDynamicBitRateChangeSupported_) ||
+        (isResolutionChanged && !isDynamicResolutionChangeSupported_);
+
+    if (isResetRequired)
+    {
+        constexpr DWORD duration = 10000;
+        WaitForPendingEncodes(duration);
+    }
 
-    desc_ = desc;
-    CreateInitializeParams();
+    CreateInitializeParams(params);
 
     NV_ENC_RECONFIGURE_PARAMS reconfigureParams = { NV_ENC_RECONFIGURE_PARAMS_VER };
-    reconfigureParams.resetEncoder = 1;
-    reconfigureParams.forceIDR = 1;
+    reconfigureParams.resetEncoder = isResetRequired ? 1 : 0;
+    reconfigureParams.forceIDR = isResetRequired || isResolutionChanged ? 1 : 0;
     memcpy(&reconfigureParams.reInitEncodeParams, &initParams_, sizeof(NV_ENC_INITIALIZE_PARAMS));
 
-    CALL_NVENC_API(s_nvenc.nvEncReconfigureEncoder, &encoder_, &reconfigureParams);
+    CALL_NVENC_API(s_nvenc.nvEncReconfigureEncoder, encoder_, &reconfigureParams);
+
+    std::lock_guard<std::mutex> lock(paramsMutex_);
+    params_ = params;
+}
+
+
+void Nvenc::GetSequenceParams(std::vector<uint8_t> &params)
+{
+    ThrowErrorIfNotInitialized();
+
+    // SPS + PPS with VUI are well below this.
+    constexpr uint32_t bufferSize = 1024;
+    params.resize(bufferSize);
+
+    uint32_t size = 0;
+    NV_ENC_SEQUENCE_PARAM_PAYLOAD payload = { NV_ENC_SEQUENCE_PARAM_PAYLOAD_VER };
+    payload.inBufferSize = bufferSize;
+    payload.spsppsBuffer = params.data();
+    payload.outSPSPPSPayloadSize = &size;
+    CALL_NVENC_API(s_nvenc.nvEncGetSequenceParams, encoder_, &payload);
+
+    params.resize(size);
 }
 
 
@@ -197,27 +336,40 @@ void Nvenc::OpenEncodeSession()
 
 void Nvenc::InitializeEncoder()
 {
-    CreateInitializeParams();
+    CreateInitializeParams(GetDynamicParams());
     CALL_NVENC_API(s_nvenc.nvEncInitializeEncoder, encoder_, &initParams_);
+
+    isDynamicBitRateChangeSupported_ = GetCapability(NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE) != 0;
+    isDynamicResolutionChangeSupported_ = GetCapability(NV_ENC_CAPS_SUPPORT_DYN_RES_CHANGE) != 0;
+}
+
+
+int Nvenc::GetCapability(NV_ENC_CAPS caps)
+{
+    NV_ENC_CAPS_PARAM capsParam = { NV_ENC_CAPS_PARAM_VER };
+    capsParam.capsToQuery = caps;
+    int value = 0;
+    CALL_NVENC_API(s_nvenc.nvEncGetEncodeCaps, encoder_, initParams_.encodeGUID, &capsParam, &value);
+    return value;
 }
 
 
-void Nvenc::CreateInitializeParams()
+void Nvenc::CreateInitializeParams(const NvencDynamicParams &params)
 {
     initParams_ = { NV_ENC_INITIALIZE_PARAMS_VER };
     initParams_.encodeGUID = NV_ENC_CODEC_H264_GUID;
     initParams_.presetGUID = NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID;
-    initParams_.encodeWidth = desc_.width;
-    initParams_.encodeHeight = desc_.height;
-    initParams_.darWidth = desc_.width;
-    initParams_.darHeight = desc_.height;
-    initParams_.frameRateNum = desc_.frameRate;
+    initParams_.encodeWidth = params.width;
+    initParams_.encodeHeight = params.height;
+    initParams_.darWidth = params.width;
+    initParams_.darHeight = params.height;
+    initParams_.frameRateNum = params.frameRate;
     initParams_.frameRateDen = 1;
     initParams_.enablePTD = 1;
-    initParams_.reportSliceOffsets = 0;
-    initParams_.enableSubFrameWrite = 0;
-    initParams_.maxEncodeWidth = desc_.width;
-    initParams_.maxEncodeHeight = desc_.height;
+    initParams_.reportSliceOffsets = desc_.subFrameOutput ? 1 : 0;
+    initParams_.enableSubFrameWrite = desc_.subFrameOutput ? 1 : 0;
+    initParams_.maxEncodeWidth = desc_.maxWidth;
+    initParams_.maxEncodeHeight = desc_.maxHeight;
     initParams_.enableMEOnlyMode = false;
     initParams_.enableOutputInVidmem = false;
     initParams_.enableEncodeAsync = true;
@@ -232,17 +384,23 @@ void Nvenc::CreateInitializeParams()
     encConfig_.gopLength = NVENC_INFINITE_GOPLENGTH;
     encConfig_.rcParams.version = NV_ENC_RC_PARAMS_VER;
     encConfig_.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;
-    encConfig_.rcParams.vbvBufferSize = desc_.maxFrameSize;
-    encConfig_.rcParams.vbvInitialDelay = desc_.maxFrameSize;
-    encConfig_.rcParams.maxBitRate = desc_.bitRate;
-    encConfig_.rcParams.averageBitRate = desc_.bitRate;
+    encConfig_.rcParams.vbvBufferSize = params.maxFrameSize;
+    encConfig_.rcParams.vbvInitialDelay = params.maxFrameSize;
+    encConfig_.rcParams.maxBitRate = params.bitRate;
+    encConfig_.rcParams.averageBitRate = params.bitRate;
     auto &h264Config = encConfig_.encodeCodecConfig.h264Config;
     h264Config.repeatSPSPPS = 1;
     h264Config.maxNumRefFrames = 0;
     h264Config.idrPeriod = encConfig_.gopLength;
     h264Config.enableIntraRefresh = true;
-    h264Config.intraRefreshPeriod = desc_.frameRate * 10;
-    h264Config.intraRefreshCnt = desc_.frameRate;
+    h264Config.intraRefreshPeriod = GetIntraRefreshPeriod(params.frameRate);
+    h264Config.intraRefreshCnt = params.frameRate;
+    h264Config.outputRecoveryPointSEI = 1;
+    if (desc_.subFrameOutput)
+    {
+        h264Config.sliceMode = 3;
+        h264Config.sliceModeData = (std::max)(desc_.sliceCount, 1U);
+    }
     initParams_.encodeConfig = &encConfig_;
 }
 
@@ -253,9 +411,9 @@ void Nvenc::CreateCompletionEvents()
 
     for (auto &resource : resources_)
     {
-        resource.completionEvent_ = ::CreateEventA(NULL, FALSE, FALSE, NULL);
+        resource.completionEvent_ = std::make_unique<Event>();
         NV_ENC_EVENT_PARAMS eventParams = { NV_ENC_EVENT_PARAMS_VER };
-        eventParams.completionEvent = resource.completionEvent_;
+        eventParams.completionEvent = resource.completionEvent_->GetHandle();
         CALL_NVENC_API(s_nvenc.nvEncRegisterAsyncEvent, encoder_, &eventParams);
     }
 }
@@ -270,9 +428,9 @@ void Nvenc::DestroyCompletionEvents()
         if (!resource.completionEvent_) continue;
 
         NV_ENC_EVENT_PARAMS eventParams = { NV_ENC_EVENT_PARAMS_VER };
-        eventParams.completionEvent = resource.completionEvent_;
+        eventParams.completionEvent = resource.completionEvent_->GetHandle();
         CALL_NVENC_API(s_nvenc.nvEncUnregisterAsyncEvent, encoder_, &eventParams);
-        ::CloseHandle(resource.completionEvent_);
+        resource.completionEvent_.reset();
     }
 }
 
@@ -287,6 +445,12 @@ void Nvenc::CreateBitstreamBuffers()
         CALL_NVENC_API(s_nvenc.nvEncCreateBitstreamBuffer, encoder_, &createBitstreamBuffer);
         resource.bitstreamBuffer_ = createBitstreamBuffer.bitstreamBuffer;
     }
+
+    if (desc_.subFrameOutput)
+    {
+        const auto mbCount = ((desc_.maxWidth + 15) / 16) * ((desc_.maxHeight + 15) / 16);
+        sliceOffsets_.resize(mbCount);
+    }
 }
 
 
@@ -295,8 +459,8 @@ void Nvenc::CreateInputTextures()
     ThrowErrorIfNotInitialized();
 
     D3D11_TEXTURE2D_DESC desc = { 0 };
-    desc.Width = desc_.width;
-    desc.Height = desc_.height;
+    desc.Width = desc_.maxWidth;
+    desc.Height = desc_.maxHeight;
     desc.MipLevels = 1;
     desc.ArraySize = 1;
     desc.Format = desc_.format;
@@ -306,17 +470,17 @@ void Nvenc::CreateInputTextures()
     desc.CPUAccessFlags = 0;
     desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
 
-    for (auto &resource : resources_)
+    for (auto &inputTexture : inputTextures_)
     {
-        if (FAILED(desc_.d3d11Device->CreateTexture2D(&desc, NULL, &resource.inputTexture_)))
+        if (FAILED(desc_.d3d11Device->CreateTexture2D(&desc, NULL, &inputTexture.inputTexture_)))
         {
             ThrowError("Failed to create shared texture.");
             return;
         }
 
         ComPtr<IDXGIResource> dxgiResource;
-        resource.inputTexture_.As(&dxgiResource);
-        if (FAILED(dxgiResource->GetSharedHandle(&resource.inputTextureSharedHandle_)))
+        inputTexture.inputTexture_.As(&dxgiResource);
+        if (FAILED(dxgiResource->GetSharedHandle(&inputTexture.inputTextureSharedHandle_)))
         {
             ThrowError("Failed to get shared handle.");
             return;
@@ -329,19 +493,19 @@ void Nvenc::RegisterResources()
 {
     ThrowErrorIfNotInitialized();
 
-    for (auto &resource : resources_)
+    for (auto &inputTexture : inputTextures_)
     {
         NV_ENC_REGISTER_RESOURCE registerResource = { NV_ENC_REGISTER_RESOURCE_VER };
         registerResource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
-        registerResource.resourceToRegister = resource.inputTexture_.Get();
-        registerResource.width = desc_.width;
-        registerResource.height = desc_.height;
+        registerResource.resourceToRegister = inputTexture.inputTexture_.Get();
+        registerResource.width = desc_.maxWidth;
+        registerResource.height = desc_.maxHeight;
         registerResource.pitch = 0;
         registerResource.bufferFormat = NV_ENC_BUFFER_FORMAT_ARGB;
         registerResource.bufferUsage = NV_ENC_INPUT_IMAGE;
         CALL_NVENC_API(s_nvenc.nvEncRegisterResource, encoder_, &registerResource);
 
-        resource.registeredResource_ = registerResource.registeredResource;
+        inputTexture.registeredResource_ = registerResource.registeredResource;
     }
 }
 
@@ -350,10 +514,10 @@ void Nvenc::UnregisterResources()
 {
     ThrowErrorIfNotInitialized();
 
-    for (auto &resource : resources_)
+    for (auto &inputTexture : inputTextures_)
     {
-       if (!resource.registeredResource_) continue;
-        CALL_NVENC_API(s_nvenc.nvEncUnregisterResource, encoder_, resource.registeredResource_);
+        if (!inputTexture.registeredResource_) continue;
+        CALL_NVENC_API(s_nvenc.nvEncUnregisterResource, encoder_, inputTexture.registeredResource_);
     }
 }
 
@@ -365,6 +529,15 @@ void Nvenc::DestroyBitstreamBuffers()
     for (auto &resource : resources_)
     {
         if (!resource.bitstreamBuffer_) continue;
+
+        // Zero-copy packets must all be released before this, but do not
+        // leave a bitstream locked if one was missed.
+        if (resource.state_ == ResourceState::Completed)
+        {
+            CALL_NVENC_API(s_nvenc.nvEncUnlockBitstream, encoder_, resource.bitstreamBuffer_);
+            resource.state_ = ResourceState::Drained;
+        }
+
         CALL_NVENC_API(s_nvenc.nvEncDestroyBitstreamBuffer, encoder_, resource.bitstreamBuffer_);
     }
 }
@@ -378,38 +551,134 @@ void Nvenc::DestroyEncoder()
 }
 
 
-void Nvenc::Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame)
+bool Nvenc::TryAcquireResource(Resource &resource)
+{
+    auto state = ResourceState::Free;
+    if (resource.state_.compare_exchange_strong(state, ResourceState::Copying)) return true;
+
+    state = ResourceState::Drained;
+    return resource.state_.compare_exchange_strong(state, ResourceState::Copying);
+}
+
+
+bool Nvenc::CanEncode() const
+{
+    if (!IsValid()) return false;
+
+    const auto state = resources_[GetInputIndex()].state_.load();
+    if (state != ResourceState::Free && state != ResourceState::Drained) return false;
+
+    return !inputTextures_[inputIndex_ % GetInputTextureCount()].isInUse_;
+}
+
+
+void Nvenc::Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame, uint64_t timeStamp, uint64_t userData)
 {
     ThrowErrorIfNotInitialized();
 
     const auto index = GetInputIndex();
     auto &resource = resources_[index];
 
-    if (resource.isEncoding_) 
+    if (!TryAcquireResource(resource))
+    {
+        ThrowError("The previous encode is still continuing.");
+    }
+
+    const auto textureIndex = static_cast<int>(inputIndex_ % GetInputTextureCount());
+    auto &inputTexture = inputTextures_[textureIndex];
+    if (inputTexture.isInUse_.exchange(true))
     {
+        resource.state_ = ResourceState::Free;
         ThrowError("The previous encode is still continuing.");
     }
-    resource.isEncoding_ = true;
+    resource.inputTextureIndex_ = textureIndex;
+    resource.timeStamp_ = timeStamp;
+    resource.userData_ = userData;
+
+    // The copy and the picture must agree on the size even if Reconfigure()
+    // runs in between.
+    const auto params = GetDynamicParams();
 
-    CopyToInputTexture(index, source);
-    MapInputResource(index);
+    try
+    {
+        if (source)
+        {
+            CopyToInputTexture(textureIndex, source, params);
+        }
+        MapInputResource(textureIndex);
+    }
+    catch (...)
+    {
+        inputTexture.isInUse_ = false;
+        resource.state_ = ResourceState::Free;
+        throw;
+    }
 
-    if (EncodeInputTexture(index, forceIdrFrame)) 
+    // A failed nvEncEncodePicture() throws; the slot and the input texture
+    // must be released either way, or every later Encode() finds them busy.
+    try
     {
-        ++inputIndex_;
+        if (EncodeInputTexture(index, forceIdrFrame, params))
+        {
+            resource.state_ = ResourceState::Submitted;
+            ++inputIndex_;
+            return;
+        }
     }
-    else
+    catch (...)
     {
-        resource.isEncoding_ = false;
+        ReleaseInput(resource, textureIndex);
+        throw;
     }
+
+    ReleaseInput(resource, textureIndex);
 }
 
 
-void Nvenc::CopyToInputTexture(int index, const ComPtr<ID3D11Texture2D> &texture)
+void Nvenc::ReleaseInput(Resource &resource, int textureIndex)
+{
+    // The original error matters more than a failed unmap, and the slot has
+    // to be freed regardless.
+    try
+    {
+        UnmapInputResource(textureIndex);
+    }
+    catch (const std::exception&)
+    {
+    }
+
+    inputTextures_[textureIndex].isInUse_ = false;
+    resource.state_ = ResourceState::Free;
+}
+
+
+void Nvenc::WarmUp(int frameCount)
+{
+    // Encodes whatever the input textures hold and throws the output away so
+    // that the driver has finished its lazy setup before the first real frame.
+    // This must run before anyone else drains the encoder.
+    std::vector<NvencEncodedData> data;
+    for (int i = 0; i < frameCount; ++i)
+    {
+        Encode(nullptr, i == 0);
+        GetEncodedData(data);
+        data.clear();
+    }
+}
+
+
+NvencDynamicParams Nvenc::GetDynamicParams() const
+{
+    std::lock_guard<std::mutex> lock(paramsMutex_);
+    return params_;
+}
+
+
+void Nvenc::CopyToInputTexture(int textureIndex, const ComPtr<ID3D11Texture2D> &texture, const NvencDynamicParams &params)
 {
     ThrowErrorIfNotInitialized();
 
-    auto &resource = resources_[index];
+    const auto &resource = inputTextures_[textureIndex];
     ComPtr<ID3D11Texture2D> inputTexture;
 
     if (FAILED(GetUnityDevice()->OpenSharedResource(
@@ -423,32 +692,41 @@ void Nvenc::CopyToInputTexture(int index, const ComPtr<ID3D11Texture2D> &texture
 
     ComPtr<ID3D11DeviceContext> context;
     GetUnityDevice()->GetImmediateContext(&context);
-    context->CopyResource(inputTexture.Get(), texture.Get());
-    // context->CopySubresourceRegion(inputTexture.Get(), 0, 0, 0, 0, texture.Get(), 0, NULL);
+    // Only the top-left area of the current resolution is encoded.
+    D3D11_TEXTURE2D_DESC sourceDesc;
+    texture->GetDesc(&sourceDesc);
+    D3D11_BOX box = { 0 };
+    box.right = (std::min)(sourceDesc.Width, params.width);
+    box.bottom = (std::min)(sourceDesc.Height, params.height);
+    box.back = 1;
+    context->CopySubresourceRegion(inputTexture.Get(), 0, 0, 0, 0, texture.Get(), 0, &box);
     context->Flush();
 }
 
 
-bool Nvenc::EncodeInputTexture(int index, bool forceIdrFrame)
+bool Nvenc::EncodeInputTexture(int index, bool forceIdrFrame, const NvencDynamicParams &params)
 {
     ThrowErrorIfNotInitialized();
 
     auto &resource = resources_[index];
+    const auto &inputTexture = inputTextures_[resource.inputTextureIndex_];
 
     NV_ENC_PIC_PARAMS picParams = { NV_ENC_PIC_PARAMS_VER };
     picParams.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
-    picParams.inputBuffer = resource.inputResource_;
+    picParams.inputBuffer = inputTexture.inputResource_;
     picParams.bufferFmt = NV_ENC_BUFFER_FORMAT_ARGB;
-    picParams.inputWidth = desc_.width;
-    picParams.inputHeight = desc_.height;
+    picParams.inputWidth = params.width;
+    picParams.inputHeight = params.height;
     picParams.outputBitstream = resource.bitstreamBuffer_;
-    picParams.completionEvent = resource.completionEvent_;
+    picParams.completionEvent = resource.completionEvent_->GetHandle();
     picParams.frameIdx = static_cast<uint32_t>(inputIndex_);
+    picParams.inputTimeStamp = resource.timeStamp_;
     if (forceIdrFrame)
     {
         picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
     }
 
+    resource.submitTime_ = GetClockMicroseconds();
     const auto status = CALL_NVENC_API(s_nvenc.nvEncEncodePicture, encoder_, &picParams);
     if (status != NV_ENC_SUCCESS && status != NV_ENC_ERR_NEED_MORE_INPUT)
     {
@@ -459,11 +737,11 @@ bool Nvenc::EncodeInputTexture(int index, bool forceIdrFrame)
 }
 
 
-void Nvenc::MapInputResource(int index)
+void Nvenc::MapInputResource(int textureIndex)
 {
     ThrowErrorIfNotInitialized();
 
-    auto &resource = resources_[index];
+    auto &resource = inputTextures_[textureIndex];
     if (!resource.registeredResource_) return;
 
     NV_ENC_MAP_INPUT_RESOURCE mapInputResource = { NV_ENC_MAP_INPUT_RESOURCE_VER };
@@ -473,13 +751,13 @@ void Nvenc::MapInputResource(int index)
 }
 
 
-void Nvenc::UnmapInputResource(int index)
+void Nvenc::UnmapInputResource(int textureIndex)
 {
     ThrowErrorIfNotInitialized();
 
-    auto &resource = resources_[index];
+    auto &resource = inputTextures_[textureIndex];
 
-    if (!resource.inputResource_)
+    if (resource.inputResource_)
     {
         CALL_NVENC_API(s_nvenc.nvEncUnmapInputResource, encoder_, resource.inputResource_);
         resource.inputResource_ = nullptr;
@@ -496,12 +774,18 @@ void Nvenc::GetEncodedData(std::vector<NvencEncodedData> &data)
         const auto index = GetOutputIndex();
         auto &resource = resources_[index];
 
-        if (!resource.isEncoding_) 
+        if (resource.state_ != ResourceState::Submitted) 
         {
             ThrowError("Try to get an invalid bitstream.");
             continue;
         }
 
+        if (desc_.subFrameOutput)
+        {
+            GetEncodedSlices(index, data);
+            continue;
+        }
+
         constexpr DWORD duration = 10000;
         if (!WaitForCompletion(index, duration))
         {
@@ -509,23 +793,243 @@ void Nvenc::GetEncodedData(std::vector<NvencEncodedData> &data)
             continue;
         }
 
+        ReadEncodedData(index, data);
+    }
+}
+
+
+void Nvenc::GetCompletedEncodedData(std::vector<NvencEncodedData> &data, bool isCompletionSignaled)
+{
+    ThrowErrorIfNotInitialized();
+
+    for (;outputIndex_ < inputIndex_; ++outputIndex_)
+    {
+        const auto index = GetOutputIndex();
+        auto &resource = resources_[index];
+
+        if (resource.state_ != ResourceState::Submitted) 
+        {
+            ThrowError("Try to get an invalid bitstream.");
+            continue;
+        }
+
+        // The caller has already consumed the completion event of the oldest slot.
+        if (!isCompletionSignaled && !WaitForCompletion(index, 0)) return;
+        isCompletionSignaled = false;
+
+        ReadEncodedData(index, data);
+    }
+}
+
+
+Event * Nvenc::GetPendingCompletionEvent() const
+{
+    if (!IsValid() || desc_.subFrameOutput) return nullptr;
+    if (outputIndex_ >= inputIndex_) return nullptr;
+
+    return resources_[GetOutputIndex()].completionEvent_.get();
+}
+
+
+void Nvenc::ReadEncodedData(int index, std::vector<NvencEncodedData> &data)
+{
+    const auto completeTime = GetClockMicroseconds();
+
+    auto &resource = resources_[index];
+    resource.state_ = ResourceState::Completed;
+
+    UnmapInputResource(resource.inputTextureIndex_);
+    inputTextures_[resource.inputTextureIndex_].isInUse_ = false;
+
+    NV_ENC_LOCK_BITSTREAM lockBitstream = { NV_ENC_LOCK_BITSTREAM_VER };
+    lockBitstream.outputBitstream = resource.bitstreamBuffer_;
+    lockBitstream.doNotWait = false;
+    lockBitstream.getRCStats = 1;
+    CALL_NVENC_API(s_nvenc.nvEncLockBitstream, encoder_, &lockBitstream);
+
+    NvencEncodedData ed;
+    ed.index = outputIndex_;
+    ed.size = lockBitstream.bitstreamSizeInBytes;
+    SetFrameInfo(ed, lockBitstream);
+    ed.userData = resource.userData_;
+    ed.submitTime = resource.submitTime_;
+    ed.completeTime = completeTime;
+
+    if (desc_.zeroCopy)
+    {
+        const auto ptr = static_cast<uint8_t *>(lockBitstream.bitstreamBufferPtr);
+        ed.buffer = PooledBuffer(ptr, PooledBufferDeleter { this, index });
+        BuildNalIndex(ptr, ed.size, ed.nalIndex);
+        ed.isRecoveryPoint = HasRecoveryPointSei(ptr, ed.size, ed.nalIndex);
+        data.push_back(std::move(ed));
+        slotFreedEvent_.Signal();
+        return;
+    }
+
+    ed.buffer = desc_.bufferPool->Acquire(ed.size);
+    ::memcpy(ed.buffer.get(), lockBitstream.bitstreamBufferPtr, ed.size);
+    BuildNalIndex(ed.buffer.get(), ed.size, ed.nalIndex);
+    ed.isRecoveryPoint = HasRecoveryPointSei(ed.buffer.get(), ed.size, ed.nalIndex);
+    data.push_back(std::move(ed));
+
+    CALL_NVENC_API(s_nvenc.nvEncUnlockBitstream, encoder_, resource.bitstreamBuffer_);
+
+    resource.state_ = ResourceState::Drained;
+    slotFreedEvent_.Signal();
+}
+
+
+void Nvenc::GetEncodedSlices(int index, std::vector<NvencEncodedData> &data)
+{
+    using namespace std::chrono;
+
+    auto &resource = resources_[index];
+    constexpr DWORD duration = 10000;
+    const auto timeout = steady_clock::now() + milliseconds(duration);
+    const auto firstSlice = data.size();
+    uint32_t emittedSlices = 0;
+    bool isCompletionSignaled = false;
+
+    for (;;)
+    {
         NV_ENC_LOCK_BITSTREAM lockBitstream = { NV_ENC_LOCK_BITSTREAM_VER };
         lockBitstream.outputBitstream = resource.bitstreamBuffer_;
-        lockBitstream.doNotWait = false;
-        CALL_NVENC_API(s_nvenc.nvEncLockBitstream, encoder_, &lockBitstream);
-
-        NvencEncodedData ed;
-        ed.index = outputIndex_;
-        ed.size = lockBitstream.bitstreamSizeInBytes;
-        ed.buffer = std::make_unique<uint8_t[]>(ed.size);
-        ::memcpy(ed.buffer.get(), lockBitstream.bitstreamBufferPtr, ed.size);
-        data.push_back(std::move(ed));
+        lockBitstream.doNotWait = true;
+        lockBitstream.getRCStats = 1;
+        lockBitstream.sliceOffsets = sliceOffsets_.data();
+
+        const auto status = s_nvenc.nvEncLockBitstream(encoder_, &lockBitstream);
+        if (status == NV_ENC_SUCCESS)
+        {
+            const auto isCompleted = 
+                isCompletionSignaled || 
+                lockBitstream.hwEncodeStatus == hwEncodeStatusCompleted;
+            const auto size = lockBitstream.bitstreamSizeInBytes;
+            const auto sliceCount = (std::min)(
+                lockBitstream.numSlices, 
+                static_cast<uint32_t>(sliceOffsets_.size()));
+
+            // A slice is finished once the next one has started, and the last
+            // one once the picture is. Anything in front of the first slice
+            // (SPS/PPS/SEI) goes out with it.
+            const auto readyCount = isCompleted ? 
+                (std::max)(sliceCount, 1U) : 
+                (sliceCount > 0 ? sliceCount - 1 : 0);
+            const auto src = static_cast<const uint8_t *>(lockBitstream.bitstreamBufferPtr);
+
+            for (; emittedSlices < readyCount; ++emittedSlices)
+            {
+                const auto begin = emittedSlices == 0 ? 0 : sliceOffsets_[emittedSlices];
+                const auto end = emittedSlices + 1 < sliceCount ? sliceOffsets_[emittedSlices + 1] : size;
+                if (end <= begin || end > size) continue;
+
+                NvencEncodedData ed;
+                ed.index = outputIndex_;
+                ed.size = end - begin;
+                ed.isLastSlice = false;
+                SetFrameInfo(ed, lockBitstream);
+                ed.userData = resource.userData_;
+                ed.submitTime = resource.submitTime_;
+                ed.completeTime = GetClockMicroseconds();
+                ed.buffer = desc_.bufferPool->Acquire(ed.size);
+                ::memcpy(ed.buffer.get(), src + begin, ed.size);
+                BuildNalIndex(ed.buffer.get(), ed.size, ed.nalIndex);
+                ed.isRecoveryPoint = HasRecoveryPointSei(ed.buffer.get(), ed.size, ed.nalIndex);
+                data.push_back(std::move(ed));
+            }
+
+            CALL_NVENC_API(s_nvenc.nvEncUnlockBitstream, encoder_, resource.bitstreamBuffer_);
+
+            if (isCompleted)
+            {
+                if (data.size() > firstSlice)
+                {
+                    data.back().isLastSlice = true;
+                }
+                break;
+            }
+        }
+        else if (status != NV_ENC_ERR_LOCK_BUSY)
+        {
+            OutputNvencApiError("s_nvenc.nvEncLockBitstream", status);
+        }
+
+        if (steady_clock::now() > timeout)
+        {
+            ThrowError("Timeout when getting encoded slices.");
+            return;
+        }
+
+        // Sleeps until the picture is done or the next look at its slices.
+        if (!isCompletionSignaled)
+        {
+            isCompletionSignaled = WaitForCompletion(index, slicePollInterval);
+        }
+    }
+
+    // Consume the completion signal so that the next use of this slot waits properly.
+    if (!isCompletionSignaled)
+    {
+        WaitForCompletion(index, duration);
+    }
+    resource.state_ = ResourceState::Completed;
+
+    UnmapInputResource(resource.inputTextureIndex_);
+    inputTextures_[resource.inputTextureIndex_].isInUse_ = false;
+
+    resource.state_ = ResourceState::Drained;
+    slotFreedEvent_.Signal();
+}
+
+
+void Nvenc::ReleaseBuffer(uint8_t *, int index)
+{
+    auto &resource = resources_[index];
+    if (resource.state_ != ResourceState::Completed) return;
 
+    try
+    {
         CALL_NVENC_API(s_nvenc.nvEncUnlockBitstream, encoder_, resource.bitstreamBuffer_);
+    }
+    catch (const std::exception &)
+    {
+        // The error has already been reported by ThrowError().
+    }
+
+    resource.state_ = ResourceState::Drained;
+    slotFreedEvent_.Signal();
+}
+
+
+bool Nvenc::WaitForEncodeSlot(DWORD duration)
+{
+    // Only the thread that calls Encode() waits here, so the auto-reset event
+    // keeps a slot freed between CanEncode() and Wait() from being missed.
+    const auto timeout = GetClockMicroseconds() + static_cast<uint64_t>(duration) * 1000;
+    while (!CanEncode())
+    {
+        const auto now = GetClockMicroseconds();
+        if (now >= timeout) return false;
+
+        const auto remaining = static_cast<uint32_t>((timeout - now + 999) / 1000);
+        if (slotFreedEvent_.Wait(remaining) == Event::WaitResult::Failed) return false;
+    }
+    return true;
+}
 
-        UnmapInputResource(index);
 
-        resource.isEncoding_ = false;
+void Nvenc::WaitForPendingEncodes(DWORD duration)
+{
+    using namespace std::chrono;
+    const auto timeout = steady_clock::now() + milliseconds(duration);
+    while (outputIndex_ < inputIndex_)
+    {
+        if (steady_clock::now() > timeout)
+        {
+            ThrowError("Timeout when waiting for pending encodes.");
+            return;
+        }
+        std::this_thread::yield();
     }
 }
 
@@ -536,13 +1040,14 @@ bool Nvenc::WaitForCompletion(int index, DWORD duration)
 
     auto &resource = resources_[index];
 
-    if (::WaitForSingleObject(resource.completionEvent_, duration) == WAIT_FAILED)
+    const auto result = resource.completionEvent_->Wait(duration);
+    if (result == Event::WaitResult::Failed)
     {
         ThrowError("Failed to wait for encode completion.");
         return false;
     }
 
-    return true;
+    return result == Event::WaitResult::Signaled;
 }
 
 
@@ -552,10 +1057,10 @@ void Nvenc::EndEncode()
 
     if (inputIndex_ == 0U) return;
 
-    SendEOS();
-
     std::vector<NvencEncodedData> data;
     GetEncodedData(data);
+
+    SendEOS();
 }
 
 
@@ -563,15 +1068,18 @@ void Nvenc::SendEOS()
 {
     ThrowErrorIfNotInitialized();
 
-    auto &resource = resources_[GetInputIndex()];
-    resource.isEncoding_ = true;
+    const auto index = GetInputIndex();
+    auto &resource = resources_[index];
+    if (!TryAcquireResource(resource)) return;
 
     NV_ENC_PIC_PARAMS picParams = { NV_ENC_PIC_PARAMS_VER };
     picParams.encodePicFlags = NV_ENC_PIC_FLAG_EOS;
-    picParams.completionEvent = resource.completionEvent_;
+    picParams.completionEvent = resource.completionEvent_->GetHandle();
     CALL_NVENC_API(s_nvenc.nvEncEncodePicture, encoder_, &picParams);
 
-    ++inputIndex_;
+    constexpr DWORD duration = 10000;
+    WaitForCompletion(index, duration);
+    resource.state_ = ResourceState::Free;
 }
 
 
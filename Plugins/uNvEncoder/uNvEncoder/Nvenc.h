@@ -3,10 +3,14 @@
 #include <vector>
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <d3d11.h>
 #include <wrl/client.h>
 #include "nvEncodeAPI.h"
 #include "Common.h"
+#include "BufferPool.h"
+#include "AnnexB.h"
+#include "Event.h"
 
 
 namespace uNvEncoder
@@ -18,22 +22,90 @@ struct NvencDesc
     ComPtr<ID3D11Device> d3d11Device; 
     uint32_t width = 1920; 
     uint32_t height = 1080;
+    uint32_t maxWidth = 0;
+    uint32_t maxHeight = 0;
     DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
     uint32_t frameRate = 60;
     uint32_t bitRate = 2'000'000;
     uint32_t maxFrameSize = 2'000'000 / 60;
+    uint32_t pipelineDepth = 3;
+    bool zeroCopy = false;
+    bool subFrameOutput = false;
+    uint32_t sliceCount = 4;
+    std::shared_ptr<BufferPool> bufferPool;
 };
 
 
+// The part of NvencDesc that Reconfigure() can change on a live session.
+struct NvencDynamicParams
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t frameRate = 0;
+    uint32_t bitRate = 0;
+    uint32_t maxFrameSize = 0;
+};
+
+
+// In zero-copy mode, buffer points into the locked NVENC bitstream and
+// dropping it unlocks the bitstream; otherwise it is a copy from the pool.
+// In sub-frame mode one frame arrives as several packets sharing the same
+// index, and only the final one has isLastSlice set. isRecoveryPoint marks
+// the start of an intra refresh wave, where a decoder can join without an
+// IDR frame.
+// timeStamp and userData are the values given to Encode(). The *Time members
+// are GetClockMicroseconds() values taken when the frame was submitted to
+// NVENC and when its completion was picked up.
+// The remaining members are copied from NV_ENC_LOCK_BITSTREAM.
 struct NvencEncodedData
 {
     uint64_t index = 0;
-    std::unique_ptr<uint8_t[]> buffer;
+    PooledBuffer buffer;
     uint32_t size = 0;
+    bool isLastSlice = true;
+    bool isIdrFrame = false;
+    bool isRecoveryPoint = false;
+    uint64_t timeStamp = 0;
+    uint64_t userData = 0;
+    uint64_t submitTime = 0;
+    uint64_t completeTime = 0;
+    uint32_t frameIndex = 0;
+    NV_ENC_PIC_TYPE pictureType = NV_ENC_PIC_TYPE_UNKNOWN;
+    uint32_t averageQp = 0;
+    uint32_t satd = 0;
+    bool isLtrFrame = false;
+    uint32_t ltrFrameIndex = 0;
+    uint32_t intraMbCount = 0;
+    uint32_t interMbCount = 0;
+    int32_t averageMvX = 0;
+    int32_t averageMvY = 0;
+    BitstreamFormat format = BitstreamFormat::AnnexB;
+    NalIndex nalIndex;
 };
 
 
-class Nvenc final
+// Once filters and sinks are done with a packet it is frozen and shared by
+// the consumer queue and every subscriber; the payload is released, or
+// unlocked in zero-copy mode, when the last reference is dropped.
+using EncodedPacketRef = std::shared_ptr<const NvencEncodedData>;
+
+
+inline bool IsRandomAccessPoint(const NvencEncodedData &ed)
+{
+    return ed.isIdrFrame || ed.isRecoveryPoint;
+}
+
+
+// Frames from one intra refresh wave, and so one recovery point, to the
+// next. A GOP is never longer than this.
+inline uint32_t GetIntraRefreshPeriod(uint32_t frameRate)
+{
+    constexpr uint32_t intraRefreshInterval = 2; // [s]
+    return (frameRate > 0 ? frameRate : 1) * intraRefreshInterval;
+}
+
+
+class Nvenc final : public BufferOwner
 {
 public:
     explicit Nvenc(const NvencDesc &desc);
@@ -41,16 +113,24 @@ public:
     void Initialize();
     void Finalize();
     bool IsValid() const { return encoder_ != nullptr; }
+    bool CanEncode() const;
     void Reconfigure(const NvencDesc &desc);
-    void Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame);
+    void Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame, uint64_t timeStamp = 0, uint64_t userData = 0);
+    void WarmUp(int frameCount);
+    bool WaitForEncodeSlot(DWORD duration);
+    void WaitForPendingEncodes(DWORD duration);
     void GetEncodedData(std::vector<NvencEncodedData> &data);
+    void GetCompletedEncodedData(std::vector<NvencEncodedData> &data, bool isCompletionSignaled);
+    Event * GetPendingCompletionEvent() const;
+    void GetSequenceParams(std::vector<uint8_t> &params);
 
 private:
     void ThrowErrorIfNotInitialized();
 
     void OpenEncodeSession();
     void InitializeEncoder();
-    void CreateInitializeParams();
+    int GetCapability(NV_ENC_CAPS caps);
+    void CreateInitializeParams(const NvencDynamicParams &params);
     void DestroyEncoder();
     void CreateCompletionEvents();
     void DestroyCompletionEvents();
@@ -60,46 +140,99 @@ private:
     void RegisterResources();
     void UnregisterResources();
 
-    void CopyToInputTexture(int index, const ComPtr<ID3D11Texture2D> &texture);
-    bool EncodeInputTexture(int index, bool forceIdrFrame);
-    void MapInputResource(int index);
-    void UnmapInputResource(int index);
+    NvencDynamicParams GetDynamicParams() const;
+    void CopyToInputTexture(int textureIndex, const ComPtr<ID3D11Texture2D> &texture, const NvencDynamicParams &params);
+    bool EncodeInputTexture(int index, bool forceIdrFrame, const NvencDynamicParams &params);
+    void MapInputResource(int textureIndex);
+    void UnmapInputResource(int textureIndex);
+    void ReleaseBuffer(uint8_t *buffer, int index) override;
+    void ReadEncodedData(int index, std::vector<NvencEncodedData> &data);
+    void GetEncodedSlices(int index, std::vector<NvencEncodedData> &data);
     bool WaitForCompletion(int index, DWORD duration);
     void EndEncode();
     void SendEOS();
 
     unsigned long GetResourceCount() const { return static_cast<unsigned long>(resources_.size()); }
+    unsigned long GetInputTextureCount() const { return static_cast<unsigned long>(inputTextures_.size()); }
     unsigned long GetInputIndex() const { return inputIndex_ % GetResourceCount(); }
     unsigned long GetOutputIndex() const { return outputIndex_ % GetResourceCount(); }
 
-    NvencDesc desc_;
+    // A slot is owned by the Unity thread while Free/Drained -> Copying -> Submitted,
+    // and by the encode thread while Submitted -> Completed -> Drained.
+    // In zero-copy mode a slot stays Completed while its bitstream is locked
+    // and becomes Drained when the consumer drops the packet.
+    enum class ResourceState
+    {
+        Free,
+        Copying,
+        Submitted,
+        Completed,
+        Drained,
+    };
+
+    struct Resource;
+    bool TryAcquireResource(Resource &resource);
+    void ReleaseInput(Resource &resource, int textureIndex);
+
+    // Fixed at construction so that the drain thread can read it without a
+    // lock. Its size and rate members are only the initial values; the
+    // current ones are in params_.
+    const NvencDesc desc_;
+    NvencDynamicParams params_;
+    mutable std::mutex paramsMutex_;
     NV_ENC_INITIALIZE_PARAMS initParams_ = { NV_ENC_INITIALIZE_PARAMS_VER };
     NV_ENC_CONFIG encConfig_ = { NV_ENC_CONFIG_VER };;
     bool isInitialized_ = false;
+    bool isDynamicBitRateChangeSupported_ = false;
+    bool isDynamicResolutionChangeSupported_ = false;
     void *encoder_ = nullptr;
-    uint64_t inputIndex_ = 0U;
-    uint64_t outputIndex_ = 0U;
+    std::atomic<uint64_t> inputIndex_ { 0U };
+    std::atomic<uint64_t> outputIndex_ { 0U };
 
-    struct Resource
+    struct InputTexture
     {
         ComPtr<ID3D11Texture2D> inputTexture_ = nullptr;
         HANDLE inputTextureSharedHandle_ = nullptr;
         NV_ENC_REGISTERED_PTR registeredResource_ = nullptr;
         NV_ENC_INPUT_PTR inputResource_ = nullptr;
+        std::atomic<bool> isInUse_ { false };
+    };
+    std::vector<InputTexture> inputTextures_;
+
+    // Output slots outnumber input textures in zero-copy mode so that locked
+    // bitstreams held by the consumer do not stall the encoder.
+    struct Resource
+    {
+        int inputTextureIndex_ = -1;
         NV_ENC_OUTPUT_PTR bitstreamBuffer_ = nullptr;
-        void *completionEvent_ = nullptr;
-        std::atomic<bool> isEncoding_ = false;
+        std::unique_ptr<Event> completionEvent_;
+        uint64_t timeStamp_ = 0;
+        uint64_t userData_ = 0;
+        uint64_t submitTime_ = 0;
+        std::atomic<ResourceState> state_ { ResourceState::Free };
     };
     std::vector<Resource> resources_;
+    std::vector<uint32_t> sliceOffsets_;
+
+    // Signaled whenever draining or releasing a packet frees a slot or an
+    // input texture.
+    Event slotFreedEvent_;
 
 public:
     static void LoadModule();
     static void UnloadModule();
 
+    // Uses functionList instead of the functions of the NVENC DLL, e.g. a fake
+    // encoder in tests. Must be called before any encoder is initialized;
+    // nullptr goes back to loading the DLL.
+    static void SetFunctionList(const NV_ENCODE_API_FUNCTION_LIST *functionList);
+
 private:
     static HMODULE s_module;
     static NV_ENCODE_API_FUNCTION_LIST s_nvenc;
     static uint32_t s_referenceCount;
+    static bool s_hasExternalFunctionList;
+    static std::mutex s_moduleMutex;
 };
 
 
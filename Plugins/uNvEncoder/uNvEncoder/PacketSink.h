@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Nvenc.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Receives every encoded packet on the thread that drains the encoder, before
+// the packet is queued for the consumer. The payload is only valid during
+// Write(), and Write() should not block for long since it delays the queue.
+// Sinks that want length-prefixed packets say so in GetFormat(); the encoder
+// converts each packet once for all sinks that share a format.
+class PacketSink
+{
+public:
+    virtual ~PacketSink() = default;
+    virtual BitstreamFormat GetFormat() const { return BitstreamFormat::AnnexB; }
+    virtual void Write(const NvencEncodedData &data) = 0;
+};
+
+
+}
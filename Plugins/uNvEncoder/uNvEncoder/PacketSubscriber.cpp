@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <iterator>
+#include "PacketSubscriber.h"
+
+
+namespace uNvEncoder
+{
+
+
+PacketSubscriber::PacketSubscriber(size_t capacity, BackpressurePolicy policy)
+    : capacity_((std::max)(capacity, static_cast<size_t>(1)))
+    , policy_(policy)
+{
+    popped_.reserve(capacity_);
+}
+
+
+bool PacketSubscriber::Push(const EncodedPacketRef &packet)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Slices of one frame share the index, so only the first packet of an
+    // IDR frame or a recovery point starts a new GOP.
+    const bool isGopStart = IsRandomAccessPoint(*packet) && packet->index != lastIndex_;
+    lastIndex_ = packet->index;
+
+    if (isWaitingForIdrFrame_ && !isGopStart)
+    {
+        ++droppedCount_;
+        return false;
+    }
+    isWaitingForIdrFrame_ = false;
+
+    if (policy_ == BackpressurePolicy::Coalesce && isGopStart)
+    {
+        // The consumer only needs the latest GOP to decode the next frame.
+        DropQueuedPackets(queue_.size());
+    }
+
+    bool isDropped = false;
+    if (queue_.size() == capacity_)
+    {
+        switch (policy_)
+        {
+            case BackpressurePolicy::DropOldest:
+            {
+                // Drop whole GOPs so that the queue still starts where a decoder can join.
+                size_t n = 1;
+                while (n < queue_.size() && !IsGopStart(n)) ++n;
+                DropQueuedPackets(n);
+                break;
+            }
+            case BackpressurePolicy::Coalesce:
+            {
+                DropQueuedPackets(queue_.size());
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+        isDropped = true;
+    }
+
+    // The packet is useless if the GOP it belongs to has just been dropped.
+    if (queue_.size() == capacity_ || (isDropped && queue_.empty() && !isGopStart))
+    {
+        ++droppedCount_;
+        isWaitingForIdrFrame_ = true;
+        return false;
+    }
+
+    queue_.push_back(packet);
+    return !isDropped;
+}
+
+
+const std::vector<EncodedPacketRef> & PacketSubscriber::Pop(size_t maxCount)
+{
+    // Drop the previous packets outside the lock; in zero-copy mode this
+    // unlocks NVENC bitstreams.
+    popped_.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto n = (std::min)(maxCount, queue_.size());
+    const auto end = queue_.begin() + n;
+    popped_.assign(std::make_move_iterator(queue_.begin()), std::make_move_iterator(end));
+    queue_.erase(queue_.begin(), end);
+    return popped_;
+}
+
+
+void PacketSubscriber::Release()
+{
+    popped_.clear();
+}
+
+
+bool PacketSubscriber::IsGopStart(size_t i) const
+{
+    return IsRandomAccessPoint(*queue_[i]) && queue_[i]->index != queue_[i - 1]->index;
+}
+
+
+void PacketSubscriber::DropQueuedPackets(size_t count)
+{
+    droppedCount_ += count;
+    queue_.erase(queue_.begin(), queue_.begin() + count);
+}
+
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "Nvenc.h"
+
+
+namespace uNvEncoder
+{
+
+
+enum class BackpressurePolicy : int
+{
+    Error = 0,
+    Block = 1,
+    DropNewest = 2,
+    DropOldest = 3,
+    Coalesce = 4,
+};
+
+
+// Bounded queue of shared packets for one consumer. The drain thread pushes
+// the same packet to every subscriber, so a slow subscriber only fills its own
+// queue. A new subscriber and one that has just dropped a packet skip
+// packets until the next IDR frame or recovery point, since those would
+// reference frames the consumer never got. Block and Error behave as DropNewest
+// here since waiting on one subscriber would stall all the others.
+class PacketSubscriber final
+{
+public:
+    PacketSubscriber(size_t capacity, BackpressurePolicy policy);
+    PacketSubscriber(const PacketSubscriber &) = delete;
+    PacketSubscriber & operator=(const PacketSubscriber &) = delete;
+
+    // Drain thread only. Returns false if a packet was dropped.
+    bool Push(const EncodedPacketRef &packet);
+
+    // Consumer thread only. The packets stay alive until the next Pop() or
+    // Release().
+    const std::vector<EncodedPacketRef> & Pop(size_t maxCount);
+    void Release();
+
+    size_t GetCapacity() const { return capacity_; }
+    uint64_t GetDroppedCount() const { return droppedCount_; }
+
+private:
+    bool IsGopStart(size_t i) const;
+    void DropQueuedPackets(size_t count);
+
+    const size_t capacity_;
+    const BackpressurePolicy policy_;
+    std::deque<EncodedPacketRef> queue_;
+    std::mutex mutex_;
+    bool isWaitingForIdrFrame_ = true;
+    uint64_t lastIndex_ = UINT64_MAX;
+    std::vector<EncodedPacketRef> popped_;
+    std::atomic<uint64_t> droppedCount_ { 0 };
+};
+
+
+}
@@ -0,0 +1,213 @@
+#include <vector>
+#include "ParameterSets.h"
+#include "AnnexB.h"
+#include "BitReader.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    constexpr uint32_t extendedSar = 255;
+
+    // Table E-1
+    constexpr int sarTable[][2] = 
+    {
+        { 0, 0 }, { 1, 1 }, { 12, 11 }, { 10, 11 }, { 16, 11 }, { 40, 33 }, { 24, 11 }, { 20, 11 }, 
+        { 32, 11 }, { 80, 33 }, { 18, 11 }, { 15, 11 }, { 64, 33 }, { 160, 99 }, { 4, 3 }, { 3, 2 }, 
+        { 2, 1 }, 
+    };
+
+    bool HasChromaFormat(uint32_t profileIdc)
+    {
+        switch (profileIdc)
+        {
+            case 100: case 110: case 122: case 244: case 44:
+            case 83: case 86: case 118: case 128: case 138:
+            case 139: case 134: case 135:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void SkipScalingList(BitReader &reader, int size)
+    {
+        int lastScale = 8;
+        int nextScale = 8;
+        for (int i = 0; i < size; ++i)
+        {
+            if (nextScale != 0)
+            {
+                nextScale = (lastScale + reader.Se() + 256) % 256;
+            }
+            lastScale = nextScale == 0 ? lastScale : nextScale;
+        }
+    }
+
+    void ParseVui(BitReader &reader, ParameterSetInfo &info)
+    {
+        if (reader.U1())
+        {
+            const auto aspectRatioIdc = reader.U(8);
+            if (aspectRatioIdc == extendedSar)
+            {
+                info.sarWidth = static_cast<int>(reader.U(16));
+                info.sarHeight = static_cast<int>(reader.U(16));
+            }
+            else if (aspectRatioIdc < sizeof(sarTable) / sizeof(sarTable[0]))
+            {
+                info.sarWidth = sarTable[aspectRatioIdc][0];
+                info.sarHeight = sarTable[aspectRatioIdc][1];
+            }
+        }
+
+        if (reader.U1()) reader.U1(); // overscan_appropriate_flag
+
+        if (reader.U1())
+        {
+            info.videoFormat = static_cast<int>(reader.U(3));
+            info.isVideoFullRange = reader.U1() != 0;
+            if (reader.U1())
+            {
+                info.colourPrimaries = static_cast<int>(reader.U(8));
+                info.transferCharacteristics = static_cast<int>(reader.U(8));
+                info.matrixCoefficients = static_cast<int>(reader.U(8));
+            }
+        }
+
+        if (reader.U1())
+        {
+            reader.Ue(); // chroma_sample_loc_type_top_field
+            reader.Ue(); // chroma_sample_loc_type_bottom_field
+        }
+
+        info.hasTimingInfo = reader.U1() != 0;
+        if (info.hasTimingInfo)
+        {
+            info.numUnitsInTick = reader.U(32);
+            info.timeScale = reader.U(32);
+            info.isFixedFrameRate = reader.U1() != 0;
+        }
+
+        // HRD and bitstream restriction are not needed by any sink.
+    }
+
+    bool ParseSps(const uint8_t *data, size_t size, ParameterSetInfo &info)
+    {
+        BitReader reader(data, size);
+        reader.U(8); // NAL unit header
+
+        info.profileIdc = static_cast<int>(reader.U(8));
+        info.constraintFlags = static_cast<int>(reader.U(8));
+        info.levelIdc = static_cast<int>(reader.U(8));
+        info.spsId = static_cast<int>(reader.Ue());
+
+        bool isSeparateColourPlane = false;
+        if (HasChromaFormat(info.profileIdc))
+        {
+            info.chromaFormatIdc = static_cast<int>(reader.Ue());
+            if (info.chromaFormatIdc == 3) isSeparateColourPlane = reader.U1() != 0;
+            info.bitDepthLuma = static_cast<int>(reader.Ue()) + 8;
+            info.bitDepthChroma = static_cast<int>(reader.Ue()) + 8;
+            reader.U1(); // qpprime_y_zero_transform_bypass_flag
+            if (reader.U1())
+            {
+                const int listCount = info.chromaFormatIdc != 3 ? 8 : 12;
+                for (int i = 0; i < listCount; ++i)
+                {
+                    if (reader.U1()) SkipScalingList(reader, i < 6 ? 16 : 64);
+                }
+            }
+        }
+
+        reader.Ue(); // log2_max_frame_num_minus4
+        const auto picOrderCntType = reader.Ue();
+        if (picOrderCntType == 0)
+        {
+            reader.Ue(); // log2_max_pic_order_cnt_lsb_minus4
+        }
+        else if (picOrderCntType == 1)
+        {
+            reader.U1();
+            reader.Se();
+            reader.Se();
+            const auto cycleCount = reader.Ue();
+            for (uint32_t i = 0; i < cycleCount && !reader.HasError(); ++i) reader.Se();
+        }
+
+        info.maxNumRefFrames = static_cast<int>(reader.Ue());
+        reader.U1(); // gaps_in_frame_num_value_allowed_flag
+        const auto widthInMbs = reader.Ue() + 1;
+        const auto heightInMapUnits = reader.Ue() + 1;
+        info.frameMbsOnly = reader.U1() != 0;
+        if (!info.frameMbsOnly) reader.U1(); // mb_adaptive_frame_field_flag
+        reader.U1(); // direct_8x8_inference_flag
+
+        uint32_t cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+        if (reader.U1())
+        {
+            cropLeft = reader.Ue();
+            cropRight = reader.Ue();
+            cropTop = reader.Ue();
+            cropBottom = reader.Ue();
+        }
+
+        // 7.4.2.1.1, crop offsets are in chroma sample units.
+        const bool hasChroma = info.chromaFormatIdc != 0 && !isSeparateColourPlane;
+        const auto subWidthC = hasChroma && info.chromaFormatIdc != 3 ? 2U : 1U;
+        const auto subHeightC = hasChroma && info.chromaFormatIdc == 1 ? 2U : 1U;
+        const auto frameHeightFactor = info.frameMbsOnly ? 1U : 2U;
+        const auto cropUnitX = subWidthC;
+        const auto cropUnitY = subHeightC * frameHeightFactor;
+        info.width = static_cast<int>(widthInMbs * 16 - cropUnitX * (cropLeft + cropRight));
+        info.height = static_cast<int>(heightInMapUnits * 16 * frameHeightFactor - cropUnitY * (cropTop + cropBottom));
+
+        info.hasVui = reader.U1() != 0;
+        if (info.hasVui) ParseVui(reader, info);
+
+        return !reader.HasError() && info.width > 0 && info.height > 0;
+    }
+
+    bool ParsePps(const uint8_t *data, size_t size, ParameterSetInfo &info)
+    {
+        BitReader reader(data, size);
+        reader.U(8); // NAL unit header
+
+        info.ppsId = static_cast<int>(reader.Ue());
+        reader.Ue(); // seq_parameter_set_id
+        info.isCabac = reader.U1() != 0;
+
+        return !reader.HasError();
+    }
+}
+
+
+bool ParseParameterSets(const uint8_t *data, size_t size, ParameterSetInfo &info)
+{
+    std::vector<NalUnit> units;
+    ParseNalUnits(data, size, units);
+
+    bool hasSps = false;
+    bool hasPps = false;
+    for (const auto &unit : units)
+    {
+        if (unit.type == NalUnitTypeSps && !hasSps)
+        {
+            if (!ParseSps(data + unit.offset, unit.size, info)) return false;
+            hasSps = true;
+        }
+        else if (unit.type == NalUnitTypePps && !hasPps)
+        {
+            if (!ParsePps(data + unit.offset, unit.size, info)) return false;
+            hasPps = true;
+        }
+    }
+
+    return hasSps && hasPps;
+}
+
+
+}
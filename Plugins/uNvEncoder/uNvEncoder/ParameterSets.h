@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace uNvEncoder
+{
+
+
+// Fields of an H.264 SPS/PPS pair that sinks need for container headers and
+// session descriptions. width and height are the cropped picture size.
+// Laid out for C#: 4-byte fields first, then the flags.
+struct ParameterSetInfo
+{
+    int profileIdc = 0;
+    int constraintFlags = 0;
+    int levelIdc = 0;
+    int spsId = 0;
+    int ppsId = 0;
+    int chromaFormatIdc = 1;
+    int bitDepthLuma = 8;
+    int bitDepthChroma = 8;
+    int width = 0;
+    int height = 0;
+    int maxNumRefFrames = 0;
+    int sarWidth = 1;
+    int sarHeight = 1;
+    int videoFormat = 5;
+    int colourPrimaries = 2;
+    int transferCharacteristics = 2;
+    int matrixCoefficients = 2;
+    uint32_t numUnitsInTick = 0;
+    uint32_t timeScale = 0;
+    bool frameMbsOnly = true;
+    bool hasVui = false;
+    bool isVideoFullRange = false;
+    bool hasTimingInfo = false;
+    bool isFixedFrameRate = false;
+    bool isCabac = false;
+};
+
+
+// Parses the first SPS and PPS found in an Annex-B buffer. Returns false
+// when either one is missing or malformed.
+bool ParseParameterSets(const uint8_t *data, size_t size, ParameterSetInfo &info);
+
+
+}
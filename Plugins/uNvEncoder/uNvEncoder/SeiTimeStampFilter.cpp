@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cstring>
+#include "SeiTimeStampFilter.h"
+#include "ByteWriter.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    constexpr uint8_t userDataUnregistered = 5;
+
+    // Identifies the payload layout for receivers.
+    constexpr uint8_t timeStampUuid[16] = 
+    {
+        0x75, 0x4E, 0x76, 0x45, 0x6E, 0x63, 0x6F, 0x64, 
+        0x65, 0x72, 0x54, 0x69, 0x6D, 0x65, 0x00, 0x01, 
+    };
+
+    void WriteEmulationPrevented(std::vector<uint8_t> &nal, const std::vector<uint8_t> &rbsp)
+    {
+        int zeroCount = 0;
+        for (const auto byte : rbsp)
+        {
+            if (zeroCount == 2 && byte <= 0x03)
+            {
+                nal.push_back(0x03);
+                zeroCount = 0;
+            }
+            nal.push_back(byte);
+            zeroCount = byte == 0 ? zeroCount + 1 : 0;
+        }
+    }
+
+    bool IsSlice(uint8_t type)
+    {
+        return type == NalUnitTypeSlice || type == NalUnitTypeIdrSlice;
+    }
+}
+
+
+SeiTimeStampFilter::SeiTimeStampFilter()
+{
+    rbsp_.reserve(64);
+    sei_.reserve(64);
+}
+
+
+bool SeiTimeStampFilter::Filter(NvencEncodedData &data, bool, BufferPool &pool)
+{
+    const bool isFirstSlice = !isInFrame_;
+    isInFrame_ = !data.isLastSlice;
+    if (!isFirstSlice) return true;
+
+    nalUnits_.clear();
+    AppendNalUnits(data.buffer.get(), data.size, &data.nalIndex, 0, nalUnits_);
+
+    const auto slice = std::find_if(nalUnits_.begin(), nalUnits_.end(), [](const NalUnit &unit)
+    {
+        return IsSlice(unit.type);
+    });
+    if (slice == nalUnits_.end()) return true;
+
+    rbsp_.clear();
+    {
+        ByteWriter writer(rbsp_);
+        writer.U8(userDataUnregistered);
+        writer.U8(sizeof(timeStampUuid) + 16);
+        writer.Bytes(timeStampUuid, sizeof(timeStampUuid));
+        writer.U64(data.timeStamp);
+        writer.U64(data.userData);
+        writer.U8(0x80); // rbsp_trailing_bits
+    }
+
+    sei_.clear();
+    sei_.insert(sei_.end(), { 0x00, 0x00, 0x00, 0x01, NalUnitTypeSei });
+    WriteEmulationPrevented(sei_, rbsp_);
+
+    // The SEI goes right before the slice's start code.
+    const auto insertOffset = slice->offset - slice->startCodeSize;
+    const auto size = data.size + sei_.size();
+    auto buffer = pool.Acquire(size);
+    const auto src = data.buffer.get();
+    const auto dst = buffer.get();
+    ::memcpy(dst, src, insertOffset);
+    ::memcpy(dst + insertOffset, sei_.data(), sei_.size());
+    ::memcpy(dst + insertOffset + sei_.size(), src + insertOffset, data.size - insertOffset);
+
+    data.buffer = std::move(buffer);
+    data.size = static_cast<uint32_t>(size);
+    BuildNalIndex(data.buffer.get(), data.size, data.nalIndex);
+    return true;
+}
+
+
+}
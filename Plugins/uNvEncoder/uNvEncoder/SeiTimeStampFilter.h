@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include "BitstreamFilter.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Inserts a user_data_unregistered SEI in front of the first slice of every
+// frame carrying the frame's timeStamp and userData (big-endian 64-bit each),
+// so that receivers can match decoded frames to capture times.
+class SeiTimeStampFilter final : public BitstreamFilter
+{
+public:
+    SeiTimeStampFilter();
+    bool Filter(NvencEncodedData &data, bool isWritable, BufferPool &pool) override;
+
+private:
+    bool isInFrame_ = false;
+    std::vector<NalUnit> nalUnits_;
+    std::vector<uint8_t> rbsp_;
+    std::vector<uint8_t> sei_;
+};
+
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+
+namespace uNvEncoder
+{
+
+
+constexpr size_t CacheLineSize = 64;
+
+
+// Bounded ring buffer for exactly one producer thread and one consumer thread.
+// Push() and Pop() never block and never allocate; slots are reused in place.
+template <class T>
+class SpscQueue final
+{
+public:
+    explicit SpscQueue(size_t capacity)
+        : capacity_(RoundUpToPowerOfTwo(capacity))
+        , mask_(capacity_ - 1)
+        , buffer_(std::make_unique<T[]>(capacity_))
+    {
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue & operator=(const SpscQueue &) = delete;
+
+    // Producer thread only.
+    bool Push(T &&value)
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ == capacity_)
+        {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ == capacity_) return false;
+        }
+
+        buffer_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only.
+    bool Pop(T &value)
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_)
+        {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_) return false;
+        }
+
+        value = std::move(buffer_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t GetSize() const
+    {
+        const auto head = head_.load(std::memory_order_acquire);
+        const auto tail = tail_.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    size_t GetCapacity() const { return capacity_; }
+    bool IsEmpty() const { return GetSize() == 0; }
+
+private:
+    static size_t RoundUpToPowerOfTwo(size_t n)
+    {
+        size_t size = 1;
+        while (size < n) size <<= 1;
+        return size;
+    }
+
+    const size_t capacity_;
+    const size_t mask_;
+    const std::unique_ptr<T[]> buffer_;
+
+    // The consumer-owned and producer-owned indices live on separate cache lines
+    // so that the two threads do not invalidate each other on every push/pop.
+    alignas(CacheLineSize) std::atomic<size_t> head_ { 0 };
+    size_t cachedTail_ = 0;
+    alignas(CacheLineSize) std::atomic<size_t> tail_ { 0 };
+    size_t cachedHead_ = 0;
+};
+
+
+}